@@ -0,0 +1,25 @@
+#version 450
+
+layout (location = 0) in vec3 inColor;
+layout (location = 1) in vec3 inBarycentric;
+
+layout (location = 0) out vec4 outFragColor;
+
+layout(push_constant) uniform PushConsts {
+	mat4 mvp;
+	vec2 viewport;
+	float edgePixels;
+	uint target;
+} pushConsts;
+
+void main() 
+{
+	// buildVertex keeps the three corner triangles of every split and drops the middle one. On a
+	// 2^target grid of barycentric cells that leaves the cells whose coordinates together set every bit
+	uint n = 1u << pushConsts.target;
+	uvec3 cell = uvec3(min(inBarycentric * float(n), vec3(n - 1u)));
+	if ((cell.x | cell.y | cell.z) != n - 1u) {
+		discard;
+	}
+	outFragColor = vec4(inColor, 1.0);
+}
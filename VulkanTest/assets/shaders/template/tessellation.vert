@@ -0,0 +1,14 @@
+#version 450
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inColor;
+
+layout (location = 0) out vec3 outPos;
+layout (location = 1) out vec3 outColor;
+
+// Seed triangles go to the control shader untransformed, they are projected per tessellated vertex
+void main() 
+{
+	outPos = inPos;
+	outColor = inColor;
+}
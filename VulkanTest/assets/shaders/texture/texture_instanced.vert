@@ -0,0 +1,25 @@
+#version 450
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inColor;
+layout (location = 2) in vec2 inTexCoord;
+// Per instance: xyz translation, w uniform scale
+layout (location = 3) in vec4 inInstance;
+
+layout (location = 0) out vec3 fragColor;
+layout (location = 1) out vec2 fragTexCoord;
+
+out gl_PerVertex {
+	vec4 gl_Position;   
+};
+
+layout(push_constant) uniform PushConsts {
+	mat4 mvp;
+} pushConsts;
+
+void main() 
+{
+	fragColor = inColor;
+	fragTexCoord = inTexCoord;
+	gl_Position = pushConsts.mvp * vec4(inPos.xyz * inInstance.w + inInstance.xyz, 1.0);
+}
@@ -0,0 +1,416 @@
+/*
+* Block based device memory allocator
+*/
+
+#include "allocator.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace myvk
+{
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Check if the last byte of one range and the first byte of the next one share a page
+static bool onSamePage(VkDeviceSize lastByteOfFirst, VkDeviceSize firstByteOfSecond, VkDeviceSize pageSize)
+{
+    return (lastByteOfFirst & ~(pageSize - 1)) == (firstByteOfSecond & ~(pageSize - 1));
+}
+
+static bool tilingConflict(AllocationTiling a, AllocationTiling b)
+{
+    return a != ALLOCATION_TILING_FREE && b != ALLOCATION_TILING_FREE && a != b;
+}
+
+static double toMiB(VkDeviceSize bytes)
+{
+    return (double)bytes / (1024.0 * 1024.0);
+}
+
+void Allocator::create(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudget, VkDeviceSize blockSize)
+{
+    this->device = device;
+    this->blockSize = blockSize;
+    selector.create(instance, physicalDevice, memoryBudget);
+    memoryProperties = selector.getMemoryProperties();
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    bufferImageGranularity = std::max<VkDeviceSize>(deviceProperties.limits.bufferImageGranularity, 1);
+    maxMemoryAllocationCount = deviceProperties.limits.maxMemoryAllocationCount;
+    nonCoherentAtomSize = std::max<VkDeviceSize>(deviceProperties.limits.nonCoherentAtomSize, 1);
+
+    blocks.resize(memoryProperties.memoryTypeCount);
+}
+
+void Allocator::destroy()
+{
+    for (auto &typeBlocks : blocks)
+    {
+        for (auto block : typeBlocks)
+        {
+            if (block->mapped != nullptr)
+            {
+                vkUnmapMemory(device, block->memory);
+            }
+            vkFreeMemory(device, block->memory, nullptr);
+            selector.trackFree(block->memoryTypeIndex, block->size);
+            delete block;
+        }
+        typeBlocks.clear();
+    }
+    blockBytes = 0;
+    usedBytes = 0;
+}
+
+VkDeviceSize Allocator::preferredBlockSize(uint32_t memoryTypeIndex) const
+{
+    uint32_t heapIndex = memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[heapIndex].size;
+    // Small heaps (e.g. 256 MiB BAR windows) would be used up by a handful of default sized blocks
+    if (heapSize <= 1024ull * 1024 * 1024)
+    {
+        return std::min(blockSize, heapSize / 8);
+    }
+    return blockSize;
+}
+
+uint32_t Allocator::totalBlockCount() const
+{
+    uint32_t count = 0;
+    for (auto &typeBlocks : blocks)
+    {
+        count += static_cast<uint32_t>(typeBlocks.size());
+    }
+    return count;
+}
+
+VkResult Allocator::createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated, MemoryBlock *&block)
+{
+    if (totalBlockCount() >= maxMemoryAllocationCount)
+    {
+        return VK_ERROR_TOO_MANY_OBJECTS;
+    }
+
+    VkMemoryAllocateInfo memAlloc = myvk::initializers::memoryAllocateInfo();
+    memAlloc.allocationSize = size;
+    memAlloc.memoryTypeIndex = memoryTypeIndex;
+    VkDeviceMemory memory;
+    VkResult result = vkAllocateMemory(device, &memAlloc, nullptr, &memory);
+    if (result != VK_SUCCESS)
+    {
+        return result;
+    }
+
+    block = new MemoryBlock();
+    block->memory = memory;
+    block->size = size;
+    block->memoryTypeIndex = memoryTypeIndex;
+    block->dedicated = dedicated;
+    block->suballocations.push_back({0, size, ALLOCATION_TILING_FREE});
+    if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        VK_CHECK_RESULT(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &block->mapped));
+    }
+    blocks[memoryTypeIndex].push_back(block);
+    selector.trackAllocation(memoryTypeIndex, size);
+
+    blockBytes += size;
+    peakBlockBytes = std::max(peakBlockBytes, blockBytes);
+    return VK_SUCCESS;
+}
+
+void Allocator::destroyBlock(MemoryBlock *block)
+{
+    auto &typeBlocks = blocks[block->memoryTypeIndex];
+    typeBlocks.erase(std::find(typeBlocks.begin(), typeBlocks.end(), block));
+    if (block->mapped != nullptr)
+    {
+        vkUnmapMemory(device, block->memory);
+    }
+    vkFreeMemory(device, block->memory, nullptr);
+    selector.trackFree(block->memoryTypeIndex, block->size);
+    blockBytes -= block->size;
+    delete block;
+}
+
+bool Allocator::allocateFromBlock(MemoryBlock *block, const VkMemoryRequirements &memReqs, AllocationTiling tiling, Allocation &allocation)
+{
+    auto &suballocations = block->suballocations;
+    auto best = suballocations.end();
+    VkDeviceSize bestOffset = 0;
+
+    // Best fit over the free ranges
+    for (auto it = suballocations.begin(); it != suballocations.end(); ++it)
+    {
+        if (it->tiling != ALLOCATION_TILING_FREE || it->size < memReqs.size)
+        {
+            continue;
+        }
+        VkDeviceSize offset = alignUp(it->offset, memReqs.alignment);
+        // Move away from the previous resource if it has a different tiling on the same page
+        if (bufferImageGranularity > 1 && it != suballocations.begin())
+        {
+            auto prev = std::prev(it);
+            if (tilingConflict(prev->tiling, tiling) && onSamePage(prev->offset + prev->size - 1, offset, bufferImageGranularity))
+            {
+                offset = alignUp(offset, bufferImageGranularity);
+            }
+        }
+        if (offset + memReqs.size > it->offset + it->size)
+        {
+            continue;
+        }
+        // The next resource can't be moved, so skip this range if it would share a page with it
+        auto next = std::next(it);
+        if (bufferImageGranularity > 1 && next != suballocations.end() &&
+            tilingConflict(tiling, next->tiling) && onSamePage(offset + memReqs.size - 1, next->offset, bufferImageGranularity))
+        {
+            continue;
+        }
+        if (best == suballocations.end() || it->size < best->size)
+        {
+            best = it;
+            bestOffset = offset;
+        }
+    }
+
+    if (best == suballocations.end())
+    {
+        return false;
+    }
+
+    // Split the free range into leading padding, the allocation and the remainder
+    VkDeviceSize freeBegin = best->offset;
+    VkDeviceSize freeEnd = best->offset + best->size;
+    VkDeviceSize allocationEnd = bestOffset + memReqs.size;
+    if (bestOffset > freeBegin)
+    {
+        suballocations.insert(best, {freeBegin, bestOffset - freeBegin, ALLOCATION_TILING_FREE});
+    }
+    best->offset = bestOffset;
+    best->size = memReqs.size;
+    best->tiling = tiling;
+    if (allocationEnd < freeEnd)
+    {
+        suballocations.insert(std::next(best), {allocationEnd, freeEnd - allocationEnd, ALLOCATION_TILING_FREE});
+    }
+
+    block->usedBytes += memReqs.size;
+    block->allocationCount++;
+    usedBytes += memReqs.size;
+    peakUsedBytes = std::max(peakUsedBytes, usedBytes);
+
+    allocation.memory = block->memory;
+    allocation.offset = bestOffset;
+    allocation.size = memReqs.size;
+    allocation.memoryTypeIndex = block->memoryTypeIndex;
+    allocation.mapped = block->mapped != nullptr ? static_cast<char *>(block->mapped) + bestOffset : nullptr;
+    allocation.block = block;
+    return true;
+}
+
+VkResult Allocator::allocate(const VkMemoryRequirements &memReqs, MemoryUsage usage, AllocationTiling tiling, Allocation &allocation)
+{
+    assert(tiling != ALLOCATION_TILING_FREE);
+    MemoryTypeFlags flags = memoryUsageFlags(usage);
+    uint32_t typeBits = memReqs.memoryTypeBits;
+    uint32_t memoryTypeIndex;
+    VkResult result = VK_ERROR_FEATURE_NOT_PRESENT;
+
+    while (selector.findMemoryType(typeBits, flags, memReqs.size, memoryTypeIndex))
+    {
+        result = allocateFromType(memReqs, memoryTypeIndex, tiling, allocation);
+        if (result != VK_ERROR_OUT_OF_DEVICE_MEMORY && result != VK_ERROR_OUT_OF_HOST_MEMORY)
+        {
+            break;
+        }
+        // The heap is full, try the next best type
+        typeBits &= ~(1u << memoryTypeIndex);
+    }
+    if (result == VK_ERROR_FEATURE_NOT_PRESENT)
+    {
+        printf("No memory type with flags 0x%x in type bits 0x%x\n", flags.required, memReqs.memoryTypeBits);
+    }
+    return result;
+}
+
+VkResult Allocator::allocateFromType(const VkMemoryRequirements &requirements, uint32_t memoryTypeIndex, AllocationTiling tiling, Allocation &allocation)
+{
+    // Allocations in non coherent memory cover whole atoms, so invalidating one never touches its neighbours
+    VkMemoryRequirements memReqs = requirements;
+    VkMemoryPropertyFlags propertyFlags = memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags;
+    if ((propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+    {
+        memReqs.alignment = std::max(memReqs.alignment, nonCoherentAtomSize);
+        memReqs.size = alignUp(memReqs.size, nonCoherentAtomSize);
+    }
+
+    VkDeviceSize preferredSize = preferredBlockSize(memoryTypeIndex);
+    MemoryBlock *block = nullptr;
+
+    // Big resources get a block of their own, they would only fragment the shared ones
+    if (memReqs.size > preferredSize / 2)
+    {
+        VkResult result = createBlock(memoryTypeIndex, memReqs.size, true, block);
+        if (result != VK_SUCCESS)
+        {
+            return result;
+        }
+        allocateFromBlock(block, memReqs, tiling, allocation);
+        return VK_SUCCESS;
+    }
+
+    for (auto existing : blocks[memoryTypeIndex])
+    {
+        if (!existing->dedicated && existing->size - existing->usedBytes >= memReqs.size &&
+            allocateFromBlock(existing, memReqs, tiling, allocation))
+        {
+            return VK_SUCCESS;
+        }
+    }
+
+    // No room left, retry with smaller blocks if the heap is running out
+    VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    for (VkDeviceSize size = preferredSize; size >= memReqs.size; size /= 2)
+    {
+        result = createBlock(memoryTypeIndex, size, false, block);
+        if (result != VK_ERROR_OUT_OF_DEVICE_MEMORY && result != VK_ERROR_OUT_OF_HOST_MEMORY)
+        {
+            break;
+        }
+    }
+    if (result != VK_SUCCESS)
+    {
+        return result;
+    }
+    allocateFromBlock(block, memReqs, tiling, allocation);
+    return VK_SUCCESS;
+}
+
+void Allocator::invalidate(const Allocation &allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+    assert(allocation.mapped != nullptr);
+    if (memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+    {
+        return;
+    }
+    if (size == VK_WHOLE_SIZE)
+    {
+        size = allocation.size - offset;
+    }
+    // The allocation is padded to whole atoms, so the widened range stays inside it
+    VkMappedMemoryRange range = myvk::initializers::mappedMemoryRange();
+    range.memory = allocation.memory;
+    range.offset = (allocation.offset + offset) / nonCoherentAtomSize * nonCoherentAtomSize;
+    range.size = alignUp(allocation.offset + offset + size, nonCoherentAtomSize) - range.offset;
+    VK_CHECK_RESULT(vkInvalidateMappedMemoryRanges(device, 1, &range));
+}
+
+void Allocator::free(Allocation &allocation)
+{
+    MemoryBlock *block = allocation.block;
+    if (block == nullptr)
+    {
+        return;
+    }
+
+    auto &suballocations = block->suballocations;
+    auto it = suballocations.begin();
+    while (it != suballocations.end() && !(it->offset == allocation.offset && it->tiling != ALLOCATION_TILING_FREE))
+    {
+        ++it;
+    }
+    assert(it != suballocations.end());
+
+    block->usedBytes -= it->size;
+    block->allocationCount--;
+    usedBytes -= it->size;
+
+    // Mark the range free and merge it with free neighbours
+    it->tiling = ALLOCATION_TILING_FREE;
+    auto next = std::next(it);
+    if (next != suballocations.end() && next->tiling == ALLOCATION_TILING_FREE)
+    {
+        it->size += next->size;
+        suballocations.erase(next);
+    }
+    if (it != suballocations.begin())
+    {
+        auto prev = std::prev(it);
+        if (prev->tiling == ALLOCATION_TILING_FREE)
+        {
+            prev->size += it->size;
+            suballocations.erase(it);
+        }
+    }
+
+    // Keep one empty block per memory type around so alternating allocations don't thrash
+    if (block->allocationCount == 0 && (block->dedicated || blocks[block->memoryTypeIndex].size() > 1))
+    {
+        destroyBlock(block);
+    }
+
+    allocation = Allocation();
+}
+
+AllocatorStats Allocator::getStats() const
+{
+    AllocatorStats stats;
+    VkDeviceSize freeBytes = 0;
+    for (auto &typeBlocks : blocks)
+    {
+        for (auto block : typeBlocks)
+        {
+            stats.blockCount++;
+            stats.allocationCount += block->allocationCount;
+            for (auto &suballocation : block->suballocations)
+            {
+                if (suballocation.tiling == ALLOCATION_TILING_FREE)
+                {
+                    freeBytes += suballocation.size;
+                    stats.largestFreeRange = std::max(stats.largestFreeRange, suballocation.size);
+                }
+            }
+        }
+    }
+    stats.blockBytes = blockBytes;
+    stats.usedBytes = usedBytes;
+    stats.peakBlockBytes = peakBlockBytes;
+    stats.peakUsedBytes = peakUsedBytes;
+    stats.fragmentation = freeBytes > 0 ? 1.0f - (float)stats.largestFreeRange / (float)freeBytes : 0.0f;
+    return stats;
+}
+
+void Allocator::dumpStats() const
+{
+    AllocatorStats stats = getStats();
+    printf("Memory: %u blocks, %u allocations, %.2f MiB used of %.2f MiB, peak %.2f MiB used of %.2f MiB, fragmentation %.2f\n",
+           stats.blockCount, stats.allocationCount,
+           toMiB(stats.usedBytes), toMiB(stats.blockBytes),
+           toMiB(stats.peakUsedBytes), toMiB(stats.peakBlockBytes),
+           stats.fragmentation);
+    for (uint32_t i = 0; i < static_cast<uint32_t>(blocks.size()); i++)
+    {
+        if (blocks[i].empty())
+        {
+            continue;
+        }
+        VkDeviceSize typeBlockBytes = 0, typeUsedBytes = 0;
+        uint32_t typeAllocationCount = 0;
+        for (auto block : blocks[i])
+        {
+            typeBlockBytes += block->size;
+            typeUsedBytes += block->usedBytes;
+            typeAllocationCount += block->allocationCount;
+        }
+        printf("  type %u (heap %u): %zu blocks, %u allocations, %.2f MiB used of %.2f MiB\n",
+               i, memoryProperties.memoryTypes[i].heapIndex, blocks[i].size(), typeAllocationCount,
+               toMiB(typeUsedBytes), toMiB(typeBlockBytes));
+    }
+    selector.dumpBudget();
+}
+} // namespace myvk
@@ -0,0 +1,120 @@
+/*
+* Block based device memory allocator
+*
+* Resources are bound at offsets inside a few large VkDeviceMemory blocks per memory type
+* instead of getting one vkAllocateMemory call each
+*/
+
+#ifndef ALLOCATOR_HPP
+#define ALLOCATOR_HPP
+
+#include <vulkan/vulkan.h>
+#include "tools.hpp"
+#include "memorytype.hpp"
+
+#include <list>
+#include <vector>
+
+// Default size of a memory block, smaller heaps get an eighth of their size instead
+#define DEFAULT_MEMORY_BLOCK_SIZE (64ull * 1024 * 1024)
+
+namespace myvk
+{
+// Linear and optimal resources may not share a page of bufferImageGranularity bytes
+enum AllocationTiling
+{
+    ALLOCATION_TILING_FREE = 0,
+    ALLOCATION_TILING_LINEAR,  // buffers and linear images
+    ALLOCATION_TILING_OPTIMAL, // optimal tiled images
+};
+
+struct Suballocation
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    AllocationTiling tiling;
+};
+
+struct MemoryBlock
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memoryTypeIndex = 0;
+    // Host visible blocks stay mapped for their whole lifetime
+    void *mapped = nullptr;
+    // Blocks created for a single large resource are released as soon as it is freed
+    bool dedicated = false;
+    VkDeviceSize usedBytes = 0;
+    uint32_t allocationCount = 0;
+    // Ordered ranges covering the whole block, adjacent free ranges are always merged
+    std::list<Suballocation> suballocations;
+};
+
+struct Allocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    uint32_t memoryTypeIndex = 0;
+    // Host pointer to the start of the allocation, nullptr if the memory is not host visible
+    void *mapped = nullptr;
+    MemoryBlock *block = nullptr;
+};
+
+struct AllocatorStats
+{
+    uint32_t blockCount = 0;
+    uint32_t allocationCount = 0;
+    VkDeviceSize blockBytes = 0;
+    VkDeviceSize usedBytes = 0;
+    VkDeviceSize peakBlockBytes = 0;
+    VkDeviceSize peakUsedBytes = 0;
+    VkDeviceSize largestFreeRange = 0;
+    // 1 - largest free range / total free bytes, 0 means all free memory is contiguous
+    float fragmentation = 0.0f;
+};
+
+class Allocator
+{
+  public:
+    /** @brief memoryBudget must only be set if VK_EXT_memory_budget is enabled on the device */
+    void create(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device, bool memoryBudget, VkDeviceSize blockSize = DEFAULT_MEMORY_BLOCK_SIZE);
+    void destroy();
+
+    /** @brief Sub-allocate memory matching the requirements from the best ranked memory type for the usage,
+     *  falls back to the next ranked type if a heap runs out of memory */
+    VkResult allocate(const VkMemoryRequirements &memReqs, MemoryUsage usage, AllocationTiling tiling, Allocation &allocation);
+    /** @brief Return an allocation to its block, does nothing for an empty allocation */
+    void free(Allocation &allocation);
+    /** @brief Make device writes to a range of a mapped allocation visible to the host, does nothing for coherent memory */
+    void invalidate(const Allocation &allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE);
+
+    AllocatorStats getStats() const;
+    /** @brief Print block count, usage, peak usage and fragmentation per memory type */
+    void dumpStats() const;
+
+  private:
+    VkDevice device = VK_NULL_HANDLE;
+    MemoryTypeSelector selector;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    VkDeviceSize bufferImageGranularity = 1;
+    VkDeviceSize nonCoherentAtomSize = 1;
+    uint32_t maxMemoryAllocationCount = 0;
+    VkDeviceSize blockSize = DEFAULT_MEMORY_BLOCK_SIZE;
+    // One list of blocks per memory type
+    std::vector<std::vector<MemoryBlock *>> blocks;
+    VkDeviceSize blockBytes = 0;
+    VkDeviceSize usedBytes = 0;
+    VkDeviceSize peakBlockBytes = 0;
+    VkDeviceSize peakUsedBytes = 0;
+
+    VkResult allocateFromType(const VkMemoryRequirements &requirements, uint32_t memoryTypeIndex, AllocationTiling tiling, Allocation &allocation);
+    VkDeviceSize preferredBlockSize(uint32_t memoryTypeIndex) const;
+    VkResult createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated, MemoryBlock *&block);
+    void destroyBlock(MemoryBlock *block);
+    bool allocateFromBlock(MemoryBlock *block, const VkMemoryRequirements &memReqs, AllocationTiling tiling, Allocation &allocation);
+    uint32_t totalBlockCount() const;
+};
+} // namespace myvk
+
+#endif
@@ -0,0 +1,258 @@
+/*
+* Block compression
+*/
+
+#include "blockcompress.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define STB_DXT_IMPLEMENTATION
+#include <stb-master/stb_dxt.h>
+
+// Rows of blocks compressed per thread pool iteration
+#define BLOCK_BAND_ROWS 8
+
+namespace myvk
+{
+namespace blockcompress
+{
+uint32_t getBlockSize(BlockFormat format)
+{
+    return format == BLOCK_FORMAT_BC1 ? 8 : 16;
+}
+
+VkFormat getVkFormat(BlockFormat format)
+{
+    return format == BLOCK_FORMAT_BC1 ? VK_FORMAT_BC1_RGB_UNORM_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+}
+
+mipmap::MipChainLayout layoutChain(const mipmap::MipChainLayout &layout, BlockFormat format, size_t alignment)
+{
+    mipmap::MipChainLayout blockLayout;
+    size_t offset = 0;
+    for (const mipmap::MipLevel &level : layout.levels)
+    {
+        mipmap::MipLevel blockLevel;
+        blockLevel.width = level.width;
+        blockLevel.height = level.height;
+        blockLevel.offset = (offset + alignment - 1) / alignment * alignment;
+        blockLevel.size = static_cast<size_t>((level.width + 3) / 4) * ((level.height + 3) / 4) * getBlockSize(format);
+        blockLayout.levels.push_back(blockLevel);
+        offset = blockLevel.offset + blockLevel.size;
+    }
+    blockLayout.size = offset;
+    return blockLayout;
+}
+
+static void expand565(uint16_t color, unsigned char rgba[4])
+{
+    uint32_t r = (color >> 11) & 31;
+    uint32_t g = (color >> 5) & 63;
+    uint32_t b = color & 31;
+    rgba[0] = static_cast<unsigned char>((r << 3) | (r >> 2));
+    rgba[1] = static_cast<unsigned char>((g << 2) | (g >> 4));
+    rgba[2] = static_cast<unsigned char>((b << 3) | (b >> 2));
+    rgba[3] = 255;
+}
+
+// BC3 always interpolates four colors, BC1 only if the first endpoint is the larger one
+static void decodeColor(const unsigned char *block, bool fourColors, unsigned char rgba[64])
+{
+    uint16_t c0 = static_cast<uint16_t>(block[0] | block[1] << 8);
+    uint16_t c1 = static_cast<uint16_t>(block[2] | block[3] << 8);
+    unsigned char palette[4][4];
+    expand565(c0, palette[0]);
+    expand565(c1, palette[1]);
+    fourColors = fourColors || c0 > c1;
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = static_cast<unsigned char>(fourColors ? (2 * palette[0][c] + palette[1][c]) / 3 : (palette[0][c] + palette[1][c]) / 2);
+        palette[3][c] = static_cast<unsigned char>(fourColors ? (palette[0][c] + 2 * palette[1][c]) / 3 : 0);
+    }
+    palette[2][3] = 255;
+    palette[3][3] = 255;
+
+    uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | static_cast<uint32_t>(block[7]) << 24;
+    for (int i = 0; i < 16; i++)
+    {
+        memcpy(&rgba[i * 4], palette[(indices >> (2 * i)) & 3], 3);
+    }
+}
+
+static void decodeAlpha(const unsigned char *block, unsigned char rgba[64])
+{
+    uint32_t a0 = block[0];
+    uint32_t a1 = block[1];
+    unsigned char palette[8] = {static_cast<unsigned char>(a0), static_cast<unsigned char>(a1)};
+    for (uint32_t i = 1; i < 7; i++)
+    {
+        palette[i + 1] = static_cast<unsigned char>(a0 > a1 ? ((7 - i) * a0 + i * a1) / 7 : i < 5 ? ((5 - i) * a0 + i * a1) / 5 : i == 5 ? 0 : 255);
+    }
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        indices |= static_cast<uint64_t>(block[2 + i]) << (8 * i);
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        rgba[i * 4 + 3] = palette[(indices >> (3 * i)) & 7];
+    }
+}
+
+void decompressBlock(const unsigned char *block, BlockFormat format, unsigned char rgba[64])
+{
+    if (format == BLOCK_FORMAT_BC1)
+    {
+        decodeColor(block, false, rgba);
+        for (int i = 0; i < 16; i++)
+        {
+            rgba[i * 4 + 3] = 255;
+        }
+    }
+    else
+    {
+        decodeAlpha(block, rgba);
+        decodeColor(block + 8, true, rgba);
+    }
+}
+
+// stb_dxt fills its tables on the first call, which must not race
+static void warmUp()
+{
+    unsigned char warmup[64] = {};
+    unsigned char warmupBlock[16];
+    stb_compress_dxt_block(warmupBlock, warmup, 0, STB_DXT_NORMAL);
+}
+
+// Compress row by of blocks of a level into blocks, returns the squared error of its texels inside the level if measure is set
+static double compressBlockRow(const unsigned char *levelTexels, const mipmap::MipLevel &level, uint32_t by, unsigned char *blocks,
+                               BlockFormat format, bool highQuality, bool measure)
+{
+    const uint32_t blockSize = getBlockSize(format);
+    const int alpha = format == BLOCK_FORMAT_BC3 ? 1 : 0;
+    const int mode = highQuality ? STB_DXT_HIGHQUAL : STB_DXT_NORMAL;
+    const int channels = format == BLOCK_FORMAT_BC3 ? 4 : 3;
+    uint32_t blocksPerRow = (level.width + 3) / 4;
+    double error = 0.0;
+    for (uint32_t bx = 0; bx < blocksPerRow; bx++)
+    {
+        unsigned char texels[64];
+        for (uint32_t y = 0; y < 4; y++)
+        {
+            uint32_t sy = std::min(by * 4 + y, level.height - 1);
+            for (uint32_t x = 0; x < 4; x++)
+            {
+                uint32_t sx = std::min(bx * 4 + x, level.width - 1);
+                memcpy(&texels[(y * 4 + x) * 4], &levelTexels[(static_cast<size_t>(sy) * level.width + sx) * 4], 4);
+            }
+        }
+        unsigned char block[16];
+        stb_compress_dxt_block(block, texels, alpha, mode);
+        memcpy(blocks + static_cast<size_t>(bx) * blockSize, block, blockSize);
+
+        if (measure)
+        {
+            // Only texels inside the level count
+            unsigned char decoded[64];
+            decompressBlock(block, format, decoded);
+            for (uint32_t y = 0; y < 4 && by * 4 + y < level.height; y++)
+            {
+                for (uint32_t x = 0; x < 4 && bx * 4 + x < level.width; x++)
+                {
+                    for (int c = 0; c < channels; c++)
+                    {
+                        double d = static_cast<double>(decoded[(y * 4 + x) * 4 + c]) - texels[(y * 4 + x) * 4 + c];
+                        error += d * d;
+                    }
+                }
+            }
+        }
+    }
+    return error;
+}
+
+void compressChain(const void *pixels, const mipmap::MipChainLayout &layout, void *dst, const mipmap::MipChainLayout &blockLayout,
+                   BlockFormat format, ThreadPool &threadPool, bool highQuality, double *psnr)
+{
+    struct Band
+    {
+        uint32_t level;
+        uint32_t firstRow;
+        uint32_t rowCount;
+    };
+    std::vector<Band> bands;
+    for (uint32_t level = 0; level < layout.levels.size(); level++)
+    {
+        uint32_t blockRows = (layout.levels[level].height + 3) / 4;
+        for (uint32_t row = 0; row < blockRows; row += BLOCK_BAND_ROWS)
+        {
+            bands.push_back({level, row, std::min(static_cast<uint32_t>(BLOCK_BAND_ROWS), blockRows - row)});
+        }
+    }
+
+    warmUp();
+    const unsigned char *src = static_cast<const unsigned char *>(pixels);
+    unsigned char *base = static_cast<unsigned char *>(dst);
+    const uint32_t blockSize = getBlockSize(format);
+    std::vector<double> bandErrors(bands.size(), 0.0);
+    threadPool.parallelFor(static_cast<uint32_t>(bands.size()), [&](uint32_t b) {
+        const Band &band = bands[b];
+        const mipmap::MipLevel &level = layout.levels[band.level];
+        size_t rowSize = static_cast<size_t>((level.width + 3) / 4) * blockSize;
+        unsigned char *blocks = base + blockLayout.levels[band.level].offset;
+        bool measure = psnr != nullptr && band.level == 0;
+        for (uint32_t by = band.firstRow; by < band.firstRow + band.rowCount; by++)
+        {
+            bandErrors[b] += compressBlockRow(src + level.offset, level, by, blocks + by * rowSize, format, highQuality, measure);
+        }
+    });
+
+    if (psnr != nullptr)
+    {
+        double error = 0.0;
+        for (double bandError : bandErrors)
+        {
+            error += bandError;
+        }
+        *psnr = getPsnr(error, layout.levels[0].width, layout.levels[0].height, format);
+    }
+}
+
+void compressRows(const unsigned char *texels, const mipmap::MipLevel &level, uint32_t firstRow, uint32_t rowCount, void *dst,
+                  BlockFormat format, ThreadPool &threadPool, bool highQuality, double *squaredError)
+{
+    warmUp();
+    unsigned char *blocks = static_cast<unsigned char *>(dst);
+    size_t rowSize = static_cast<size_t>((level.width + 3) / 4) * getBlockSize(format);
+    uint32_t bandCount = (rowCount + BLOCK_BAND_ROWS - 1) / BLOCK_BAND_ROWS;
+    std::vector<double> bandErrors(bandCount, 0.0);
+    threadPool.parallelFor(bandCount, [&](uint32_t b) {
+        uint32_t bandEnd = std::min((b + 1) * BLOCK_BAND_ROWS, rowCount);
+        for (uint32_t row = b * BLOCK_BAND_ROWS; row < bandEnd; row++)
+        {
+            bandErrors[b] += compressBlockRow(texels, level, firstRow + row, blocks + row * rowSize, format, highQuality, squaredError != nullptr);
+        }
+    });
+
+    if (squaredError != nullptr)
+    {
+        double error = 0.0;
+        for (double bandError : bandErrors)
+        {
+            error += bandError;
+        }
+        *squaredError = error;
+    }
+}
+
+double getPsnr(double squaredError, uint32_t width, uint32_t height, BlockFormat format)
+{
+    const int channels = format == BLOCK_FORMAT_BC3 ? 4 : 3;
+    double mse = squaredError / (static_cast<double>(width) * height * channels);
+    return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : INFINITY;
+}
+} // namespace blockcompress
+} // namespace myvk
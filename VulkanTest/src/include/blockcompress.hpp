@@ -0,0 +1,53 @@
+/*
+* Block compression
+*
+* RGBA8 mip chains are compressed to BC1 or BC3 with stb_dxt, one 4x4 block at a time. The rows of
+* blocks of all levels are spread over a thread pool together, blocks sticking out of a level repeat
+* its last row and column. Every block is decoded again right away to measure the error
+*/
+
+#ifndef BLOCKCOMPRESS_HPP
+#define BLOCKCOMPRESS_HPP
+
+#include <vulkan/vulkan.h>
+#include "threadpool.hpp"
+#include "mipmap.hpp"
+
+#include <cstdint>
+
+namespace myvk
+{
+namespace blockcompress
+{
+enum BlockFormat
+{
+    BLOCK_FORMAT_BC1 = 0, // RGB in 8 bytes per block, alpha is dropped
+    BLOCK_FORMAT_BC3,     // RGBA in 16 bytes per block
+};
+
+uint32_t getBlockSize(BlockFormat format);
+VkFormat getVkFormat(BlockFormat format);
+
+/** @brief Place the compressed levels of an RGBA8 chain, channels of the result is 0 */
+mipmap::MipChainLayout layoutChain(const mipmap::MipChainLayout &layout, BlockFormat format, size_t alignment = MIP_LEVEL_ALIGNMENT);
+
+/** @brief Compress every level of an RGBA8 chain into dst, laid out by blockLayout
+ *  @param psnr If set, receives the peak signal to noise ratio of level 0 in dB, over RGB for BC1 and RGBA for BC3 */
+void compressChain(const void *pixels, const mipmap::MipChainLayout &layout, void *dst, const mipmap::MipChainLayout &blockLayout,
+                   BlockFormat format, ThreadPool &threadPool, bool highQuality = false, double *psnr = nullptr);
+
+/** @brief Compress rows of blocks [firstRow, firstRow + rowCount) of one RGBA8 level into dst, one row after another
+ *  @param texels Tightly packed texels of the whole level, e.g. from mipmap::ChainBuilder
+ *  @param squaredError If set, receives the summed squared error of the texels in the rows, for getPsnr */
+void compressRows(const unsigned char *texels, const mipmap::MipLevel &level, uint32_t firstRow, uint32_t rowCount, void *dst,
+                  BlockFormat format, ThreadPool &threadPool, bool highQuality = false, double *squaredError = nullptr);
+
+/** @brief Peak signal to noise ratio in dB of a width x height level with the summed squared error of compressRows */
+double getPsnr(double squaredError, uint32_t width, uint32_t height, BlockFormat format);
+
+/** @brief Decode one block into 16 RGBA8 texels in row major order */
+void decompressBlock(const unsigned char *block, BlockFormat format, unsigned char rgba[64]);
+} // namespace blockcompress
+} // namespace myvk
+
+#endif
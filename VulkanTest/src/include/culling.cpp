@@ -0,0 +1,175 @@
+/*
+* Frustum culling
+*/
+
+#include "culling.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// Spheres per thread pool iteration, and the count below which culling stays on the calling thread
+#define CULL_BLOCK_SIZE 16384
+#define CULL_THREADED_MIN (4 * CULL_BLOCK_SIZE)
+
+namespace myvk
+{
+namespace culling
+{
+Frustum extractFrustum(const float *m)
+{
+    // Rows of the matrix, m is column major. A point is inside when -w <= x <= w, -w <= y <= w and 0 <= z <= w
+    float row[4][4];
+    for (int r = 0; r < 4; r++)
+    {
+        for (int c = 0; c < 4; c++)
+        {
+            row[r][c] = m[c * 4 + r];
+        }
+    }
+    Frustum frustum;
+    for (int c = 0; c < 4; c++)
+    {
+        frustum.planes[0][c] = row[3][c] + row[0][c];
+        frustum.planes[1][c] = row[3][c] - row[0][c];
+        frustum.planes[2][c] = row[3][c] + row[1][c];
+        frustum.planes[3][c] = row[3][c] - row[1][c];
+        frustum.planes[4][c] = row[2][c];
+        frustum.planes[5][c] = row[3][c] - row[2][c];
+    }
+    // Unit normals turn the plane equation into a distance that can be compared with a radius
+    for (auto &plane : frustum.planes)
+    {
+        float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        for (float &value : plane)
+        {
+            value = length > 0.0f ? value / length : value;
+        }
+    }
+    return frustum;
+}
+
+void SphereSet::resize(uint32_t count)
+{
+    this->count = count;
+    size_t padded = (static_cast<size_t>(count) + CULL_BATCH_SIZE - 1) / CULL_BATCH_SIZE * CULL_BATCH_SIZE;
+    x.resize(padded, 0.0f);
+    y.resize(padded, 0.0f);
+    z.resize(padded, 0.0f);
+    // No distance is above FLT_MAX, so padding always fails the first plane
+    radius.resize(padded, -FLT_MAX);
+}
+
+uint32_t cullSpheresScalar(const Frustum &frustum, const SphereSet &spheres, uint32_t first, uint32_t last, uint32_t *visible)
+{
+    uint32_t visibleCount = 0;
+    for (uint32_t i = first; i < last; i++)
+    {
+        bool inside = true;
+        for (const auto &plane : frustum.planes)
+        {
+            float distance = plane[0] * spheres.x[i] + plane[1] * spheres.y[i] + plane[2] * spheres.z[i] + plane[3];
+            inside = inside && distance > -spheres.radius[i];
+        }
+        visible[visibleCount] = i;
+        visibleCount += inside ? 1 : 0;
+    }
+    return visibleCount;
+}
+
+// Append the lanes set in mask, the loop runs once per visible sphere
+static inline uint32_t appendVisible(uint32_t mask, uint32_t base, uint32_t *visible, uint32_t visibleCount)
+{
+    while (mask != 0)
+    {
+        visible[visibleCount++] = base + static_cast<uint32_t>(__builtin_ctz(mask));
+        mask &= mask - 1;
+    }
+    return visibleCount;
+}
+
+uint32_t cullSpheres(const Frustum &frustum, const SphereSet &spheres, uint32_t first, uint32_t last, uint32_t *visible)
+{
+    uint32_t visibleCount = 0;
+    uint32_t i = first;
+#if defined(__AVX__)
+    for (; i < last; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&spheres.x[i]);
+        __m256 y = _mm256_loadu_ps(&spheres.y[i]);
+        __m256 z = _mm256_loadu_ps(&spheres.z[i]);
+        __m256 negativeRadius = _mm256_xor_ps(_mm256_loadu_ps(&spheres.radius[i]), _mm256_set1_ps(-0.0f));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const auto &plane : frustum.planes)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(plane[0])), _mm256_mul_ps(y, _mm256_set1_ps(plane[1]))),
+                                            _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(plane[2])), _mm256_set1_ps(plane[3])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GT_OQ));
+        }
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+        if (last - i < 8)
+        {
+            mask &= (1u << (last - i)) - 1;
+        }
+        visibleCount = appendVisible(mask, i, visible, visibleCount);
+    }
+#elif defined(__SSE2__)
+    for (; i < last; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&spheres.x[i]);
+        __m128 y = _mm_loadu_ps(&spheres.y[i]);
+        __m128 z = _mm_loadu_ps(&spheres.z[i]);
+        __m128 negativeRadius = _mm_xor_ps(_mm_loadu_ps(&spheres.radius[i]), _mm_set1_ps(-0.0f));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const auto &plane : frustum.planes)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane[0])), _mm_mul_ps(y, _mm_set1_ps(plane[1]))),
+                                         _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, negativeRadius));
+        }
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(inside));
+        if (last - i < 4)
+        {
+            mask &= (1u << (last - i)) - 1;
+        }
+        visibleCount = appendVisible(mask, i, visible, visibleCount);
+    }
+#else
+    visibleCount = cullSpheresScalar(frustum, spheres, first, last, visible);
+#endif
+    return visibleCount;
+}
+
+uint32_t cullSpheres(const Frustum &frustum, const SphereSet &spheres, uint32_t *visible, ThreadPool &threadPool)
+{
+    if (spheres.count < CULL_THREADED_MIN || threadPool.getThreadCount() == 1)
+    {
+        return cullSpheres(frustum, spheres, 0, spheres.count, visible);
+    }
+
+    // Every block writes from its own start, then the lists are moved together in block order
+    uint32_t blockCount = (spheres.count + CULL_BLOCK_SIZE - 1) / CULL_BLOCK_SIZE;
+    std::vector<uint32_t> blockVisible(blockCount);
+    threadPool.parallelFor(blockCount, [&](uint32_t block) {
+        uint32_t first = block * CULL_BLOCK_SIZE;
+        uint32_t last = std::min(first + CULL_BLOCK_SIZE, spheres.count);
+        blockVisible[block] = cullSpheres(frustum, spheres, first, last, visible + first);
+    });
+    uint32_t visibleCount = blockVisible[0];
+    for (uint32_t block = 1; block < blockCount; block++)
+    {
+        memmove(visible + visibleCount, visible + block * CULL_BLOCK_SIZE, blockVisible[block] * sizeof(uint32_t));
+        visibleCount += blockVisible[block];
+    }
+    return visibleCount;
+}
+} // namespace culling
+} // namespace myvk
@@ -0,0 +1,62 @@
+/*
+* Frustum culling
+*
+* Bounding spheres are kept as separate x, y, z and radius arrays, so SSE tests four and AVX eight of
+* them against a frustum plane with one instruction each. The indices of the visible ones are compacted
+* into a list that drives the draws, large sets are split across a thread pool
+*/
+
+#ifndef CULLING_HPP
+#define CULLING_HPP
+
+#include "threadpool.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Spheres tested per iteration, the arrays are padded to a multiple of it
+#define CULL_BATCH_SIZE 8
+
+namespace myvk
+{
+namespace culling
+{
+struct Frustum
+{
+    // Left, right, bottom, top, near, far. xyz is the unit normal pointing inside, w the distance
+    float planes[6][4];
+};
+
+/** @brief Planes of the clip volume of a column major view projection matrix, with depth from 0 to 1 as in Vulkan */
+Frustum extractFrustum(const float *viewProjection);
+
+struct SphereSet
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> radius;
+    uint32_t count = 0;
+
+    /** @brief Padding spheres are never visible */
+    void resize(uint32_t count);
+    void set(uint32_t i, float centerX, float centerY, float centerZ, float sphereRadius)
+    {
+        x[i] = centerX;
+        y[i] = centerY;
+        z[i] = centerZ;
+        radius[i] = sphereRadius;
+    }
+};
+
+/** @brief Write the indices of the spheres in [first, last) that touch the frustum to visible, in order
+ *  @return Number of visible spheres */
+uint32_t cullSpheres(const Frustum &frustum, const SphereSet &spheres, uint32_t first, uint32_t last, uint32_t *visible);
+/** @brief Same with one sphere at a time, as reference */
+uint32_t cullSpheresScalar(const Frustum &frustum, const SphereSet &spheres, uint32_t first, uint32_t last, uint32_t *visible);
+/** @brief Cull all spheres in blocks on the thread pool, visible needs room for spheres.count indices */
+uint32_t cullSpheres(const Frustum &frustum, const SphereSet &spheres, uint32_t *visible, ThreadPool &threadPool);
+} // namespace culling
+} // namespace myvk
+
+#endif
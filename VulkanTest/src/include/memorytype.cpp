@@ -0,0 +1,182 @@
+/*
+* Memory type selection
+*/
+
+#include "memorytype.hpp"
+
+namespace myvk
+{
+static uint32_t countBits(uint32_t value)
+{
+    uint32_t count = 0;
+    for (; value != 0; value &= value - 1)
+    {
+        count++;
+    }
+    return count;
+}
+
+static double toMiB(VkDeviceSize bytes)
+{
+    return (double)bytes / (1024.0 * 1024.0);
+}
+
+MemoryTypeFlags memoryUsageFlags(MemoryUsage usage)
+{
+    MemoryTypeFlags flags;
+    switch (usage)
+    {
+    case MEMORY_USAGE_GPU_ONLY:
+        // Leave host visible device memory (BAR) to the resources the CPU writes
+        flags.preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        flags.avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        break;
+    case MEMORY_USAGE_UPLOAD:
+        // Uncached write-combined system memory is fastest for sequential writes
+        flags.required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        flags.avoided = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        break;
+    case MEMORY_USAGE_DYNAMIC:
+        flags.required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        flags.preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        break;
+    case MEMORY_USAGE_READBACK:
+        // CPU reads from uncached memory are very slow, cached types are often not coherent and need Allocator::invalidate
+        flags.required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        flags.preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        flags.avoided = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        break;
+    }
+    return flags;
+}
+
+void MemoryTypeSelector::create(VkInstance instance, VkPhysicalDevice physicalDevice, bool memoryBudget)
+{
+    this->physicalDevice = physicalDevice;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+    // The budget is chained to the properties2 query, core in 1.1 and otherwise provided by the KHR extension
+    if (memoryBudget)
+    {
+        getPhysicalDeviceMemoryProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2>(vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2"));
+        if (getPhysicalDeviceMemoryProperties2 == nullptr)
+        {
+            getPhysicalDeviceMemoryProperties2 = reinterpret_cast<PFN_vkGetPhysicalDeviceMemoryProperties2KHR>(vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR"));
+        }
+    }
+    this->memoryBudget = memoryBudget && getPhysicalDeviceMemoryProperties2 != nullptr;
+
+    updateBudget();
+}
+
+void MemoryTypeSelector::updateBudget()
+{
+    operationsSinceUpdate = 0;
+    if (!memoryBudget)
+    {
+        return;
+    }
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+    budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    VkPhysicalDeviceMemoryProperties2 memoryProperties2 = {};
+    memoryProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    memoryProperties2.pNext = &budgetProperties;
+    getPhysicalDeviceMemoryProperties2(physicalDevice, &memoryProperties2);
+
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+        heapBudget[i] = budgetProperties.heapBudget[i];
+        heapUsage[i] = budgetProperties.heapUsage[i];
+        allocatedBytesAtUpdate[i] = allocatedBytes[i];
+    }
+}
+
+void MemoryTypeSelector::trackAllocation(uint32_t memoryTypeIndex, VkDeviceSize size)
+{
+    allocatedBytes[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex] += size;
+    if (memoryBudget && ++operationsSinceUpdate >= MEMORY_BUDGET_UPDATE_INTERVAL)
+    {
+        updateBudget();
+    }
+}
+
+void MemoryTypeSelector::trackFree(uint32_t memoryTypeIndex, VkDeviceSize size)
+{
+    allocatedBytes[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex] -= size;
+    if (memoryBudget && ++operationsSinceUpdate >= MEMORY_BUDGET_UPDATE_INTERVAL)
+    {
+        updateBudget();
+    }
+}
+
+VkDeviceSize MemoryTypeSelector::getHeapBudget(uint32_t heapIndex) const
+{
+    // Some drivers report a zero budget for heaps they don't track
+    if (memoryBudget && heapBudget[heapIndex] > 0)
+    {
+        return heapBudget[heapIndex];
+    }
+    // Without the extension leave some room for other processes and driver internal allocations
+    return memoryProperties.memoryHeaps[heapIndex].size / 10 * 8;
+}
+
+VkDeviceSize MemoryTypeSelector::getHeapUsage(uint32_t heapIndex) const
+{
+    if (!memoryBudget)
+    {
+        return allocatedBytes[heapIndex];
+    }
+    // Reported usage plus whatever we allocated or freed since it was queried
+    int64_t delta = (int64_t)allocatedBytes[heapIndex] - (int64_t)allocatedBytesAtUpdate[heapIndex];
+    if (delta < 0 && (VkDeviceSize)(-delta) > heapUsage[heapIndex])
+    {
+        return 0;
+    }
+    return heapUsage[heapIndex] + delta;
+}
+
+bool MemoryTypeSelector::findMemoryType(uint32_t typeBits, const MemoryTypeFlags &flags, VkDeviceSize size, uint32_t &memoryTypeIndex) const
+{
+    // Protected memory needs a protected queue and lazily allocated memory is only for transient attachments
+    VkMemoryPropertyFlags excluded = VK_MEMORY_PROPERTY_PROTECTED_BIT & ~flags.required;
+    VkMemoryPropertyFlags avoided = flags.avoided | (VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT & ~(flags.required | flags.preferred));
+
+    uint32_t bestCost = UINT32_MAX;
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+    {
+        VkMemoryPropertyFlags propertyFlags = memoryProperties.memoryTypes[i].propertyFlags;
+        if (!(typeBits & (1u << i)) || (propertyFlags & flags.required) != flags.required || (propertyFlags & excluded))
+        {
+            continue;
+        }
+
+        uint32_t cost = countBits(flags.preferred & ~propertyFlags) + countBits(avoided & propertyFlags);
+        // A heap over budget only gets picked if nothing else fits
+        uint32_t heapIndex = memoryProperties.memoryTypes[i].heapIndex;
+        if (getHeapUsage(heapIndex) + size > getHeapBudget(heapIndex))
+        {
+            cost += VK_MAX_MEMORY_TYPES;
+        }
+
+        // Drivers list faster types first, so only a strictly lower cost replaces a candidate
+        if (cost < bestCost)
+        {
+            bestCost = cost;
+            memoryTypeIndex = i;
+        }
+    }
+    return bestCost != UINT32_MAX;
+}
+
+void MemoryTypeSelector::dumpBudget() const
+{
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+    {
+        printf("  heap %u%s: %.2f MiB allocated, %.2f MiB used of %.2f MiB budget (%s)\n",
+               i, (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ? " (device local)" : "",
+               toMiB(allocatedBytes[i]), toMiB(getHeapUsage(i)), toMiB(getHeapBudget(i)),
+               memoryBudget ? "VK_EXT_memory_budget" : "estimated");
+    }
+}
+} // namespace myvk
@@ -0,0 +1,75 @@
+/*
+* Memory type selection
+*
+* Memory properties are queried once, candidate types are ranked by required, preferred and avoided
+* property flags and by how much room their heap has left in the current budget
+*/
+
+#ifndef MEMORYTYPE_HPP
+#define MEMORYTYPE_HPP
+
+#include <vulkan/vulkan.h>
+#include "tools.hpp"
+
+// Re-query VK_EXT_memory_budget after this many block allocations or frees
+#define MEMORY_BUDGET_UPDATE_INTERVAL 30
+
+namespace myvk
+{
+// How the CPU and GPU access a resource, each usage maps to a set of property flags
+enum MemoryUsage
+{
+    MEMORY_USAGE_GPU_ONLY = 0, // attachments, textures and buffers filled by transfers
+    MEMORY_USAGE_UPLOAD,       // staging buffers written once by the CPU
+    MEMORY_USAGE_DYNAMIC,      // buffers written by the CPU and read by the GPU every frame, uses resizable BAR heaps
+    MEMORY_USAGE_READBACK,     // buffers and linear images read back by the CPU
+};
+
+struct MemoryTypeFlags
+{
+    // Types missing one of these are never picked
+    VkMemoryPropertyFlags required = 0;
+    // Each missing preferred flag and each present avoided flag makes a type rank lower
+    VkMemoryPropertyFlags preferred = 0;
+    VkMemoryPropertyFlags avoided = 0;
+};
+
+MemoryTypeFlags memoryUsageFlags(MemoryUsage usage);
+
+class MemoryTypeSelector
+{
+  public:
+    /** @brief Cache the memory properties, memoryBudget must only be set if VK_EXT_memory_budget is enabled on the device */
+    void create(VkInstance instance, VkPhysicalDevice physicalDevice, bool memoryBudget);
+
+    /** @brief Pick the best ranked memory type allowed by typeBits, returns false if no type has the required flags */
+    bool findMemoryType(uint32_t typeBits, const MemoryTypeFlags &flags, VkDeviceSize size, uint32_t &memoryTypeIndex) const;
+
+    /** @brief Account device memory allocated from or returned to the heap of a memory type */
+    void trackAllocation(uint32_t memoryTypeIndex, VkDeviceSize size);
+    void trackFree(uint32_t memoryTypeIndex, VkDeviceSize size);
+    /** @brief Refresh budget and usage of every heap */
+    void updateBudget();
+
+    VkDeviceSize getHeapBudget(uint32_t heapIndex) const;
+    VkDeviceSize getHeapUsage(uint32_t heapIndex) const;
+    const VkPhysicalDeviceMemoryProperties &getMemoryProperties() const { return memoryProperties; }
+    /** @brief Print usage and budget of every heap */
+    void dumpBudget() const;
+
+  private:
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    PFN_vkGetPhysicalDeviceMemoryProperties2 getPhysicalDeviceMemoryProperties2 = nullptr;
+    bool memoryBudget = false;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+    // Bytes allocated by us, in total and at the time of the last budget query
+    VkDeviceSize allocatedBytes[VK_MAX_MEMORY_HEAPS] = {};
+    VkDeviceSize allocatedBytesAtUpdate[VK_MAX_MEMORY_HEAPS] = {};
+    // Values reported by VK_EXT_memory_budget, usage includes other processes
+    VkDeviceSize heapBudget[VK_MAX_MEMORY_HEAPS] = {};
+    VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS] = {};
+    uint32_t operationsSinceUpdate = 0;
+};
+} // namespace myvk
+
+#endif
@@ -0,0 +1,670 @@
+/*
+* Mesh loading
+*/
+
+#include "mesh.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace myvk
+{
+static const double powersOf10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline bool isDigit(char c)
+{
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// Eight ASCII digits are checked and converted as one 64 bit word instead of one digit at a time
+static inline bool isEightDigits(const char *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return ((word & 0xf0f0f0f0f0f0f0f0ull) | (((word + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4)) ==
+           0x3333333333333333ull;
+}
+
+static inline uint32_t parseEightDigits(const char *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    word -= 0x3030303030303030ull;
+    // Combine neighbouring digits into pairs, then pairs into fours, then the two fours
+    word = word * 10 + (word >> 8);
+    word = (((word & 0x000000ff000000ffull) * (100 + (1000000ull << 32))) +
+            (((word >> 16) & 0x000000ff000000ffull) * (1 + (10000ull << 32)))) >>
+           32;
+    return static_cast<uint32_t>(word);
+}
+#endif
+
+// Append the digits at p to mantissa while it has room, digits that don't fit are counted in dropped.
+// Returns the end of the digits
+static inline const char *parseDigits(const char *p, const char *end, uint64_t &mantissa, int &significant, int &dropped)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (end - p >= 8 && significant <= 11 && isEightDigits(p))
+    {
+        mantissa = mantissa * 100000000 + parseEightDigits(p);
+        significant += mantissa != 0 ? 8 : 0;
+        p += 8;
+    }
+#endif
+    for (; p < end && isDigit(*p); p++)
+    {
+        if (significant < 19)
+        {
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+            significant += mantissa != 0 ? 1 : 0;
+        }
+        else
+        {
+            dropped++;
+        }
+    }
+    return p;
+}
+
+const char *parseFloat(const char *begin, const char *end, float &value)
+{
+    const char *p = begin;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int dropped = 0;
+    const char *digits = p;
+    p = parseDigits(p, end, mantissa, significant, dropped);
+    bool hasDigits = p != digits;
+    int exponent = dropped;
+    if (p < end && *p == '.')
+    {
+        const char *fraction = ++p;
+        int fractionDropped = 0;
+        p = parseDigits(p, end, mantissa, significant, fractionDropped);
+        exponent -= static_cast<int>(p - fraction) - fractionDropped;
+        dropped += fractionDropped;
+        hasDigits = hasDigits || p != fraction;
+    }
+    if (!hasDigits)
+    {
+        return begin;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        bool negativeExponent = false;
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            negativeExponent = *q == '-';
+            q++;
+        }
+        if (q < end && isDigit(*q))
+        {
+            int e = 0;
+            for (; q < end && isDigit(*q); q++)
+            {
+                e = std::min(e * 10 + (*q - '0'), 100000);
+            }
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+
+    // Both the mantissa and the power of ten are exact doubles, so the single division or
+    // multiplication rounds correctly. Anything else goes the slow way
+    if (dropped == 0 && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22)
+    {
+        double result = static_cast<double>(mantissa);
+        result = exponent < 0 ? result / powersOf10[-exponent] : result * powersOf10[exponent];
+        value = static_cast<float>(negative ? -result : result);
+        return p;
+    }
+    char buffer[128];
+    size_t length = std::min(static_cast<size_t>(p - begin), sizeof(buffer) - 1);
+    memcpy(buffer, begin, length);
+    buffer[length] = '\0';
+    value = strtof(buffer, nullptr);
+    return p;
+}
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *skipBlanks(const char *p, const char *end)
+{
+    while (p < end && isBlank(*p))
+    {
+        p++;
+    }
+    return p;
+}
+
+static inline const char *lineEnd(const char *p, const char *end)
+{
+    const char *newline = static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    return newline != nullptr ? newline : end;
+}
+
+// OBJ indices are 1 based or, if negative, relative to the elements defined so far.
+// Missing indices and 0 become NO_INDEX
+#define NO_INDEX UINT32_MAX
+
+static inline const char *parseIndex(const char *p, const char *end, size_t definedSoFar, uint32_t &index)
+{
+    bool negative = p < end && *p == '-';
+    p += negative ? 1 : 0;
+    int64_t value = 0;
+    for (; p < end && isDigit(*p); p++)
+    {
+        value = std::min<int64_t>(value * 10 + (*p - '0'), INT64_C(1) << 40);
+    }
+    int64_t resolved = negative ? static_cast<int64_t>(definedSoFar) - value : value - 1;
+    index = value == 0 || resolved < 0 || resolved >= NO_INDEX ? NO_INDEX : static_cast<uint32_t>(resolved);
+    return p;
+}
+
+struct ObjCorner
+{
+    uint32_t position;
+    uint32_t texCoord;
+    uint32_t normal;
+};
+
+struct ObjChunk
+{
+    const char *begin;
+    const char *end;
+    // Counted in the first pass, turned into offsets into the whole file before the second
+    size_t positions = 0;
+    size_t texCoords = 0;
+    size_t normals = 0;
+    size_t corners = 0;
+    bool failed = false;
+    // Corners that reference a texture coordinate or normal, and whether they all use the position index for it
+    bool anyTexCoord = false;
+    bool anyNormal = false;
+    bool missingTexCoord = false;
+    bool missingNormal = false;
+    bool sharedIndices = true;
+};
+
+static void countObjChunk(ObjChunk &chunk)
+{
+    for (const char *p = chunk.begin; p < chunk.end;)
+    {
+        const char *eol = lineEnd(p, chunk.end);
+        const char *q = skipBlanks(p, eol);
+        if (eol - q >= 2 && q[0] == 'v')
+        {
+            chunk.positions += isBlank(q[1]) ? 1 : 0;
+            chunk.texCoords += q[1] == 't' ? 1 : 0;
+            chunk.normals += q[1] == 'n' ? 1 : 0;
+        }
+        else if (eol - q >= 2 && q[0] == 'f' && isBlank(q[1]))
+        {
+            size_t vertices = 0;
+            for (q = skipBlanks(q + 1, eol); q < eol; q = skipBlanks(q, eol))
+            {
+                while (q < eol && !isBlank(*q))
+                {
+                    q++;
+                }
+                vertices++;
+            }
+            chunk.corners += vertices >= 3 ? (vertices - 2) * 3 : 0;
+        }
+        p = eol + 1;
+    }
+}
+
+static const char *parseFloats(const char *p, const char *end, float *dst, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        p = skipBlanks(p, end);
+        const char *next = parseFloat(p, end, dst[i]);
+        if (next == p)
+        {
+            return nullptr;
+        }
+        p = next;
+    }
+    return p;
+}
+
+static void parseObjChunk(ObjChunk &chunk, float *positions, float *texCoords, float *normals, ObjCorner *corners)
+{
+    // Elements defined before the current line, what relative indices count back from
+    size_t positionCount = chunk.positions;
+    size_t texCoordCount = chunk.texCoords;
+    size_t normalCount = chunk.normals;
+    ObjCorner *corner = corners + chunk.corners;
+    std::vector<ObjCorner> polygon;
+
+    for (const char *p = chunk.begin; p < chunk.end && !chunk.failed;)
+    {
+        const char *eol = lineEnd(p, chunk.end);
+        const char *q = skipBlanks(p, eol);
+        if (eol - q >= 2 && q[0] == 'v' && isBlank(q[1]))
+        {
+            chunk.failed = parseFloats(q + 1, eol, positions + 3 * positionCount++, 3) == nullptr;
+        }
+        else if (eol - q >= 2 && q[0] == 'v' && q[1] == 't')
+        {
+            // u is required, v and w are optional and w is dropped
+            float uvw[3] = {0.0f, 0.0f, 0.0f};
+            const char *next = parseFloats(q + 2, eol, uvw, 1);
+            for (int i = 1; i < 3 && next != nullptr && skipBlanks(next, eol) < eol; i++)
+            {
+                next = parseFloats(next, eol, uvw + i, 1);
+            }
+            chunk.failed = next == nullptr;
+            texCoords[2 * texCoordCount] = uvw[0];
+            texCoords[2 * texCoordCount + 1] = uvw[1];
+            texCoordCount++;
+        }
+        else if (eol - q >= 2 && q[0] == 'v' && q[1] == 'n')
+        {
+            chunk.failed = parseFloats(q + 2, eol, normals + 3 * normalCount++, 3) == nullptr;
+        }
+        else if (eol - q >= 2 && q[0] == 'f' && isBlank(q[1]))
+        {
+            polygon.clear();
+            for (q = skipBlanks(q + 1, eol); q < eol; q = skipBlanks(q, eol))
+            {
+                ObjCorner c = {NO_INDEX, NO_INDEX, NO_INDEX};
+                q = parseIndex(q, eol, positionCount, c.position);
+                if (q < eol && *q == '/')
+                {
+                    q = parseIndex(q + 1, eol, texCoordCount, c.texCoord);
+                    if (q < eol && *q == '/')
+                    {
+                        q = parseIndex(q + 1, eol, normalCount, c.normal);
+                    }
+                }
+                if (q < eol && !isBlank(*q))
+                {
+                    chunk.failed = true;
+                    break;
+                }
+                chunk.anyTexCoord |= c.texCoord != NO_INDEX;
+                chunk.anyNormal |= c.normal != NO_INDEX;
+                chunk.missingTexCoord |= c.texCoord == NO_INDEX;
+                chunk.missingNormal |= c.normal == NO_INDEX;
+                chunk.sharedIndices &= (c.texCoord == NO_INDEX || c.texCoord == c.position) &&
+                                       (c.normal == NO_INDEX || c.normal == c.position);
+                polygon.push_back(c);
+            }
+            for (size_t i = 2; i < polygon.size() && !chunk.failed; i++)
+            {
+                *corner++ = polygon[0];
+                *corner++ = polygon[i - 1];
+                *corner++ = polygon[i];
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+bool Mesh::loadObj(const char *data, size_t size, ThreadPool &threadPool)
+{
+    // Enough chunks to balance uneven lines between threads, but not so small that counting dominates
+    const size_t chunkSize = std::max<size_t>(size / (threadPool.getThreadCount() * 8) + 1, 1 << 20);
+    std::vector<ObjChunk> chunks;
+    for (const char *p = data, *end = data + size; p < end;)
+    {
+        const char *chunkEnd = static_cast<size_t>(end - p) > chunkSize ? lineEnd(p + chunkSize, end) : end;
+        chunkEnd = std::min(chunkEnd + 1, end);
+        ObjChunk chunk;
+        chunk.begin = p;
+        chunk.end = chunkEnd;
+        chunks.push_back(chunk);
+        p = chunkEnd;
+    }
+
+    threadPool.parallelFor(static_cast<uint32_t>(chunks.size()), [&](uint32_t i) { countObjChunk(chunks[i]); });
+
+    ObjChunk total;
+    for (ObjChunk &chunk : chunks)
+    {
+        std::swap(chunk.positions, total.positions);
+        std::swap(chunk.texCoords, total.texCoords);
+        std::swap(chunk.normals, total.normals);
+        std::swap(chunk.corners, total.corners);
+        total.positions += chunk.positions;
+        total.texCoords += chunk.texCoords;
+        total.normals += chunk.normals;
+        total.corners += chunk.corners;
+    }
+    if (total.corners == 0 || total.positions >= NO_INDEX)
+    {
+        printf("Mesh has no triangles or too many vertices\n");
+        return false;
+    }
+
+    std::vector<float> objPositions(total.positions * 3);
+    std::vector<float> objTexCoords(total.texCoords * 2);
+    std::vector<float> objNormals(total.normals * 3);
+    std::vector<ObjCorner> corners(total.corners);
+    threadPool.parallelFor(static_cast<uint32_t>(chunks.size()), [&](uint32_t i) {
+        parseObjChunk(chunks[i], objPositions.data(), objTexCoords.data(), objNormals.data(), corners.data());
+    });
+
+    for (const ObjChunk &chunk : chunks)
+    {
+        if (chunk.failed)
+        {
+            printf("Could not parse mesh line near byte %zu\n", static_cast<size_t>(chunk.begin - data));
+            return false;
+        }
+        total.anyTexCoord |= chunk.anyTexCoord;
+        total.anyNormal |= chunk.anyNormal;
+        total.missingTexCoord |= chunk.missingTexCoord;
+        total.missingNormal |= chunk.missingNormal;
+        total.sharedIndices &= chunk.sharedIndices;
+    }
+
+    // An attribute is kept if any corner has it, corners without it get zero
+    std::atomic<bool> outOfRange{false};
+    auto checkRange = [&](const ObjCorner &c) {
+        if (c.position >= total.positions ||
+            (c.texCoord != NO_INDEX && c.texCoord >= total.texCoords) ||
+            (c.normal != NO_INDEX && c.normal >= total.normals))
+        {
+            outOfRange = true;
+        }
+    };
+
+    indices.resize(total.corners);
+    if (total.sharedIndices && !(total.anyTexCoord && total.missingTexCoord) && !(total.anyNormal && total.missingNormal))
+    {
+        // Every corner uses one index for all attributes, the usual case for exported meshes,
+        // so the OBJ arrays already are the vertices
+        const uint32_t blockSize = 1 << 20;
+        threadPool.parallelFor(static_cast<uint32_t>((corners.size() + blockSize - 1) / blockSize), [&](uint32_t block) {
+            size_t end = std::min(corners.size(), static_cast<size_t>(block + 1) * blockSize);
+            for (size_t i = static_cast<size_t>(block) * blockSize; i < end; i++)
+            {
+                checkRange(corners[i]);
+                indices[i] = corners[i].position;
+            }
+        });
+        positions.swap(objPositions);
+        texCoords.clear();
+        normals.clear();
+        if (total.anyTexCoord)
+        {
+            objTexCoords.resize(positions.size() / 3 * 2);
+            texCoords.swap(objTexCoords);
+        }
+        if (total.anyNormal)
+        {
+            objNormals.resize(positions.size());
+            normals.swap(objNormals);
+        }
+    }
+    else
+    {
+        for (const ObjCorner &c : corners)
+        {
+            checkRange(c);
+        }
+        if (outOfRange)
+        {
+            printf("Mesh face references a missing vertex\n");
+            return false;
+        }
+        // Vertices made from the same position are chained, so finding a corner that was seen before
+        // only compares against the few vertices sharing its position
+        std::vector<uint32_t> firstVertex(total.positions, NO_INDEX);
+        std::vector<uint32_t> nextVertex;
+        std::vector<ObjCorner> vertexCorners;
+        positions.clear();
+        texCoords.clear();
+        normals.clear();
+        for (size_t i = 0; i < corners.size(); i++)
+        {
+            const ObjCorner &c = corners[i];
+            uint32_t vertex = firstVertex[c.position];
+            while (vertex != NO_INDEX && (vertexCorners[vertex].texCoord != c.texCoord || vertexCorners[vertex].normal != c.normal))
+            {
+                vertex = nextVertex[vertex];
+            }
+            if (vertex == NO_INDEX)
+            {
+                vertex = static_cast<uint32_t>(vertexCorners.size());
+                vertexCorners.push_back(c);
+                nextVertex.push_back(firstVertex[c.position]);
+                firstVertex[c.position] = vertex;
+
+                positions.insert(positions.end(), &objPositions[3 * c.position], &objPositions[3 * c.position] + 3);
+                if (total.anyTexCoord)
+                {
+                    const float zero[2] = {};
+                    const float *src = c.texCoord != NO_INDEX ? &objTexCoords[2 * c.texCoord] : zero;
+                    texCoords.insert(texCoords.end(), src, src + 2);
+                }
+                if (total.anyNormal)
+                {
+                    const float zero[3] = {};
+                    const float *src = c.normal != NO_INDEX ? &objNormals[3 * c.normal] : zero;
+                    normals.insert(normals.end(), src, src + 3);
+                }
+            }
+            indices[i] = vertex;
+        }
+    }
+    if (outOfRange)
+    {
+        printf("Mesh face references a missing vertex\n");
+        return false;
+    }
+    return true;
+}
+
+struct MeshFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    // MESH_FILE_NORMALS | MESH_FILE_TEXCOORDS
+    uint32_t flags;
+    uint32_t reserved;
+};
+#define MESH_FILE_NORMALS 1u
+#define MESH_FILE_TEXCOORDS 2u
+
+bool Mesh::loadBinary(const char *data, size_t size)
+{
+    MeshFileHeader header;
+    if (size < sizeof(header))
+    {
+        printf("Mesh file is truncated\n");
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != MESH_FILE_MAGIC || header.version != MESH_FILE_VERSION)
+    {
+        printf("Not a mesh file or unsupported version\n");
+        return false;
+    }
+    size_t vertexCount = header.vertexCount;
+    size_t floatCount = vertexCount * 3 + (header.flags & MESH_FILE_NORMALS ? vertexCount * 3 : 0) +
+                        (header.flags & MESH_FILE_TEXCOORDS ? vertexCount * 2 : 0);
+    if (size != sizeof(header) + floatCount * sizeof(float) + static_cast<size_t>(header.indexCount) * sizeof(uint32_t))
+    {
+        printf("Mesh file size does not match its header\n");
+        return false;
+    }
+
+    const char *p = data + sizeof(header);
+    auto read = [&p](std::vector<float> &dst, size_t count) {
+        dst.resize(count);
+        memcpy(dst.data(), p, count * sizeof(float));
+        p += count * sizeof(float);
+    };
+    read(positions, vertexCount * 3);
+    read(normals, header.flags & MESH_FILE_NORMALS ? vertexCount * 3 : 0);
+    read(texCoords, header.flags & MESH_FILE_TEXCOORDS ? vertexCount * 2 : 0);
+    indices.resize(header.indexCount);
+    memcpy(indices.data(), p, indices.size() * sizeof(uint32_t));
+
+    uint32_t maxIndex = 0;
+    for (uint32_t index : indices)
+    {
+        maxIndex = std::max(maxIndex, index);
+    }
+    if (indices.empty() || maxIndex >= vertexCount)
+    {
+        printf("Mesh file references a missing vertex\n");
+        return false;
+    }
+    return true;
+}
+
+bool Mesh::load(const char *fileName, ThreadPool &threadPool)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Could not open mesh %s\n", fileName);
+        return false;
+    }
+    struct stat fileStat;
+    void *mapped = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+        size = static_cast<size_t>(fileStat.st_size);
+        mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        printf("Could not map mesh %s\n", fileName);
+        return false;
+    }
+    // Both formats are read front to back once
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    size_t length = strlen(fileName);
+    bool obj = length >= 4 && strcmp(fileName + length - 4, ".obj") == 0;
+    const char *data = static_cast<const char *>(mapped);
+    bool loaded = obj ? loadObj(data, size, threadPool) : loadBinary(data, size);
+    munmap(mapped, size);
+    if (!loaded)
+    {
+        positions.clear();
+        normals.clear();
+        texCoords.clear();
+        indices.clear();
+        printf("Could not load mesh %s\n", fileName);
+    }
+    return loaded;
+}
+
+bool Mesh::saveBinary(const char *fileName) const
+{
+    MeshFileHeader header = {};
+    header.magic = MESH_FILE_MAGIC;
+    header.version = MESH_FILE_VERSION;
+    header.vertexCount = getVertexCount();
+    header.indexCount = getIndexCount();
+    header.flags = (hasNormals() ? MESH_FILE_NORMALS : 0) | (hasTexCoords() ? MESH_FILE_TEXCOORDS : 0);
+
+    FILE *file = fopen(fileName, "wb");
+    if (file == nullptr)
+    {
+        printf("Could not write mesh %s\n", fileName);
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(positions.data(), sizeof(float), positions.size(), file) == positions.size() &&
+                   fwrite(normals.data(), sizeof(float), normals.size(), file) == normals.size() &&
+                   fwrite(texCoords.data(), sizeof(float), texCoords.size(), file) == texCoords.size() &&
+                   fwrite(indices.data(), sizeof(uint32_t), indices.size(), file) == indices.size();
+    written = fclose(file) == 0 && written;
+    if (!written)
+    {
+        printf("Could not write mesh %s\n", fileName);
+    }
+    return written;
+}
+
+void Mesh::getBounds(float min[3], float max[3]) const
+{
+    for (int j = 0; j < 3; j++)
+    {
+        min[j] = positions.empty() ? 0.0f : positions[j];
+        max[j] = min[j];
+    }
+    for (size_t i = 0; i < positions.size(); i += 3)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            min[j] = std::min(min[j], positions[i + j]);
+            max[j] = std::max(max[j], positions[i + j]);
+        }
+    }
+}
+
+void Mesh::optimize(uint32_t cacheSize)
+{
+    std::vector<uint32_t> clusters;
+    vertexcache::optimizeCache(indices, getVertexCount(), cacheSize, &clusters);
+    vertexcache::optimizeOverdraw(indices, clusters, positions.data(), 3 * sizeof(float));
+
+    std::vector<uint32_t> remap;
+    uint32_t usedCount = vertexcache::optimizeFetch(indices, remap, getVertexCount());
+    vertexcache::remapVertices(positions, remap, usedCount, 3);
+    if (hasNormals())
+    {
+        vertexcache::remapVertices(normals, remap, usedCount, 3);
+    }
+    if (hasTexCoords())
+    {
+        vertexcache::remapVertices(texCoords, remap, usedCount, 2);
+    }
+}
+
+void Mesh::writeVertices(void *dst, const MeshVertexLayout &layout, uint32_t first, uint32_t count) const
+{
+    unsigned char *out = static_cast<unsigned char *>(dst);
+    const float zero[3] = {};
+    for (size_t i = first; i < static_cast<size_t>(first) + count; i++, out += layout.stride)
+    {
+        if (layout.positionOffset >= 0)
+        {
+            memcpy(out + layout.positionOffset, &positions[3 * i], 3 * sizeof(float));
+        }
+        if (layout.normalOffset >= 0)
+        {
+            memcpy(out + layout.normalOffset, hasNormals() ? &normals[3 * i] : zero, 3 * sizeof(float));
+        }
+        if (layout.texCoordOffset >= 0)
+        {
+            memcpy(out + layout.texCoordOffset, hasTexCoords() ? &texCoords[2 * i] : zero, 2 * sizeof(float));
+        }
+    }
+}
+} // namespace myvk
@@ -0,0 +1,78 @@
+/*
+* Mesh loading
+*
+* Wavefront OBJ and a binary mesh format are read from a mapping of the file. OBJ text is cut into
+* chunks at line breaks that are counted and then parsed on a thread pool, so every chunk writes
+* straight into its own range of the output arrays
+*
+* Vertices are kept as separate position, normal and texture coordinate arrays and can be written
+* in any interleaved or split layout, e.g. directly into mapped staging memory
+*/
+
+#ifndef MESH_HPP
+#define MESH_HPP
+
+#include "threadpool.hpp"
+#include "vertexcache.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// "MVMS" in a little endian file
+#define MESH_FILE_MAGIC 0x534d564du
+#define MESH_FILE_VERSION 1
+
+namespace myvk
+{
+/** @brief Where writeVertices puts the attributes of a vertex, attributes with a negative offset are skipped */
+struct MeshVertexLayout
+{
+    uint32_t stride;
+    int32_t positionOffset = -1;
+    int32_t normalOffset = -1;
+    int32_t texCoordOffset = -1;
+};
+
+class Mesh
+{
+  public:
+    /** @brief Load a .obj file, any other extension is read as binary mesh written by saveBinary
+     *  @note Polygons are triangulated as fans, vertices sharing all indices of a face corner are merged
+     *  @return false if the file can't be mapped or parsed */
+    bool load(const char *fileName, ThreadPool &threadPool);
+    bool saveBinary(const char *fileName) const;
+
+    uint32_t getVertexCount() const { return static_cast<uint32_t>(positions.size() / 3); }
+    uint32_t getIndexCount() const { return static_cast<uint32_t>(indices.size()); }
+    bool hasNormals() const { return !normals.empty(); }
+    bool hasTexCoords() const { return !texCoords.empty(); }
+    /** @brief Triangle list */
+    const std::vector<uint32_t> &getIndices() const { return indices; }
+    void getBounds(float min[3], float max[3]) const;
+
+    /** @brief Write vertices [first, first + count) to dst in the given layout
+     *  @note Attributes the mesh doesn't have are written as zero */
+    void writeVertices(void *dst, const MeshVertexLayout &layout, uint32_t first, uint32_t count) const;
+
+    /** @brief Reorder triangles for the vertex cache and overdraw, then vertices in the order they are first used
+     *  @note Vertices no triangle uses are dropped */
+    void optimize(uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+  private:
+    // One entry per vertex, normals and texCoords are empty if the file has none
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> texCoords;
+    std::vector<uint32_t> indices;
+
+    bool loadObj(const char *data, size_t size, ThreadPool &threadPool);
+    bool loadBinary(const char *data, size_t size);
+};
+
+/** @brief Parse a decimal float in [begin, end) like strtof, without locale and without needing a terminator
+ *  @return Pointer behind the number, begin if there is none */
+const char *parseFloat(const char *begin, const char *end, float &value);
+} // namespace myvk
+
+#endif
@@ -0,0 +1,165 @@
+/*
+* Mip chain building
+*/
+
+#include "mipmap.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include <stb-master/stb_image_resize.h>
+
+// Levels are split into about this many bands per thread so uneven bands even out,
+// bands have at least MIP_BAND_MIN_ROWS rows and levels below MIP_TAIL_TEXELS texels are not split at all
+#define MIP_BANDS_PER_THREAD 4
+#define MIP_BAND_MIN_ROWS 16
+#define MIP_TAIL_TEXELS (64 * 1024)
+
+namespace myvk
+{
+namespace mipmap
+{
+uint32_t getLevelCount(uint32_t width, uint32_t height)
+{
+    uint32_t levelCount = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+    {
+        levelCount++;
+    }
+    return levelCount;
+}
+
+MipChainLayout layoutChain(uint32_t width, uint32_t height, uint32_t channels, uint32_t levelCount, size_t alignment)
+{
+    MipChainLayout layout;
+    layout.channels = channels;
+    levelCount = levelCount == 0 ? getLevelCount(width, height) : std::min(levelCount, getLevelCount(width, height));
+    size_t offset = 0;
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        MipLevel mipLevel;
+        mipLevel.width = std::max(width >> level, 1u);
+        mipLevel.height = std::max(height >> level, 1u);
+        mipLevel.offset = (offset + alignment - 1) / alignment * alignment;
+        mipLevel.size = static_cast<size_t>(mipLevel.width) * mipLevel.height * channels;
+        layout.levels.push_back(mipLevel);
+        offset = mipLevel.offset + mipLevel.size;
+    }
+    layout.size = offset;
+    return layout;
+}
+
+// Rows [firstRow, firstRow + rowCount) of dst, sampled from the whole of src so filters reach across the band edges.
+// The offset puts the band where it is in the full level, so the bands together give the same result as one resize
+static bool resizeBand(const unsigned char *src, const MipLevel &srcLevel, unsigned char *dst, const MipLevel &dstLevel,
+                       uint32_t firstRow, uint32_t rowCount, uint32_t channels, bool srgb, bool wrap)
+{
+    int alphaChannel = channels == 4 ? 3 : channels == 2 ? 1 : STBIR_ALPHA_CHANNEL_NONE;
+    stbir_edge edge = wrap ? STBIR_EDGE_WRAP : STBIR_EDGE_CLAMP;
+    size_t dstRowSize = static_cast<size_t>(dstLevel.width) * channels;
+    return stbir_resize_subpixel(src, srcLevel.width, srcLevel.height, srcLevel.width * channels,
+                                 dst + firstRow * dstRowSize, dstLevel.width, rowCount, static_cast<int>(dstRowSize),
+                                 STBIR_TYPE_UINT8, channels, alphaChannel, 0, edge, edge, STBIR_FILTER_DEFAULT, STBIR_FILTER_DEFAULT,
+                                 srgb ? STBIR_COLORSPACE_SRGB : STBIR_COLORSPACE_LINEAR, nullptr,
+                                 static_cast<float>(dstLevel.width) / srcLevel.width, static_cast<float>(dstLevel.height) / srcLevel.height,
+                                 0.0f, static_cast<float>(firstRow)) != 0;
+}
+
+// All of dstLevel resampled from srcLevel, in bands on the pool unless the level is part of the tail
+static bool buildLevel(const unsigned char *src, const MipLevel &srcLevel, unsigned char *dst, const MipLevel &dstLevel,
+                       uint32_t channels, ThreadPool &threadPool, bool srgb, bool wrap)
+{
+    // The tail is cheaper than waking up the pool for every level
+    if (static_cast<size_t>(dstLevel.width) * dstLevel.height < MIP_TAIL_TEXELS)
+    {
+        return resizeBand(src, srcLevel, dst, dstLevel, 0, dstLevel.height, channels, srgb, wrap);
+    }
+    const uint32_t targetBands = threadPool.getThreadCount() * MIP_BANDS_PER_THREAD;
+    uint32_t bandRows = std::max((dstLevel.height + targetBands - 1) / targetBands, static_cast<uint32_t>(MIP_BAND_MIN_ROWS));
+    std::atomic<bool> failed{false};
+    threadPool.parallelFor((dstLevel.height + bandRows - 1) / bandRows, [&](uint32_t band) {
+        uint32_t firstRow = band * bandRows;
+        uint32_t rowCount = std::min(bandRows, dstLevel.height - firstRow);
+        if (!resizeBand(src, srcLevel, dst, dstLevel, firstRow, rowCount, channels, srgb, wrap))
+        {
+            failed = true;
+        }
+    });
+    return !failed;
+}
+
+bool buildChain(const unsigned char *pixels, const MipChainLayout &layout, void *dst, ThreadPool &threadPool, bool srgb, bool wrap)
+{
+    unsigned char *base = static_cast<unsigned char *>(dst);
+    const uint32_t channels = layout.channels;
+    const uint32_t targetBands = threadPool.getThreadCount() * MIP_BANDS_PER_THREAD;
+
+    // Level 0 is a plain copy, in bands as well since the staging memory may be slow to write from one thread
+    const MipLevel &top = layout.levels[0];
+    size_t topRowSize = static_cast<size_t>(top.width) * channels;
+    uint32_t copyRows = std::max((top.height + targetBands - 1) / targetBands, 1u);
+    threadPool.parallelFor((top.height + copyRows - 1) / copyRows, [&](uint32_t band) {
+        uint32_t firstRow = band * copyRows;
+        uint32_t rowCount = std::min(copyRows, top.height - firstRow);
+        memcpy(base + top.offset + firstRow * topRowSize, pixels + firstRow * topRowSize, rowCount * topRowSize);
+    });
+
+    // Every level reads the one above, so the levels run in order and the bands of one level in parallel
+    for (uint32_t level = 1; level < layout.levels.size(); level++)
+    {
+        const MipLevel &srcLevel = layout.levels[level - 1];
+        const MipLevel &dstLevel = layout.levels[level];
+        if (!buildLevel(base + srcLevel.offset, srcLevel, base + dstLevel.offset, dstLevel, channels, threadPool, srgb, wrap))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+ChainBuilder::ChainBuilder(const unsigned char *pixels, const MipChainLayout &layout, ThreadPool &threadPool, bool srgb, bool wrap)
+    : pixels(pixels), layout(layout), threadPool(threadPool), srgb(srgb), wrap(wrap)
+{
+}
+
+const unsigned char *ChainBuilder::getLevel(uint32_t level)
+{
+    assert(level < layout.levels.size() && level + 1 >= builtLevel);
+    if (level == 0)
+    {
+        return pixels;
+    }
+    // Odd and even levels take turns in the two buffers, so the level above is still there to be read
+    while (builtLevel < level && !failed)
+    {
+        uint32_t next = builtLevel + 1;
+        const unsigned char *src = builtLevel == 0 ? pixels : buffers[builtLevel % 2].data();
+        buffers[next % 2].resize(layout.levels[next].size);
+        failed = !buildLevel(src, layout.levels[builtLevel], buffers[next % 2].data(), layout.levels[next], layout.channels, threadPool, srgb, wrap);
+        builtLevel = next;
+    }
+    return failed ? nullptr : buffers[level % 2].data();
+}
+
+std::vector<VkBufferImageCopy> copyRegions(const MipChainLayout &layout, VkDeviceSize bufferOffset)
+{
+    std::vector<VkBufferImageCopy> regions(layout.levels.size());
+    for (uint32_t level = 0; level < layout.levels.size(); level++)
+    {
+        VkBufferImageCopy &region = regions[level];
+        region = {};
+        region.bufferOffset = bufferOffset + layout.levels[level].offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {layout.levels[level].width, layout.levels[level].height, 1};
+    }
+    return regions;
+}
+} // namespace mipmap
+} // namespace myvk
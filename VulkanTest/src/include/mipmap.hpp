@@ -0,0 +1,88 @@
+/*
+* Mip chain building
+*
+* Every level of a texture is resampled on the CPU from the level above it with stb_image_resize,
+* in sRGB space by default. A level is cut into bands of rows that are resized on a thread pool,
+* only the tiny tail levels are done together on one thread
+*
+* The levels are laid out one after another in a single allocation, e.g. a staging region, so the
+* whole chain goes to the image with one vkCmdCopyBufferToImage using the regions of copyRegions.
+* ChainBuilder hands out the levels one at a time instead, without the memory of the whole chain
+*/
+
+#ifndef MIPMAP_HPP
+#define MIPMAP_HPP
+
+#include <vulkan/vulkan.h>
+#include "threadpool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Offsets of the levels are multiples of this, enough for the texel size and common copy offset alignments
+#define MIP_LEVEL_ALIGNMENT 256
+
+namespace myvk
+{
+namespace mipmap
+{
+struct MipLevel
+{
+    uint32_t width;
+    uint32_t height;
+    size_t offset;
+    size_t size;
+};
+
+struct MipChainLayout
+{
+    uint32_t channels = 0;
+    std::vector<MipLevel> levels;
+    // Bytes from the start of level 0 to the end of the last level
+    size_t size = 0;
+};
+
+/** @brief Number of levels down to 1x1, floor(log2(max(width, height))) + 1 */
+uint32_t getLevelCount(uint32_t width, uint32_t height);
+
+/** @brief Place the levels of a chain of tightly packed 8 bit texels
+ *  @param levelCount 0 for the full chain */
+MipChainLayout layoutChain(uint32_t width, uint32_t height, uint32_t channels, uint32_t levelCount = 0, size_t alignment = MIP_LEVEL_ALIGNMENT);
+
+/** @brief Copy pixels into level 0 of dst and fill every other level by downsampling the one above
+ *  @param srgb Filter in linear light, the alpha channel of 4 channel texels is always linear
+ *  @param wrap Sample across the opposite edge as a repeating texture does, otherwise clamp
+ *  @return false if stb_image_resize fails, e.g. out of memory */
+bool buildChain(const unsigned char *pixels, const MipChainLayout &layout, void *dst, ThreadPool &threadPool, bool srgb = true, bool wrap = false);
+
+/** @brief Builds the levels of a chain one at a time for uploads that stream it level by level. Only the last two
+ *  levels are held in host memory, about a third of level 0, since each one is resampled from the one above */
+class ChainBuilder
+{
+  public:
+    /** @param pixels Level 0, has to stay valid while levels are built. srgb and wrap are the same as for buildChain */
+    ChainBuilder(const unsigned char *pixels, const MipChainLayout &layout, ThreadPool &threadPool, bool srgb = true, bool wrap = false);
+
+    /** @brief Tightly packed texels of a level, built from the one above the first time it is asked for
+     *  @note Levels are asked for in order, a level stays valid until the second one after it is built
+     *  @return nullptr if stb_image_resize fails */
+    const unsigned char *getLevel(uint32_t level);
+
+  private:
+    const unsigned char *pixels;
+    const MipChainLayout &layout;
+    ThreadPool &threadPool;
+    bool srgb;
+    bool wrap;
+    uint32_t builtLevel = 0;
+    bool failed = false;
+    std::vector<unsigned char> buffers[2];
+};
+
+/** @brief Copies of every level of a chain that starts at bufferOffset into a 2D color image */
+std::vector<VkBufferImageCopy> copyRegions(const MipChainLayout &layout, VkDeviceSize bufferOffset = 0);
+} // namespace mipmap
+} // namespace myvk
+
+#endif
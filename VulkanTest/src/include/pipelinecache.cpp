@@ -0,0 +1,139 @@
+/*
+* Persistent pipeline cache
+*/
+
+#include "pipelinecache.hpp"
+
+#include <unistd.h>
+
+namespace myvk
+{
+static uint64_t fnv1a(const char *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Reject data the driver would choke on or that belongs to another device or driver version
+bool PipelineCache::validate(const std::vector<char> &data) const
+{
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    return header.headerSize >= sizeof(header) &&
+           header.headerSize <= data.size() &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == deviceProperties.vendorID &&
+           header.deviceID == deviceProperties.deviceID &&
+           memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::create(VkPhysicalDevice physicalDevice, VkDevice device, const std::string &fileName)
+{
+    this->device = device;
+    this->fileName = fileName;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    std::vector<char> data;
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if (file.is_open())
+    {
+        FileHeader fileHeader = {};
+        std::streamoff fileSize = file.tellg();
+        file.seekg(0, std::ios::beg);
+        if (fileSize >= (std::streamoff)sizeof(fileHeader) && file.read(reinterpret_cast<char *>(&fileHeader), sizeof(fileHeader)) &&
+            fileHeader.magic == PIPELINE_CACHE_FILE_MAGIC && fileHeader.version == PIPELINE_CACHE_FILE_VERSION &&
+            fileHeader.dataSize == (uint64_t)(fileSize - sizeof(fileHeader)))
+        {
+            data.resize(fileHeader.dataSize);
+            if (!file.read(data.data(), data.size()) || fnv1a(data.data(), data.size()) != fileHeader.checksum || !validate(data))
+            {
+                data.clear();
+            }
+        }
+        if (data.empty())
+        {
+            printf("Ignoring stale or damaged pipeline cache %s\n", fileName.c_str());
+        }
+    }
+
+    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
+    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipelineCacheCreateInfo.initialDataSize = data.size();
+    pipelineCacheCreateInfo.pInitialData = data.empty() ? nullptr : data.data();
+    VkResult result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &cache);
+    if (result != VK_SUCCESS && !data.empty())
+    {
+        // The driver may still refuse data that passed the header checks
+        printf("Driver rejected pipeline cache %s\n", fileName.c_str());
+        data.clear();
+        pipelineCacheCreateInfo.initialDataSize = 0;
+        pipelineCacheCreateInfo.pInitialData = nullptr;
+        result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &cache);
+    }
+    VK_CHECK_RESULT(result);
+
+    warm = !data.empty();
+    loadedSize = data.size();
+}
+
+bool PipelineCache::save()
+{
+    size_t size = 0;
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, cache, &size, nullptr));
+    std::vector<char> data(size);
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, cache, &size, data.data()));
+    data.resize(size);
+
+    FileHeader fileHeader = {};
+    fileHeader.magic = PIPELINE_CACHE_FILE_MAGIC;
+    fileHeader.version = PIPELINE_CACHE_FILE_VERSION;
+    fileHeader.dataSize = data.size();
+    fileHeader.checksum = fnv1a(data.data(), data.size());
+
+    // Write next to the old file and rename over it, readers never see a half written cache
+    std::string tmpName = fileName + ".tmp";
+    FILE *file = fopen(tmpName.c_str(), "wb");
+    if (file == nullptr)
+    {
+        printf("Could not write pipeline cache %s\n", tmpName.c_str());
+        return false;
+    }
+    bool written = fwrite(&fileHeader, sizeof(fileHeader), 1, file) == 1 &&
+                   fwrite(data.data(), 1, data.size(), file) == data.size() &&
+                   fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(tmpName.c_str(), fileName.c_str()) != 0)
+    {
+        printf("Could not write pipeline cache %s\n", fileName.c_str());
+        remove(tmpName.c_str());
+        return false;
+    }
+    loadedSize = data.size();
+    return true;
+}
+
+void PipelineCache::destroy()
+{
+    if (cache == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    size_t size = 0;
+    VK_CHECK_RESULT(vkGetPipelineCacheData(device, cache, &size, nullptr));
+    if (size != loadedSize)
+    {
+        save();
+    }
+    vkDestroyPipelineCache(device, cache, nullptr);
+    cache = VK_NULL_HANDLE;
+}
+} // namespace myvk
@@ -0,0 +1,58 @@
+/*
+* Persistent pipeline cache
+*
+* The driver's pipeline cache data is kept in a file between runs, so only the first run of a
+* binary on a device pays the full pipeline compilation
+*/
+
+#ifndef PIPELINECACHE_HPP
+#define PIPELINECACHE_HPP
+
+#include <vulkan/vulkan.h>
+#include "tools.hpp"
+
+#include <string>
+
+// "MVPC", marks files written by PipelineCache
+#define PIPELINE_CACHE_FILE_MAGIC 0x4350564du
+#define PIPELINE_CACHE_FILE_VERSION 1
+
+namespace myvk
+{
+class PipelineCache
+{
+  public:
+    /** @brief Seed the cache from fileName if it was written for this device and driver, start empty otherwise */
+    void create(VkPhysicalDevice physicalDevice, VkDevice device, const std::string &fileName);
+    /** @brief Write the cache back if pipelines were added to it, then destroy it */
+    void destroy();
+
+    /** @brief Replace the file with the current cache content, the old file stays intact if writing fails */
+    bool save();
+
+    VkPipelineCache get() const { return cache; }
+    /** @brief true if the cache was seeded from the file */
+    bool isWarm() const { return warm; }
+
+  private:
+    // Written in front of the driver data to catch truncated or damaged files
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t dataSize;
+        uint64_t checksum;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceProperties deviceProperties{};
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    std::string fileName;
+    bool warm = false;
+    size_t loadedSize = 0;
+
+    bool validate(const std::vector<char> &data) const;
+};
+} // namespace myvk
+
+#endif
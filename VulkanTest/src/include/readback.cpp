@@ -0,0 +1,127 @@
+/*
+* Framebuffer readback
+*/
+
+#include "readback.hpp"
+
+namespace myvk
+{
+void ReadbackQueue::create(VkDevice device, Allocator &allocator, SubmitContext &submitContext, uint32_t width, uint32_t height, uint32_t texelSize, uint32_t slotCount)
+{
+    assert(slotCount > 0);
+    this->device = device;
+    this->allocator = &allocator;
+    this->submitContext = &submitContext;
+    this->width = width;
+    this->height = height;
+    this->texelSize = texelSize;
+
+    VkDeviceSize size = (VkDeviceSize)width * height * texelSize;
+    slots.resize(slotCount);
+    for (auto &slot : slots)
+    {
+        slot = {};
+        VkBufferCreateInfo bufferCreateInfo = myvk::initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &slot.buffer));
+        VkMemoryRequirements memReqs;
+        vkGetBufferMemoryRequirements(device, slot.buffer, &memReqs);
+        VK_CHECK_RESULT(allocator.allocate(memReqs, MEMORY_USAGE_READBACK, ALLOCATION_TILING_LINEAR, slot.memory));
+        VK_CHECK_RESULT(vkBindBufferMemory(device, slot.buffer, slot.memory.memory, slot.memory.offset));
+    }
+    head = 0;
+    tail = 0;
+    count = 0;
+    recordedCount = 0;
+}
+
+void ReadbackQueue::destroy()
+{
+    for (auto &slot : slots)
+    {
+        if (slot.state == SLOT_PENDING)
+        {
+            submitContext->wait(slot.token);
+        }
+        vkDestroyBuffer(device, slot.buffer, nullptr);
+        allocator->free(slot.memory);
+    }
+    slots.clear();
+}
+
+void ReadbackQueue::record(VkCommandBuffer cmdBuffer, VkImage image)
+{
+    Slot &slot = slots[head];
+    assert(slot.state == SLOT_FREE && "readback queue is full");
+
+    // Tightly packed rows, so the whole copy can be read or written out in one go
+    VkBufferImageCopy copyRegion = {};
+    copyRegion.bufferOffset = 0;
+    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.imageSubresource.mipLevel = 0;
+    copyRegion.imageSubresource.baseArrayLayer = 0;
+    copyRegion.imageSubresource.layerCount = 1;
+    copyRegion.imageExtent = {width, height, 1};
+    vkCmdCopyImageToBuffer(cmdBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &copyRegion);
+
+    // Make the copy available to host reads once the fence of the submission has signaled
+    VkBufferMemoryBarrier barrier = myvk::initializers::bufferMemoryBarrier();
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.buffer = slot.buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    slot.index = recordedCount++;
+    slot.state = SLOT_RECORDED;
+    head = (head + 1) % slots.size();
+    count++;
+}
+
+void ReadbackQueue::submitted(SubmitToken token)
+{
+    Slot &slot = slots[(head + slots.size() - 1) % slots.size()];
+    assert(slot.state == SLOT_RECORDED);
+    slot.token = token;
+    slot.state = SLOT_PENDING;
+}
+
+bool ReadbackQueue::map(ReadbackFrame &frame, bool wait)
+{
+    if (count == 0)
+    {
+        return false;
+    }
+    Slot &slot = slots[tail];
+    assert(slot.state == SLOT_PENDING && "oldest readback is not submitted or already mapped");
+    if (!submitContext->isComplete(slot.token))
+    {
+        if (!wait)
+        {
+            return false;
+        }
+        submitContext->wait(slot.token);
+    }
+
+    VkDeviceSize rowPitch = (VkDeviceSize)width * texelSize;
+    allocator->invalidate(slot.memory, 0, rowPitch * height);
+    slot.state = SLOT_MAPPED;
+
+    frame.data = slot.memory.mapped;
+    frame.width = width;
+    frame.height = height;
+    frame.rowPitch = rowPitch;
+    frame.index = slot.index;
+    return true;
+}
+
+void ReadbackQueue::unmap()
+{
+    Slot &slot = slots[tail];
+    assert(slot.state == SLOT_MAPPED);
+    slot.state = SLOT_FREE;
+    tail = (tail + 1) % slots.size();
+    count--;
+}
+} // namespace myvk
@@ -0,0 +1,90 @@
+/*
+* Framebuffer readback
+*
+* Images are copied into a small ring of host cached buffers, so the CPU can read and encode one
+* copy while the GPU is still rendering the following frames
+*/
+
+#ifndef READBACK_HPP
+#define READBACK_HPP
+
+#include <vulkan/vulkan.h>
+#include "tools.hpp"
+#include "allocator.hpp"
+#include "submit.hpp"
+
+#include <vector>
+
+// Two slots let the CPU read frame N while frame N + 1 renders, a third one absorbs uneven frame times
+#define DEFAULT_READBACK_SLOTS 2
+
+namespace myvk
+{
+struct ReadbackFrame
+{
+    // Host pointer to the first row, rows are rowPitch bytes apart
+    const void *data = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    VkDeviceSize rowPitch = 0;
+    // Serial number of the copy, counting from 0
+    uint64_t index = 0;
+};
+
+class ReadbackQueue
+{
+  public:
+    /** @brief Every slot holds one width x height image with texelSize bytes per texel */
+    void create(VkDevice device, Allocator &allocator, SubmitContext &submitContext, uint32_t width, uint32_t height, uint32_t texelSize, uint32_t slotCount = DEFAULT_READBACK_SLOTS);
+    /** @brief Waits for the copies still in flight before destroying the buffers */
+    void destroy();
+
+    /** @brief Record a copy of mip 0 of a 2D color image in TRANSFER_SRC_OPTIMAL into the next slot
+     *  @note The slot must be free, map and unmap the oldest copy first if the queue is full */
+    void record(VkCommandBuffer cmdBuffer, VkImage image);
+    /** @brief The copy recorded last is executed by the submission of token */
+    void submitted(SubmitToken token);
+
+    /** @brief Map the oldest copy, blocks until its submission has finished if wait is set
+     *  @return false if there is no copy in flight or it has not finished yet */
+    bool map(ReadbackFrame &frame, bool wait = true);
+    /** @brief Hand the mapped slot back for later copies */
+    void unmap();
+
+    /** @brief Number of copies recorded and not unmapped yet */
+    uint32_t pending() const { return count; }
+    bool full() const { return count == static_cast<uint32_t>(slots.size()); }
+
+  private:
+    enum SlotState
+    {
+        SLOT_FREE = 0,
+        SLOT_RECORDED,
+        SLOT_PENDING,
+        SLOT_MAPPED,
+    };
+    struct Slot
+    {
+        VkBuffer buffer;
+        Allocation memory;
+        SubmitToken token;
+        uint64_t index;
+        SlotState state;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    Allocator *allocator = nullptr;
+    SubmitContext *submitContext = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t texelSize = 0;
+    std::vector<Slot> slots;
+    // Next slot to record into and oldest slot in use
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    uint32_t count = 0;
+    uint64_t recordedCount = 0;
+};
+} // namespace myvk
+
+#endif
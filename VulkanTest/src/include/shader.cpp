@@ -0,0 +1,155 @@
+/*
+* Shader module registry
+*/
+
+#include "shader.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace myvk
+{
+static uint64_t fnv1a(const uint32_t *code, size_t size)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(code);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+void ShaderRegistry::create(VkDevice device)
+{
+    this->device = device;
+}
+
+void ShaderRegistry::destroy()
+{
+    for (auto &module : modules)
+    {
+        vkDestroyShaderModule(device, module.second.module, nullptr);
+    }
+    modules.clear();
+    paths.clear();
+}
+
+VkShaderModule ShaderRegistry::addReference(uint64_t hash)
+{
+    auto it = modules.find(hash);
+    if (it == modules.end())
+    {
+        return VK_NULL_HANDLE;
+    }
+    it->second.refCount++;
+    return it->second.module;
+}
+
+bool ShaderRegistry::isSpirv(const char *fileName)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat fileStat;
+    uint32_t magic = 0;
+    bool valid = fstat(fd, &fileStat) == 0 && fileStat.st_size > 0 && fileStat.st_size % sizeof(uint32_t) == 0 &&
+                 read(fd, &magic, sizeof(magic)) == sizeof(magic) && magic == SPIRV_MAGIC;
+    close(fd);
+    return valid;
+}
+
+VkShaderModule ShaderRegistry::acquire(const char *fileName)
+{
+    requestCount++;
+    auto path = paths.find(fileName);
+    if (path != paths.end())
+    {
+        VkShaderModule module = addReference(path->second);
+        if (module != VK_NULL_HANDLE)
+        {
+            return module;
+        }
+    }
+
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Error: Could not open shader file \"" << fileName << "\"" << std::endl;
+        return VK_NULL_HANDLE;
+    }
+    struct stat fileStat;
+    void *mapped = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+        size = static_cast<size_t>(fileStat.st_size);
+        mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        std::cerr << "Error: Could not map shader file \"" << fileName << "\"" << std::endl;
+        return VK_NULL_HANDLE;
+    }
+    fileCount++;
+
+    // Mappings are page aligned, so the code can be handed to the driver as words without a copy
+    const uint32_t *code = static_cast<const uint32_t *>(mapped);
+    if (size % sizeof(uint32_t) != 0 || code[0] != SPIRV_MAGIC)
+    {
+        std::cerr << "Error: \"" << fileName << "\" is not a SPIR-V module" << std::endl;
+        munmap(mapped, size);
+        return VK_NULL_HANDLE;
+    }
+
+    uint64_t hash = fnv1a(code, size);
+    paths[fileName] = hash;
+    VkShaderModule module = addReference(hash);
+    if (module == VK_NULL_HANDLE)
+    {
+        VkShaderModuleCreateInfo moduleCreateInfo{};
+        moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        moduleCreateInfo.codeSize = size;
+        moduleCreateInfo.pCode = code;
+        VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, nullptr, &module));
+        modules[hash] = {module, size, 1};
+        createCount++;
+    }
+    else
+    {
+        assert(modules[hash].size == size && "shader hash collision");
+    }
+    munmap(mapped, size);
+    return module;
+}
+
+void ShaderRegistry::release(VkShaderModule module)
+{
+    for (auto it = modules.begin(); it != modules.end(); ++it)
+    {
+        if (it->second.module != module)
+        {
+            continue;
+        }
+        assert(it->second.refCount > 0);
+        if (--it->second.refCount == 0)
+        {
+            vkDestroyShaderModule(device, module, nullptr);
+            modules.erase(it);
+        }
+        return;
+    }
+}
+
+void ShaderRegistry::dumpStats() const
+{
+    printf("Shaders: %u requests, %u files mapped, %u modules created, %zu alive\n",
+           requestCount, fileCount, createCount, modules.size());
+}
+} // namespace myvk
@@ -0,0 +1,61 @@
+/*
+* Shader module registry
+*
+* SPIR-V files are mapped instead of read into a copy, and modules are shared by content, so
+* pipelines using the same shader code create one VkShaderModule between them
+*/
+
+#ifndef SHADER_HPP
+#define SHADER_HPP
+
+#include <vulkan/vulkan.h>
+#include "tools.hpp"
+
+#include <string>
+#include <unordered_map>
+
+// First word of every SPIR-V module
+#define SPIRV_MAGIC 0x07230203u
+
+namespace myvk
+{
+class ShaderRegistry
+{
+  public:
+    void create(VkDevice device);
+    /** @brief Destroys every module, including the ones that were not released */
+    void destroy();
+
+    /** @brief Get the module for a SPIR-V file, shared with every earlier request for the same code
+     *  @return VK_NULL_HANDLE if the file can't be mapped or is not SPIR-V */
+    VkShaderModule acquire(const char *fileName);
+    /** @brief Drop one reference to a module, it is destroyed with the last one */
+    void release(VkShaderModule module);
+    /** @brief Check that a file holds SPIR-V without a device, to pick a path before acquire is possible */
+    static bool isSpirv(const char *fileName);
+
+    /** @brief Print how many requests were served without file I/O or module creation */
+    void dumpStats() const;
+
+  private:
+    struct Entry
+    {
+        VkShaderModule module;
+        size_t size;
+        uint32_t refCount;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    // Modules by FNV-1a hash of their code
+    std::unordered_map<uint64_t, Entry> modules;
+    // Code hash of every file loaded so far, a known path skips the file entirely
+    std::unordered_map<std::string, uint64_t> paths;
+    uint32_t requestCount = 0;
+    uint32_t fileCount = 0;
+    uint32_t createCount = 0;
+
+    VkShaderModule addReference(uint64_t hash);
+};
+} // namespace myvk
+
+#endif
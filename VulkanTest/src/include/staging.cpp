@@ -0,0 +1,330 @@
+/*
+* Staging ring buffer
+*/
+
+#include "staging.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace myvk
+{
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static VkDeviceSize leastCommonMultiple(VkDeviceSize a, VkDeviceSize b)
+{
+    VkDeviceSize x = a, y = b;
+    while (y != 0)
+    {
+        VkDeviceSize t = x % y;
+        x = y;
+        y = t;
+    }
+    return a / x * b;
+}
+
+void StagingRing::create(VkPhysicalDevice physicalDevice, VkDevice device, Allocator &allocator, SubmitContext &submitContext, VkDeviceSize size)
+{
+    this->device = device;
+    this->allocator = &allocator;
+    this->submitContext = &submitContext;
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    // Buffer to image copies need offsets aligned to 4 bytes, some devices are faster with more
+    copyOffsetAlignment = std::max<VkDeviceSize>(deviceProperties.limits.optimalBufferCopyOffsetAlignment, 4);
+    this->size = alignUp(size, copyOffsetAlignment);
+
+    // Dedicated transfer queues may only copy image blocks of a coarser granularity
+    uint32_t queueFamilyCount;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
+    imageRowGranularity = queueFamilyProperties[submitContext.getQueueFamilyIndex()].minImageTransferGranularity.height;
+
+    VkBufferCreateInfo bufferCreateInfo = myvk::initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, this->size);
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &buffer));
+    VkMemoryRequirements memReqs;
+    vkGetBufferMemoryRequirements(device, buffer, &memReqs);
+    VK_CHECK_RESULT(allocator.allocate(memReqs, MEMORY_USAGE_UPLOAD, ALLOCATION_TILING_LINEAR, memory));
+    VK_CHECK_RESULT(vkBindBufferMemory(device, buffer, memory.memory, memory.offset));
+
+    head = 0;
+    tail = 0;
+}
+
+void StagingRing::destroy()
+{
+    finish();
+    vkDestroyBuffer(device, buffer, nullptr);
+    allocator->free(memory);
+}
+
+bool StagingRing::retire(bool wait)
+{
+    bool retired = false;
+    while (!submissions.empty())
+    {
+        Submission &submission = submissions.front();
+        if (!submitContext->isComplete(submission.token))
+        {
+            // Block on the oldest submission only if nothing has been reclaimed so far
+            if (!wait || retired)
+            {
+                break;
+            }
+            submitContext->wait(submission.token);
+        }
+        tail = submission.end;
+        submissions.pop_front();
+        retired = true;
+    }
+    return retired;
+}
+
+// Reclaim finished submissions, or submit the recorded copies so they can be reclaimed next time.
+// Fails if the ring is held by acquired regions that were never released, waiting would never end
+bool StagingRing::makeRoom()
+{
+    if (retire(true))
+    {
+        return true;
+    }
+    if (cmdBuffer == VK_NULL_HANDLE)
+    {
+        printf("Staging ring is full of regions that were never released\n");
+        return false;
+    }
+    flush();
+    return true;
+}
+
+VkCommandBuffer StagingRing::getCommandBuffer()
+{
+    if (cmdBuffer == VK_NULL_HANDLE)
+    {
+        cmdBuffer = submitContext->begin();
+    }
+    return cmdBuffer;
+}
+
+// Take the largest free region of at most maxSize bytes that is a whole multiple of granularity without waiting
+StagingRegion StagingRing::acquireChunk(VkDeviceSize granularity, VkDeviceSize maxSize, VkDeviceSize alignment)
+{
+    StagingRegion region;
+    VkDeviceSize position = head % size;
+    VkDeviceSize limit = tail + size;
+    VkDeviceSize start = head + (alignUp(position, alignment) - position);
+    VkDeviceSize bufferEnd = head - position + size;
+
+    // Wrap around if what is left before the end of the buffer can't hold a single granule
+    if (start + granularity > std::min(bufferEnd, limit))
+    {
+        start = bufferEnd;
+    }
+    VkDeviceSize end = std::min(start - start % size + size, limit);
+    if (start >= end || end - start < granularity)
+    {
+        return region;
+    }
+
+    region.size = std::min(maxSize, (end - start) / granularity * granularity);
+    region.offset = start % size;
+    region.buffer = buffer;
+    region.mapped = static_cast<char *>(memory.mapped) + region.offset;
+    head = start + region.size;
+    return region;
+}
+
+bool StagingRing::acquire(VkDeviceSize size, VkDeviceSize alignment, StagingRegion &region)
+{
+    assert(size <= this->size);
+    for (;;)
+    {
+        region = acquireChunk(size, size, alignment);
+        if (region.size == size)
+        {
+            return true;
+        }
+        if (!retire(true))
+        {
+            return false;
+        }
+    }
+}
+
+void StagingRing::release(SubmitToken token)
+{
+    submissions.push_back({head, token});
+}
+
+bool StagingRing::copyBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size)
+{
+    const char *src = static_cast<const char *>(data);
+    return writeBuffer(dst, dstOffset, size, 1, [src](void *mapped, VkDeviceSize offset, VkDeviceSize size) {
+        memcpy(mapped, src + offset, size);
+    });
+}
+
+bool StagingRing::writeBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, VkDeviceSize granularity,
+                              const std::function<void(void *mapped, VkDeviceSize offset, VkDeviceSize size)> &fill)
+{
+    assert(size % granularity == 0 && granularity <= this->size);
+    VkDeviceSize written = 0;
+    while (written < size)
+    {
+        StagingRegion region = acquireChunk(granularity, size - written, copyOffsetAlignment);
+        if (region.size == 0)
+        {
+            // Ring is full, wait for older submissions or push out our own copies
+            if (!makeRoom())
+            {
+                return false;
+            }
+            continue;
+        }
+
+        fill(region.mapped, written, region.size);
+        VkBufferCopy copyRegion = {};
+        copyRegion.srcOffset = region.offset;
+        copyRegion.dstOffset = dstOffset + written;
+        copyRegion.size = region.size;
+        vkCmdCopyBuffer(getCommandBuffer(), buffer, dst, 1, &copyRegion);
+
+        written += region.size;
+    }
+    return true;
+}
+
+bool StagingRing::copyImage(VkImage dst, uint32_t width, uint32_t height, uint32_t texelSize, const void *data, uint32_t mipLevel, uint32_t blockExtent)
+{
+    const char *src = static_cast<const char *>(data);
+    VkDeviceSize rowSize = (VkDeviceSize)((width + blockExtent - 1) / blockExtent) * texelSize;
+    return writeRows(dst, width, height, texelSize, mipLevel, blockExtent, [src, rowSize](uint32_t firstRow, uint32_t rowCount, void *mapped) {
+        memcpy(mapped, src + firstRow * rowSize, rowCount * rowSize);
+    });
+}
+
+bool StagingRing::writeRows(VkImage dst, uint32_t width, uint32_t height, uint32_t texelSize, uint32_t mipLevel, uint32_t blockExtent,
+                            const std::function<void(uint32_t firstRow, uint32_t rowCount, void *mapped)> &fill)
+{
+    // Rows of texel blocks, which are single texels for uncompressed formats
+    uint32_t blockRows = (height + blockExtent - 1) / blockExtent;
+    VkDeviceSize rowSize = (VkDeviceSize)((width + blockExtent - 1) / blockExtent) * texelSize;
+    assert(rowSize <= size);
+
+    // Copy whole rows so every chunk is a rectangle of the image, chunks start on multiples of the row granularity
+    // of the queue and only the last one may be shorter than that. Compressed formats count the granularity in blocks
+    uint32_t granularRows = imageRowGranularity == 0 ? blockRows : std::min(imageRowGranularity, blockRows);
+    assert(rowSize * granularRows <= size);
+    VkDeviceSize alignment = leastCommonMultiple(copyOffsetAlignment, texelSize);
+    uint32_t row = 0;
+    while (row < blockRows)
+    {
+        VkDeviceSize granularity = rowSize * std::min(granularRows, blockRows - row);
+        StagingRegion region = acquireChunk(granularity, (blockRows - row) * rowSize, alignment);
+        if (region.size == 0)
+        {
+            if (!makeRoom())
+            {
+                return false;
+            }
+            continue;
+        }
+
+        uint32_t rowCount = static_cast<uint32_t>(region.size / rowSize);
+        fill(row, rowCount, region.mapped);
+        VkBufferImageCopy copyRegion = {};
+        copyRegion.bufferOffset = region.offset;
+        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copyRegion.imageSubresource.mipLevel = mipLevel;
+        copyRegion.imageSubresource.baseArrayLayer = 0;
+        copyRegion.imageSubresource.layerCount = 1;
+        copyRegion.imageOffset = {0, static_cast<int32_t>(row * blockExtent), 0};
+        copyRegion.imageExtent = {width, std::min(rowCount * blockExtent, height - row * blockExtent), 1};
+        vkCmdCopyBufferToImage(getCommandBuffer(), buffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+        row += rowCount;
+    }
+    return true;
+}
+
+bool StagingRing::writeImage(VkImage dst, VkDeviceSize size, uint32_t texelSize, const std::vector<VkBufferImageCopy> &regions,
+                             const std::function<void(uint32_t region, uint32_t firstRow, uint32_t rowCount, void *mapped)> &fill,
+                             uint32_t blockExtent)
+{
+    // An empty ring always has one contiguous half free, anything bigger might never fit in one piece
+    if (size > this->size / 2)
+    {
+        for (uint32_t i = 0; i < regions.size(); i++)
+        {
+            const VkBufferImageCopy &region = regions[i];
+            if (!writeRows(dst, region.imageExtent.width, region.imageExtent.height, texelSize, region.imageSubresource.mipLevel, blockExtent,
+                           [&fill, i](uint32_t firstRow, uint32_t rowCount, void *mapped) { fill(i, firstRow, rowCount, mapped); }))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    VkDeviceSize alignment = leastCommonMultiple(copyOffsetAlignment, texelSize);
+    StagingRegion region = acquireChunk(size, size, alignment);
+    while (region.size == 0)
+    {
+        if (!makeRoom())
+        {
+            return false;
+        }
+        region = acquireChunk(size, size, alignment);
+    }
+
+    std::vector<VkBufferImageCopy> copyRegions(regions);
+    for (uint32_t i = 0; i < copyRegions.size(); i++)
+    {
+        uint32_t blockRows = (copyRegions[i].imageExtent.height + blockExtent - 1) / blockExtent;
+        fill(i, 0, blockRows, static_cast<char *>(region.mapped) + copyRegions[i].bufferOffset);
+        copyRegions[i].bufferOffset += region.offset;
+    }
+    vkCmdCopyBufferToImage(getCommandBuffer(), buffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+    return true;
+}
+
+SubmitToken StagingRing::flush(VkSemaphore signalSemaphore)
+{
+    if (cmdBuffer == VK_NULL_HANDLE)
+    {
+        if (signalSemaphore == VK_NULL_HANDLE)
+        {
+            return submitContext->lastSubmitted();
+        }
+        // Still needs a submission to signal the semaphore
+        getCommandBuffer();
+    }
+
+    // Make the copied data visible to whatever reads it in later submissions
+    VkMemoryBarrier memoryBarrier = myvk::initializers::memoryBarrier();
+    memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier, 0, nullptr, 0, nullptr);
+
+    SubmitToken token = submitContext->submit(cmdBuffer, VK_NULL_HANDLE, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, signalSemaphore);
+    submissions.push_back({head, token});
+    cmdBuffer = VK_NULL_HANDLE;
+    return token;
+}
+
+void StagingRing::finish()
+{
+    flush();
+    while (retire(true))
+    {
+    }
+}
+} // namespace myvk
@@ -0,0 +1,109 @@
+/*
+* Staging ring buffer
+*
+* One persistently mapped host visible buffer carries all upload traffic, regions are handed out in
+* submission order and reclaimed once the submission that consumed them has finished
+*/
+
+#ifndef STAGING_HPP
+#define STAGING_HPP
+
+#include <vulkan/vulkan.h>
+#include "tools.hpp"
+#include "allocator.hpp"
+#include "submit.hpp"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+// Default size of the staging ring, bigger uploads are streamed through it in chunks
+#define DEFAULT_STAGING_RING_SIZE (32ull * 1024 * 1024)
+
+namespace myvk
+{
+struct StagingRegion
+{
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Host pointer to the start of the region
+    void *mapped = nullptr;
+};
+
+class StagingRing
+{
+  public:
+    /** @brief Copies are recorded into command buffers of submitContext and submitted to its queue */
+    void create(VkPhysicalDevice physicalDevice, VkDevice device, Allocator &allocator, SubmitContext &submitContext, VkDeviceSize size = DEFAULT_STAGING_RING_SIZE);
+    void destroy();
+
+    /** @brief Carve an aligned region out of the ring, waits for in-flight submissions to retire if the ring is full
+     *  @return false if the ring is filled by regions that have not been released yet */
+    bool acquire(VkDeviceSize size, VkDeviceSize alignment, StagingRegion &region);
+    /** @brief Hand every region acquired since the last release to a submission, they are reclaimed once it has finished */
+    void release(SubmitToken token);
+
+    /** @brief Record a copy of host data into a buffer, streaming it in chunks if it is bigger than the ring
+     *  @return false if the ring is full of regions that were acquired and never released, the same goes for the writes below */
+    bool copyBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size);
+    /** @brief Like copyBuffer, but fill(mapped, offset, size) writes each chunk straight into the ring
+     *  @param granularity Chunks hold whole multiples of it, e.g. the vertex stride, size has to be one too */
+    bool writeBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, VkDeviceSize granularity,
+                     const std::function<void(void *mapped, VkDeviceSize offset, VkDeviceSize size)> &fill);
+    /** @brief Record a copy of tightly packed texels into a mip level of a 2D color image in TRANSFER_DST_OPTIMAL layout
+     *  @param blockExtent 4 for block compressed formats, texelSize is then the size of a block */
+    bool copyImage(VkImage dst, uint32_t width, uint32_t height, uint32_t texelSize, const void *data, uint32_t mipLevel = 0, uint32_t blockExtent = 1);
+    /** @brief fill(region, firstRow, rowCount, mapped) writes tightly packed rows of texel blocks of regions[region] straight into the ring
+     *  @param size Bytes of all regions, whose bufferOffset is counted from the start of the data, e.g. every level of a mip chain
+     *  @note Up to half the ring, every region is filled whole and all of them go to the image with a single copy command.
+     *        Bigger data is streamed in bands of rows like copyImage. Either way the regions, and the rows of each, are filled in order */
+    bool writeImage(VkImage dst, VkDeviceSize size, uint32_t texelSize, const std::vector<VkBufferImageCopy> &regions,
+                    const std::function<void(uint32_t region, uint32_t firstRow, uint32_t rowCount, void *mapped)> &fill, uint32_t blockExtent = 1);
+    /** @brief Command buffer the next copies are recorded into, begun on demand */
+    VkCommandBuffer getCommandBuffer();
+
+    /** @brief Submit the recorded copies
+     *  @param signalSemaphore Semaphore signaled for another queue once this and every earlier copy has finished
+     *  @return Token that completes with the submission, or the last submitted one if nothing was recorded */
+    SubmitToken flush(VkSemaphore signalSemaphore = VK_NULL_HANDLE);
+    /** @brief Submit the recorded copies and wait until every submission has finished */
+    void finish();
+
+    SubmitContext &getSubmitContext() const { return *submitContext; }
+
+  private:
+    struct Submission
+    {
+        // Ring position after the last region consumed by the submission
+        VkDeviceSize end;
+        SubmitToken token;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    Allocator *allocator = nullptr;
+    SubmitContext *submitContext = nullptr;
+    VkBuffer buffer = VK_NULL_HANDLE;
+    Allocation memory;
+    VkDeviceSize size = 0;
+    VkDeviceSize copyOffsetAlignment = 4;
+    // Image copies on the queue have to start at multiples of this many rows, 0 means whole images only
+    uint32_t imageRowGranularity = 1;
+
+    // Monotonic byte counters, the ring position is the counter modulo size
+    VkDeviceSize head = 0;
+    VkDeviceSize tail = 0;
+    std::deque<Submission> submissions;
+    // Command buffer recording copies that have not been submitted yet
+    VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+
+    bool retire(bool wait);
+    bool makeRoom();
+    // Stream a mip level of an image through the ring in bands of whole rows of blocks that fill writes
+    bool writeRows(VkImage dst, uint32_t width, uint32_t height, uint32_t texelSize, uint32_t mipLevel, uint32_t blockExtent,
+                   const std::function<void(uint32_t firstRow, uint32_t rowCount, void *mapped)> &fill);
+    StagingRegion acquireChunk(VkDeviceSize granularity, VkDeviceSize maxSize, VkDeviceSize alignment);
+};
+} // namespace myvk
+
+#endif
@@ -0,0 +1,194 @@
+/*
+* Submission context
+*/
+
+#include "submit.hpp"
+
+#include <algorithm>
+
+namespace myvk
+{
+void SubmitContext::create(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex)
+{
+    this->device = device;
+    this->queue = queue;
+    this->queueFamilyIndex = queueFamilyIndex;
+    slots.reserve(MAX_SUBMIT_SLOTS);
+}
+
+void SubmitContext::destroy()
+{
+    waitIdle();
+    for (auto &slot : slots)
+    {
+        vkDestroyFence(device, slot.fence, nullptr);
+        if (slot.waitSemaphore != VK_NULL_HANDLE)
+        {
+            vkDestroySemaphore(device, slot.waitSemaphore, nullptr);
+        }
+        vkDestroyCommandPool(device, slot.commandPool, nullptr);
+    }
+    slots.clear();
+}
+
+void SubmitContext::retire(Slot &slot)
+{
+    slot.state = SLOT_FREE;
+    completedToken = std::max(completedToken, slot.token);
+}
+
+// Retire every slot whose fence has signaled
+void SubmitContext::update()
+{
+    for (auto &slot : slots)
+    {
+        if (slot.state == SLOT_PENDING && vkGetFenceStatus(device, slot.fence) == VK_SUCCESS)
+        {
+            retire(slot);
+        }
+    }
+    // Submissions complete in order, so anything older than a finished one is finished too
+    for (auto &slot : slots)
+    {
+        if (slot.state == SLOT_PENDING && slot.token <= completedToken)
+        {
+            retire(slot);
+        }
+    }
+}
+
+VkCommandBuffer SubmitContext::begin()
+{
+    update();
+
+    Slot *slot = nullptr;
+    for (auto &candidate : slots)
+    {
+        if (candidate.state == SLOT_FREE)
+        {
+            slot = &candidate;
+            break;
+        }
+    }
+
+    if (slot == nullptr && slots.size() < MAX_SUBMIT_SLOTS)
+    {
+        Slot newSlot = {};
+        VkCommandPoolCreateInfo cmdPoolInfo = myvk::initializers::commandPoolCreateInfo();
+        cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
+        cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &newSlot.commandPool));
+        VkCommandBufferAllocateInfo cmdBufAllocateInfo = myvk::initializers::commandBufferAllocateInfo(newSlot.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &newSlot.cmdBuffer));
+        VkFenceCreateInfo fenceInfo = myvk::initializers::fenceCreateInfo();
+        VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &newSlot.fence));
+        slots.push_back(newSlot);
+        slot = &slots.back();
+    }
+
+    if (slot == nullptr)
+    {
+        // Every slot is in flight, recycle the oldest one
+        for (auto &candidate : slots)
+        {
+            if (candidate.state == SLOT_PENDING && (slot == nullptr || candidate.token < slot->token))
+            {
+                slot = &candidate;
+            }
+        }
+        assert(slot != nullptr && "all submit slots are recording");
+        wait(slot->token);
+    }
+
+    VK_CHECK_RESULT(vkResetCommandPool(device, slot->commandPool, 0));
+    VK_CHECK_RESULT(vkResetFences(device, 1, &slot->fence));
+    slot->state = SLOT_RECORDING;
+
+    VkCommandBufferBeginInfo cmdBufInfo = myvk::initializers::commandBufferBeginInfo();
+    cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK_RESULT(vkBeginCommandBuffer(slot->cmdBuffer, &cmdBufInfo));
+    return slot->cmdBuffer;
+}
+
+SubmitContext::Slot &SubmitContext::findRecordingSlot(VkCommandBuffer cmdBuffer)
+{
+    auto slot = std::find_if(slots.begin(), slots.end(), [cmdBuffer](const Slot &s) { return s.cmdBuffer == cmdBuffer; });
+    assert(slot != slots.end() && slot->state == SLOT_RECORDING);
+    return *slot;
+}
+
+VkSemaphore SubmitContext::getWaitSemaphore(VkCommandBuffer cmdBuffer)
+{
+    Slot &slot = findRecordingSlot(cmdBuffer);
+    // The previous wait on it has executed once the slot's fence signaled, so it is unsignaled again
+    if (slot.waitSemaphore == VK_NULL_HANDLE)
+    {
+        VkSemaphoreCreateInfo semaphoreInfo = myvk::initializers::semaphoreCreateInfo();
+        VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &slot.waitSemaphore));
+    }
+    return slot.waitSemaphore;
+}
+
+SubmitToken SubmitContext::submit(VkCommandBuffer cmdBuffer, VkSemaphore waitSemaphore, VkPipelineStageFlags waitStageMask, VkSemaphore signalSemaphore)
+{
+    Slot &slot = findRecordingSlot(cmdBuffer);
+
+    VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffer));
+    VkSubmitInfo submitInfo = myvk::initializers::submitInfo();
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmdBuffer;
+    if (waitSemaphore != VK_NULL_HANDLE)
+    {
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &waitSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStageMask;
+    }
+    if (signalSemaphore != VK_NULL_HANDLE)
+    {
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &signalSemaphore;
+    }
+    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, slot.fence));
+
+    slot.token = ++submittedToken;
+    slot.state = SLOT_PENDING;
+    return slot.token;
+}
+
+bool SubmitContext::isComplete(SubmitToken token)
+{
+    if (token <= completedToken)
+    {
+        return true;
+    }
+    update();
+    return token <= completedToken;
+}
+
+void SubmitContext::wait(SubmitToken token)
+{
+    assert(token <= submittedToken);
+    if (token <= completedToken)
+    {
+        return;
+    }
+    for (auto &slot : slots)
+    {
+        if (slot.state == SLOT_PENDING && slot.token == token)
+        {
+            VK_CHECK_RESULT(vkWaitForFences(device, 1, &slot.fence, VK_TRUE, DEFAULT_FENCE_TIMEOUT));
+            retire(slot);
+            break;
+        }
+    }
+    update();
+}
+
+void SubmitContext::waitIdle()
+{
+    if (submittedToken > 0)
+    {
+        wait(submittedToken);
+    }
+}
+} // namespace myvk
@@ -0,0 +1,81 @@
+/*
+* Submission context
+*
+* Recycles primary command buffers and fences for one queue, every slot has its own command pool
+* that is reset as a whole once the fence of its last submission has signaled
+*/
+
+#ifndef SUBMIT_HPP
+#define SUBMIT_HPP
+
+#include <vulkan/vulkan.h>
+#include "tools.hpp"
+
+#include <vector>
+
+// Slots are created on demand up to this count, after that begin waits for the oldest submission
+#define MAX_SUBMIT_SLOTS 8
+
+namespace myvk
+{
+// Serial number of a submission, submissions on one queue complete in order
+typedef uint64_t SubmitToken;
+
+class SubmitContext
+{
+  public:
+    void create(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex);
+    /** @brief Waits for every submission before destroying the pools and fences */
+    void destroy();
+
+    /** @brief Get a reset primary command buffer in the recording state */
+    VkCommandBuffer begin();
+    /** @brief End and submit a command buffer returned by begin without waiting for it
+     *  @param waitSemaphore Semaphore signaled by another queue that has to be waited on at waitStageMask
+     *  @param signalSemaphore Semaphore to signal for another queue once the submission has finished */
+    SubmitToken submit(VkCommandBuffer cmdBuffer, VkSemaphore waitSemaphore = VK_NULL_HANDLE, VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VkSemaphore signalSemaphore = VK_NULL_HANDLE);
+    /** @brief Semaphore owned by the slot of a recording command buffer, meant to be signaled by another queue and
+     *  waited on by this submission, it can't be reused before the slot is recycled */
+    VkSemaphore getWaitSemaphore(VkCommandBuffer cmdBuffer);
+    bool isComplete(SubmitToken token);
+    /** @brief Block until the submission of the token has finished */
+    void wait(SubmitToken token);
+    void waitIdle();
+
+    VkQueue getQueue() const { return queue; }
+    uint32_t getQueueFamilyIndex() const { return queueFamilyIndex; }
+    /** @brief Token of the most recent submission */
+    SubmitToken lastSubmitted() const { return submittedToken; }
+
+  private:
+    enum SlotState
+    {
+        SLOT_FREE = 0,
+        SLOT_RECORDING,
+        SLOT_PENDING,
+    };
+    struct Slot
+    {
+        VkCommandPool commandPool;
+        VkCommandBuffer cmdBuffer;
+        VkFence fence;
+        // Created on first use by getWaitSemaphore
+        VkSemaphore waitSemaphore;
+        SubmitToken token;
+        SlotState state;
+    };
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    uint32_t queueFamilyIndex = 0;
+    std::vector<Slot> slots;
+    SubmitToken submittedToken = 0;
+    SubmitToken completedToken = 0;
+
+    void retire(Slot &slot);
+    Slot &findRecordingSlot(VkCommandBuffer cmdBuffer);
+    void update();
+};
+} // namespace myvk
+
+#endif
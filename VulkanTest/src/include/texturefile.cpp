@@ -0,0 +1,192 @@
+/*
+* Texture files
+*/
+
+#include "texturefile.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace myvk
+{
+TextureFile::~TextureFile()
+{
+    close();
+}
+
+// Only the formats texconv writes are accepted, with the texel or block size the copies assume for them
+static bool checkFormat(const TextureFileHeader &header)
+{
+    switch (header.format)
+    {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+        return header.texelSize == 4 && header.blockExtent == 1;
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        return header.texelSize == 8 && header.blockExtent == 4;
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+        return header.texelSize == 16 && header.blockExtent == 4;
+    default:
+        return false;
+    }
+}
+
+// Levels have to lie inside the file, in order, and be exactly as big as their size and format ask for
+static bool checkHeader(const TextureFileHeader &header, size_t fileSize)
+{
+    if (header.magic != TEXTURE_FILE_MAGIC || header.version != TEXTURE_FILE_VERSION)
+    {
+        printf("Not a texture file or unsupported version\n");
+        return false;
+    }
+    if (header.width == 0 || header.height == 0 || header.width > TEXTURE_FILE_MAX_EXTENT || header.height > TEXTURE_FILE_MAX_EXTENT ||
+        header.levelCount == 0 || header.levelCount > mipmap::getLevelCount(header.width, header.height) || !checkFormat(header))
+    {
+        printf("Texture file header is invalid\n");
+        return false;
+    }
+    uint64_t end = sizeof(header);
+    for (uint32_t level = 0; level < header.levelCount; level++)
+    {
+        // The extent is capped above, so the size can't overflow
+        uint64_t width = std::max(header.width >> level, 1u);
+        uint64_t height = std::max(header.height >> level, 1u);
+        uint64_t size = (width + header.blockExtent - 1) / header.blockExtent * ((height + header.blockExtent - 1) / header.blockExtent) * header.texelSize;
+        uint64_t offset = header.levelOffsets[level];
+        // Copies need buffer offsets aligned to 4 bytes and to the texel size
+        bool aligned = offset % 4 == 0 && (offset - header.levelOffsets[0]) % header.texelSize == 0;
+        if (header.levelSizes[level] != size || offset < end || offset > fileSize || size > fileSize - offset || !aligned)
+        {
+            printf("Texture file level %u does not match its header\n", level);
+            return false;
+        }
+        end = offset + size;
+    }
+    return true;
+}
+
+bool TextureFile::open(const char *fileName)
+{
+    close();
+    int fd = ::open(fileName, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("Could not open texture %s\n", fileName);
+        return false;
+    }
+    struct stat fileStat;
+    void *map = MAP_FAILED;
+    size_t size = 0;
+    if (fstat(fd, &fileStat) == 0 && static_cast<size_t>(fileStat.st_size) >= sizeof(header))
+    {
+        size = static_cast<size_t>(fileStat.st_size);
+        map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        printf("Could not map texture %s\n", fileName);
+        return false;
+    }
+
+    memcpy(&header, map, sizeof(header));
+    if (!checkHeader(header, size))
+    {
+        munmap(map, size);
+        header = {};
+        printf("Could not load texture %s\n", fileName);
+        return false;
+    }
+    // The levels are read once, front to back, by the copy into staging memory, start reading them ahead now
+    madvise(map, size, MADV_SEQUENTIAL);
+    madvise(map, size, MADV_WILLNEED);
+    mapped = map;
+    mappedSize = size;
+    return true;
+}
+
+void TextureFile::close()
+{
+    if (mapped != nullptr)
+    {
+        munmap(mapped, mappedSize);
+    }
+    mapped = nullptr;
+    mappedSize = 0;
+    header = {};
+}
+
+size_t TextureFile::getDataSize() const
+{
+    uint32_t last = header.levelCount - 1;
+    return static_cast<size_t>(header.levelOffsets[last] + header.levelSizes[last] - header.levelOffsets[0]);
+}
+
+std::vector<VkBufferImageCopy> TextureFile::getCopyRegions(VkDeviceSize bufferOffset) const
+{
+    std::vector<VkBufferImageCopy> regions(header.levelCount);
+    for (uint32_t level = 0; level < header.levelCount; level++)
+    {
+        VkBufferImageCopy &region = regions[level];
+        region = {};
+        region.bufferOffset = bufferOffset + header.levelOffsets[level] - header.levelOffsets[0];
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {std::max(header.width >> level, 1u), std::max(header.height >> level, 1u), 1};
+    }
+    return regions;
+}
+
+bool TextureFile::save(const char *fileName, VkFormat format, uint32_t texelSize, uint32_t blockExtent,
+                       const mipmap::MipChainLayout &layout, const void *data)
+{
+    if (layout.levels.empty() || layout.levels.size() > TEXTURE_FILE_MAX_LEVELS)
+    {
+        printf("Texture has no or too many levels for a texture file\n");
+        return false;
+    }
+    TextureFileHeader header = {};
+    header.magic = TEXTURE_FILE_MAGIC;
+    header.version = TEXTURE_FILE_VERSION;
+    header.format = static_cast<uint32_t>(format);
+    header.width = layout.levels[0].width;
+    header.height = layout.levels[0].height;
+    header.levelCount = static_cast<uint32_t>(layout.levels.size());
+    header.texelSize = texelSize;
+    header.blockExtent = blockExtent;
+    // The layout is kept as is behind the header, so the levels of data are written with one call
+    size_t dataOffset = (sizeof(header) + MIP_LEVEL_ALIGNMENT - 1) / MIP_LEVEL_ALIGNMENT * MIP_LEVEL_ALIGNMENT;
+    for (uint32_t level = 0; level < header.levelCount; level++)
+    {
+        header.levelOffsets[level] = dataOffset + layout.levels[level].offset - layout.levels[0].offset;
+        header.levelSizes[level] = layout.levels[level].size;
+    }
+
+    FILE *file = fopen(fileName, "wb");
+    if (file == nullptr)
+    {
+        printf("Could not write texture %s\n", fileName);
+        return false;
+    }
+    std::vector<char> padding(header.levelOffsets[0] - sizeof(header), 0);
+    const char *levels = static_cast<const char *>(data) + layout.levels[0].offset;
+    size_t levelsSize = layout.size - layout.levels[0].offset;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(padding.data(), 1, padding.size(), file) == padding.size() &&
+                   fwrite(levels, 1, levelsSize, file) == levelsSize;
+    written = fclose(file) == 0 && written;
+    if (!written)
+    {
+        printf("Could not write texture %s\n", fileName);
+    }
+    return written;
+}
+} // namespace myvk
@@ -0,0 +1,83 @@
+/*
+* Texture files
+*
+* A .mtex file holds a texture ready for the GPU: a header with the Vulkan format, the size and the
+* offset of every mip level, followed by the levels exactly as they are copied to the image, either
+* as plain texels or as compressed blocks. Levels start on MIP_LEVEL_ALIGNMENT boundaries of the
+* file, so a mapping of it can be copied into staging memory as is with no decode step
+*/
+
+#ifndef TEXTUREFILE_HPP
+#define TEXTUREFILE_HPP
+
+#include <vulkan/vulkan.h>
+#include "mipmap.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// "MVTX" in a little endian file
+#define TEXTURE_FILE_MAGIC 0x5854564du
+#define TEXTURE_FILE_VERSION 1
+#define TEXTURE_FILE_MAX_LEVELS 16
+// Largest width or height, which has TEXTURE_FILE_MAX_LEVELS levels
+#define TEXTURE_FILE_MAX_EXTENT 32768u
+
+namespace myvk
+{
+struct TextureFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    // VkFormat of the image
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    // Bytes per texel, or per block of blockExtent x blockExtent texels for compressed formats
+    uint32_t texelSize;
+    uint32_t blockExtent;
+    // Counted from the start of the file
+    uint64_t levelOffsets[TEXTURE_FILE_MAX_LEVELS];
+    uint64_t levelSizes[TEXTURE_FILE_MAX_LEVELS];
+};
+
+class TextureFile
+{
+  public:
+    TextureFile() = default;
+    ~TextureFile();
+    TextureFile(const TextureFile &) = delete;
+    TextureFile &operator=(const TextureFile &) = delete;
+
+    /** @brief Map a .mtex file and check its header, the levels are read from the mapping until close
+     *  @return false if the file can't be mapped or is not a valid texture file */
+    bool open(const char *fileName);
+    void close();
+
+    /** @brief Write the levels of data, laid out by layout, e.g. from mipmap::buildChain or blockcompress::compressChain */
+    static bool save(const char *fileName, VkFormat format, uint32_t texelSize, uint32_t blockExtent,
+                     const mipmap::MipChainLayout &layout, const void *data);
+
+    VkFormat getFormat() const { return static_cast<VkFormat>(header.format); }
+    uint32_t getWidth() const { return header.width; }
+    uint32_t getHeight() const { return header.height; }
+    uint32_t getLevelCount() const { return header.levelCount; }
+    uint32_t getTexelSize() const { return header.texelSize; }
+    uint32_t getBlockExtent() const { return header.blockExtent; }
+
+    /** @brief All levels from the start of level 0 to the end of the last one, with the padding in between */
+    const void *getData() const { return static_cast<const char *>(mapped) + header.levelOffsets[0]; }
+    size_t getDataSize() const;
+    /** @brief Copies of every level from a buffer holding getData() at bufferOffset */
+    std::vector<VkBufferImageCopy> getCopyRegions(VkDeviceSize bufferOffset = 0) const;
+
+  private:
+    void *mapped = nullptr;
+    size_t mappedSize = 0;
+    TextureFileHeader header = {};
+};
+} // namespace myvk
+
+#endif
@@ -0,0 +1,103 @@
+/*
+* Thread pool
+*/
+
+#include "threadpool.hpp"
+
+namespace myvk
+{
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::runIterations(Loop &loop)
+{
+    for (uint32_t i = loop.next.fetch_add(1); i < loop.count; i = loop.next.fetch_add(1))
+    {
+        (*loop.func)(i);
+    }
+}
+
+void ThreadPool::workerLoop()
+{
+    uint64_t seenGeneration = 0;
+    for (;;)
+    {
+        std::shared_ptr<Loop> current;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stop || generation != seenGeneration; });
+            if (stop)
+            {
+                return;
+            }
+            seenGeneration = generation;
+            if (!loop)
+            {
+                continue;
+            }
+            current = loop;
+            busyWorkers++;
+        }
+        runIterations(*current);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busyWorkers--;
+        }
+        done.notify_one();
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t count, const std::function<void(uint32_t)> &func)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (workers.empty() || count == 1)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            func(i);
+        }
+        return;
+    }
+
+    std::shared_ptr<Loop> current = std::make_shared<Loop>();
+    current->func = &func;
+    current->count = count;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        loop = current;
+        generation++;
+    }
+    wake.notify_all();
+    runIterations(*current);
+
+    // Every iteration has been taken, wait for the workers still running one
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return busyWorkers == 0; });
+    loop.reset();
+}
+} // namespace myvk
@@ -0,0 +1,60 @@
+/*
+* Thread pool
+*
+* A fixed set of worker threads that run the iterations of a parallel loop, the calling thread
+* takes part in the loop as well
+*/
+
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace myvk
+{
+class ThreadPool
+{
+  public:
+    /** @param threadCount Threads working on a loop including the caller, 0 uses every hardware thread */
+    explicit ThreadPool(uint32_t threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /** @brief Call func(i) for every i in [0, count) and return once all calls have finished
+     *  @note Iterations run in any order, loops must not be started from inside func */
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)> &func);
+
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+  private:
+    struct Loop
+    {
+        const std::function<void(uint32_t)> *func;
+        uint32_t count;
+        std::atomic<uint32_t> next{0};
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stop = false;
+
+    // Current loop, workers keep a reference so one that wakes up late can't take iterations of the next loop
+    std::shared_ptr<Loop> loop;
+    uint32_t busyWorkers = 0;
+    uint64_t generation = 0;
+
+    void workerLoop();
+    static void runIterations(Loop &loop);
+};
+} // namespace myvk
+
+#endif
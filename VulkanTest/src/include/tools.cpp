@@ -10,6 +10,9 @@
 
 #include "tools.hpp"
 
+#include <cerrno>
+#include <cstdint>
+
 namespace myvk
 {
 namespace tools
@@ -359,6 +362,127 @@ VkShaderModule loadShaderGLSL(const char *fileName, VkDevice device, VkShaderSta
     return shaderModule;
 }
 
+bool deviceExtensionSupported(VkPhysicalDevice physicalDevice, const char *extensionName)
+{
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data());
+    for (auto &extension : extensions)
+    {
+        if (strcmp(extension.extensionName, extensionName) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t getTransferQueueFamilyIndex(const std::vector<VkQueueFamilyProperties> &queueFamilyProperties, uint32_t graphicsQueueFamilyIndex)
+{
+    // Compute queues can always do transfers even if the family doesn't report it
+    for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++)
+    {
+        VkQueueFlags flags = queueFamilyProperties[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+        {
+            return i;
+        }
+    }
+    for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++)
+    {
+        VkQueueFlags flags = queueFamilyProperties[i].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+        {
+            return i;
+        }
+    }
+    return graphicsQueueFamilyIndex;
+}
+
+bool savePPM(const char *filename, const void *data, uint32_t width, uint32_t height, VkDeviceSize rowPitch, bool colorSwizzle)
+{
+    std::ofstream file(filename, std::ios::out | std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Could not open file \"" << filename << "\"" << std::endl;
+        return false;
+    }
+
+    // ppm header
+    file << "P6\n"
+         << width << "\n"
+         << height << "\n"
+         << 255 << "\n";
+
+    // Convert a whole row at a time instead of writing every texel on its own
+    std::vector<char> line(width * 3);
+    const char *row = static_cast<const char *>(data);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            const char *texel = row + x * 4;
+            line[x * 3 + 0] = colorSwizzle ? texel[2] : texel[0];
+            line[x * 3 + 1] = texel[1];
+            line[x * 3 + 2] = colorSwizzle ? texel[0] : texel[2];
+        }
+        file.write(line.data(), line.size());
+        row += rowPitch;
+    }
+    return file.good();
+}
+
+bool hasArgument(int argc, char **argv, const char *name)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], name) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t getArgument(int argc, char **argv, const char *name, uint32_t defaultValue)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], name) == 0)
+        {
+            // Only plain unsigned decimal numbers count, strtoul alone would also take "-1", "12abc" or nothing at all
+            const char *value = argv[i + 1];
+            char *end = nullptr;
+            errno = 0;
+            unsigned long number = value[0] >= '0' && value[0] <= '9' ? strtoul(value, &end, 10) : 0;
+            if (end == nullptr || *end != '\0' || errno == ERANGE || number > UINT32_MAX)
+            {
+                printf("%s expects a number, not \"%s\", using %u\n", name, value, defaultValue);
+                return defaultValue;
+            }
+            return static_cast<uint32_t>(number);
+        }
+    }
+    if (argc > 1 && strcmp(argv[argc - 1], name) == 0)
+    {
+        printf("%s expects a number, using %u\n", name, defaultValue);
+    }
+    return defaultValue;
+}
+
+const char *getArgument(int argc, char **argv, const char *name, const char *defaultValue)
+{
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], name) == 0)
+        {
+            return argv[i + 1];
+        }
+    }
+    return defaultValue;
+}
+
 bool fileExists(const std::string &filename)
 {
     std::ifstream f(filename.c_str());
@@ -103,6 +103,23 @@ VkShaderModule loadShader(const char *fileName, VkDevice device);
 // Note: GLSL support requires vendor-specific extensions to be enabled and is not a core-feature of Vulkan
 VkShaderModule loadShaderGLSL(const char *fileName, VkDevice device, VkShaderStageFlagBits stage);
 
+/** @brief Checks if the physical device supports a device extension */
+bool deviceExtensionSupported(VkPhysicalDevice physicalDevice, const char *extensionName);
+
+/** @brief Find a queue family for asynchronous transfers, transfer only families first and then compute ones without graphics
+ *  @return graphicsQueueFamilyIndex if the device has no such family */
+uint32_t getTransferQueueFamilyIndex(const std::vector<VkQueueFamilyProperties> &queueFamilyProperties, uint32_t graphicsQueueFamilyIndex);
+
+/** @brief Write rows of 4 byte texels to a binary ppm file, alpha is dropped and red and blue are swapped if colorSwizzle is set */
+bool savePPM(const char *filename, const void *data, uint32_t width, uint32_t height, VkDeviceSize rowPitch, bool colorSwizzle);
+
+/** @brief Checks if a command line flag like "--verify" was given */
+bool hasArgument(int argc, char **argv, const char *name);
+/** @brief Value following a command line option like "--frames 100", defaultValue if it is missing or not a number */
+uint32_t getArgument(int argc, char **argv, const char *name, uint32_t defaultValue);
+/** @brief String following a command line option like "--mesh bunny.obj", defaultValue if it is missing */
+const char *getArgument(int argc, char **argv, const char *name, const char *defaultValue);
+
 /** @brief Checks if a file exists */
 bool fileExists(const std::string &filename);
 } // namespace tools
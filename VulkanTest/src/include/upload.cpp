@@ -0,0 +1,194 @@
+/*
+* Batched uploads
+*/
+
+#include "upload.hpp"
+
+namespace myvk
+{
+static VkImageMemoryBarrier imageBarrier(VkImage image, uint32_t mipLevels, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkImageLayout oldLayout, VkImageLayout newLayout)
+{
+    VkImageMemoryBarrier barrier = myvk::initializers::imageMemoryBarrier();
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1};
+    return barrier;
+}
+
+void UploadBatch::addBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size)
+{
+    buffers.push_back({dst, dstOffset, data, size, 1, nullptr});
+}
+
+void UploadBatch::addBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, VkDeviceSize granularity,
+                            std::function<void(void *mapped, VkDeviceSize offset, VkDeviceSize size)> fill)
+{
+    buffers.push_back({dst, dstOffset, nullptr, size, granularity, std::move(fill)});
+}
+
+void UploadBatch::addImage(VkImage dst, uint32_t width, uint32_t height, uint32_t texelSize, const void *data, VkImageLayout finalLayout)
+{
+    images.push_back({dst, width, height, texelSize, data, finalLayout, 1, {}, 0, nullptr, 1});
+}
+
+void UploadBatch::addImage(VkImage dst, uint32_t mipLevels, uint32_t texelSize, std::vector<VkBufferImageCopy> regions, const void *data,
+                           VkImageLayout finalLayout, uint32_t blockExtent)
+{
+    images.push_back({dst, 0, 0, texelSize, data, finalLayout, mipLevels, std::move(regions), 0, nullptr, blockExtent});
+}
+
+void UploadBatch::addImage(VkImage dst, uint32_t mipLevels, uint32_t texelSize, VkDeviceSize size, std::vector<VkBufferImageCopy> regions,
+                           std::function<void(uint32_t region, uint32_t firstRow, uint32_t rowCount, void *mapped)> fill, VkImageLayout finalLayout,
+                           uint32_t blockExtent)
+{
+    images.push_back({dst, 0, 0, texelSize, nullptr, finalLayout, mipLevels, std::move(regions), size, std::move(fill), blockExtent});
+}
+
+static VkBufferMemoryBarrier bufferBarrier(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask)
+{
+    VkBufferMemoryBarrier barrier = myvk::initializers::bufferMemoryBarrier();
+    barrier.srcAccessMask = srcAccessMask;
+    barrier.dstAccessMask = dstAccessMask;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    return barrier;
+}
+
+SubmitToken UploadBatch::submit()
+{
+    uint32_t srcQueueFamilyIndex = stagingRing.getSubmitContext().getQueueFamilyIndex();
+    uint32_t dstQueueFamilyIndex = dstContext.getQueueFamilyIndex();
+    bool handOff = &stagingRing.getSubmitContext() != &dstContext;
+    bool ownershipTransfer = srcQueueFamilyIndex != dstQueueFamilyIndex;
+
+    std::vector<VkImageMemoryBarrier> barriers;
+    barriers.reserve(images.size());
+
+    // Move every image into a copy destination layout with one barrier
+    if (!images.empty())
+    {
+        for (auto &image : images)
+        {
+            barriers.push_back(imageBarrier(image.dst, image.mipLevels, 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+        }
+        vkCmdPipelineBarrier(stagingRing.getCommandBuffer(),
+                             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr,
+                             0, nullptr,
+                             static_cast<uint32_t>(barriers.size()), barriers.data());
+    }
+
+    // The ring only splits the batch into more submissions when it runs out of room. If it can't make room the
+    // remaining copies are skipped, the barriers below still leave every resource in its final state
+    bool copied = true;
+    for (auto &buffer : buffers)
+    {
+        if (copied && buffer.fill)
+        {
+            copied = stagingRing.writeBuffer(buffer.dst, buffer.dstOffset, buffer.size, buffer.granularity, buffer.fill);
+        }
+        else if (copied)
+        {
+            copied = stagingRing.copyBuffer(buffer.dst, buffer.dstOffset, buffer.data, buffer.size);
+        }
+    }
+    for (auto &image : images)
+    {
+        if (copied && image.fill)
+        {
+            copied = stagingRing.writeImage(image.dst, image.size, image.texelSize, image.regions, image.fill, image.blockExtent);
+        }
+        else if (copied && !image.regions.empty())
+        {
+            const char *data = static_cast<const char *>(image.data);
+            for (size_t i = 0; i < image.regions.size() && copied; i++)
+            {
+                const VkBufferImageCopy &region = image.regions[i];
+                copied = stagingRing.copyImage(image.dst, region.imageExtent.width, region.imageExtent.height, image.texelSize,
+                                               data + region.bufferOffset, region.imageSubresource.mipLevel, image.blockExtent);
+            }
+        }
+        else if (copied)
+        {
+            copied = stagingRing.copyImage(image.dst, image.width, image.height, image.texelSize, image.data);
+        }
+    }
+    if (!copied)
+    {
+        printf("Upload batch is incomplete, %zu buffers and %zu images were not all copied\n", buffers.size(), images.size());
+    }
+
+    // And into their final layouts with another one
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    if (ownershipTransfer)
+    {
+        // Release everything to the destination family, the layout change happens with the acquire
+        barriers.clear();
+        for (auto &buffer : buffers)
+        {
+            bufferBarriers.push_back(bufferBarrier(buffer.dst, buffer.dstOffset, buffer.size, VK_ACCESS_TRANSFER_WRITE_BIT, 0));
+            bufferBarriers.back().srcQueueFamilyIndex = srcQueueFamilyIndex;
+            bufferBarriers.back().dstQueueFamilyIndex = dstQueueFamilyIndex;
+        }
+        for (auto &image : images)
+        {
+            barriers.push_back(imageBarrier(image.dst, image.mipLevels, VK_ACCESS_TRANSFER_WRITE_BIT, 0, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, image.finalLayout));
+            barriers.back().srcQueueFamilyIndex = srcQueueFamilyIndex;
+            barriers.back().dstQueueFamilyIndex = dstQueueFamilyIndex;
+        }
+        vkCmdPipelineBarrier(stagingRing.getCommandBuffer(),
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                             0, nullptr,
+                             static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+                             static_cast<uint32_t>(barriers.size()), barriers.data());
+    }
+    else if (!images.empty())
+    {
+        barriers.clear();
+        for (auto &image : images)
+        {
+            barriers.push_back(imageBarrier(image.dst, image.mipLevels, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_MEMORY_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, image.finalLayout));
+        }
+        vkCmdPipelineBarrier(stagingRing.getCommandBuffer(),
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                             0, nullptr,
+                             0, nullptr,
+                             static_cast<uint32_t>(barriers.size()), barriers.data());
+    }
+
+    buffers.clear();
+    images.clear();
+    if (!handOff)
+    {
+        return stagingRing.flush();
+    }
+
+    // The destination queue waits for the copies on a semaphore and acquires what was released to it
+    VkCommandBuffer cmdBuffer = dstContext.begin();
+    VkSemaphore semaphore = dstContext.getWaitSemaphore(cmdBuffer);
+    stagingRing.flush(semaphore);
+    if (ownershipTransfer)
+    {
+        for (auto &barrier : bufferBarriers)
+        {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        }
+        for (auto &barrier : barriers)
+        {
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        }
+        vkCmdPipelineBarrier(cmdBuffer,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                             0, nullptr,
+                             static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+                             static_cast<uint32_t>(barriers.size()), barriers.data());
+    }
+    return dstContext.submit(cmdBuffer, semaphore, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+}
+} // namespace myvk
@@ -0,0 +1,87 @@
+/*
+* Batched uploads
+*
+* Any number of buffer and image uploads are recorded into one command buffer with a single barrier
+* before and after all copies, and submitted once without waiting for the queue
+*
+* When the staging ring feeds another queue than the one using the resources, the batch ends with a
+* semaphore hand-off and, across queue families, a release and acquire of every uploaded resource
+*/
+
+#ifndef UPLOAD_HPP
+#define UPLOAD_HPP
+
+#include <vulkan/vulkan.h>
+#include "tools.hpp"
+#include "staging.hpp"
+
+#include <functional>
+#include <vector>
+
+namespace myvk
+{
+class UploadBatch
+{
+  public:
+    explicit UploadBatch(StagingRing &stagingRing) : stagingRing(stagingRing), dstContext(stagingRing.getSubmitContext()) {}
+    /** @param dstContext Context of the queue the uploaded resources are used on */
+    UploadBatch(StagingRing &stagingRing, SubmitContext &dstContext) : stagingRing(stagingRing), dstContext(dstContext) {}
+
+    /** @brief Queue a copy of host data into a buffer, data must stay valid until submit */
+    void addBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data, VkDeviceSize size);
+    /** @brief Queue an upload that fill writes straight into staging memory, see StagingRing::writeBuffer */
+    void addBuffer(VkBuffer dst, VkDeviceSize dstOffset, VkDeviceSize size, VkDeviceSize granularity,
+                   std::function<void(void *mapped, VkDeviceSize offset, VkDeviceSize size)> fill);
+    /** @brief Queue a copy of tightly packed texels into mip 0 of a 2D color image, data must stay valid until submit
+     *  @note The previous content of the image is discarded, it ends up in finalLayout */
+    void addImage(VkImage dst, uint32_t width, uint32_t height, uint32_t texelSize, const void *data, VkImageLayout finalLayout);
+    /** @brief Queue a copy of every region of data, e.g. the levels of a mapped file, data must stay valid until submit
+     *  @note The regions are streamed one by one with StagingRing::copyImage, data is never copied as a whole */
+    void addImage(VkImage dst, uint32_t mipLevels, uint32_t texelSize, std::vector<VkBufferImageCopy> regions, const void *data,
+                  VkImageLayout finalLayout, uint32_t blockExtent = 1);
+    /** @brief Queue an upload of the first mipLevels levels that fill writes straight into staging memory, see StagingRing::writeImage */
+    void addImage(VkImage dst, uint32_t mipLevels, uint32_t texelSize, VkDeviceSize size, std::vector<VkBufferImageCopy> regions,
+                  std::function<void(uint32_t region, uint32_t firstRow, uint32_t rowCount, void *mapped)> fill, VkImageLayout finalLayout,
+                  uint32_t blockExtent = 1);
+
+    /** @brief Record and submit every queued upload, usually as a single submission
+     *  @return Token of dstContext that completes once the resources are usable on its queue, the batch is empty afterwards */
+    SubmitToken submit();
+    bool empty() const { return buffers.empty() && images.empty(); }
+
+  private:
+    struct BufferUpload
+    {
+        VkBuffer dst;
+        VkDeviceSize dstOffset;
+        const void *data;
+        VkDeviceSize size;
+        VkDeviceSize granularity;
+        // Used instead of data when set
+        std::function<void(void *, VkDeviceSize, VkDeviceSize)> fill;
+    };
+    struct ImageUpload
+    {
+        VkImage dst;
+        uint32_t width;
+        uint32_t height;
+        uint32_t texelSize;
+        const void *data;
+        VkImageLayout finalLayout;
+        uint32_t mipLevels;
+        // Copies of data, or of what fill writes, when set
+        std::vector<VkBufferImageCopy> regions;
+        // Used instead of data when set
+        VkDeviceSize size;
+        std::function<void(uint32_t, uint32_t, uint32_t, void *)> fill;
+        uint32_t blockExtent;
+    };
+
+    StagingRing &stagingRing;
+    SubmitContext &dstContext;
+    std::vector<BufferUpload> buffers;
+    std::vector<ImageUpload> images;
+};
+} // namespace myvk
+
+#endif
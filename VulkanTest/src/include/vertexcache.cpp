@@ -0,0 +1,241 @@
+/*
+* Vertex cache optimization
+*/
+
+#include "vertexcache.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+namespace myvk
+{
+namespace vertexcache
+{
+CacheStats analyze(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize)
+{
+    // A vertex is in the FIFO while fewer than cacheSize misses happened since it was loaded
+    std::vector<uint32_t> loadedAt(vertexCount, 0);
+    std::vector<bool> used(vertexCount, false);
+    uint32_t misses = 0;
+    uint32_t usedCount = 0;
+    for (uint32_t index : indices)
+    {
+        if (!used[index] || misses - loadedAt[index] >= cacheSize)
+        {
+            usedCount += used[index] ? 0 : 1;
+            used[index] = true;
+            loadedAt[index] = misses++;
+        }
+    }
+    CacheStats stats;
+    stats.acmr = indices.empty() ? 0.0f : misses / (indices.size() / 3.0f);
+    stats.atvr = usedCount == 0 ? 0.0f : static_cast<float>(misses) / usedCount;
+    return stats;
+}
+
+// Tipsify, Sander, Nehab and Barczak 2007. Triangles are emitted as fans around one vertex at a time,
+// the next fan is the neighbour that stays in the cache longest while still having triangles left
+void optimizeCache(std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize, std::vector<uint32_t> *clusters)
+{
+    assert(indices.size() % 3 == 0);
+    const uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+
+    // Triangles of every vertex, and how many of them are not emitted yet
+    std::vector<uint32_t> live(vertexCount, 0);
+    for (uint32_t index : indices)
+    {
+        live[index]++;
+    }
+    std::vector<uint32_t> adjacencyOffsets(static_cast<size_t>(vertexCount) + 1, 0);
+    for (uint32_t v = 0; v < vertexCount; v++)
+    {
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + live[v];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (uint32_t i = 0; i < indices.size(); i++)
+        {
+            adjacency[fill[indices[i]]++] = i / 3;
+        }
+    }
+
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    if (clusters != nullptr)
+    {
+        clusters->clear();
+    }
+
+    uint32_t timestamp = cacheSize + 1;
+    uint32_t cursor = 0;
+    uint32_t fan = triangleCount > 0 ? indices[0] : UINT32_MAX;
+    bool newCluster = true;
+    while (fan != UINT32_MAX)
+    {
+        if (newCluster && clusters != nullptr)
+        {
+            clusters->push_back(static_cast<uint32_t>(result.size()));
+        }
+
+        candidates.clear();
+        for (uint32_t a = adjacencyOffsets[fan]; a < adjacencyOffsets[fan + 1]; a++)
+        {
+            uint32_t triangle = adjacency[a];
+            if (emitted[triangle])
+            {
+                continue;
+            }
+            emitted[triangle] = true;
+            for (uint32_t j = 0; j < 3; j++)
+            {
+                uint32_t v = indices[triangle * 3 + j];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (timestamp - cacheTime[v] > cacheSize)
+                {
+                    cacheTime[v] = timestamp++;
+                }
+            }
+        }
+
+        // Prefer the candidate loaded longest ago that will still be cached after its own fan,
+        // live[v] triangles add at most 2 * live[v] new vertices
+        uint32_t next = UINT32_MAX;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates)
+        {
+            if (live[v] == 0)
+            {
+                continue;
+            }
+            int64_t priority = 0;
+            if (timestamp - cacheTime[v] + 2 * live[v] <= cacheSize)
+            {
+                priority = timestamp - cacheTime[v];
+            }
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+
+        // No neighbour left, go back to recently used vertices and then to the first unfinished one.
+        // The cache is cold after such a jump, so a new cluster starts there
+        newCluster = next == UINT32_MAX;
+        while (next == UINT32_MAX && !deadEnd.empty())
+        {
+            uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            next = live[v] > 0 ? v : UINT32_MAX;
+        }
+        while (next == UINT32_MAX && cursor < vertexCount)
+        {
+            next = live[cursor] > 0 ? cursor : UINT32_MAX;
+            cursor++;
+        }
+        fan = next;
+    }
+    indices.swap(result);
+}
+
+void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<uint32_t> &clusters, const void *positions, size_t positionStride)
+{
+    const unsigned char *base = static_cast<const unsigned char *>(positions);
+    auto position = [&](uint32_t index) { return reinterpret_cast<const float *>(base + index * positionStride); };
+
+    // Area weighted centroid of the mesh, and centroid and normal of every cluster
+    struct Cluster
+    {
+        uint32_t begin;
+        uint32_t end;
+        float centroid[3];
+        float normal[3];
+        float sortKey;
+    };
+    std::vector<Cluster> sorted(clusters.size());
+    double meshCentroid[3] = {};
+    double meshArea = 0.0;
+    for (size_t c = 0; c < clusters.size(); c++)
+    {
+        Cluster &cluster = sorted[c];
+        cluster.begin = clusters[c];
+        cluster.end = c + 1 < clusters.size() ? clusters[c + 1] : static_cast<uint32_t>(indices.size());
+        double centroid[3] = {};
+        double normal[3] = {};
+        double area = 0.0;
+        for (uint32_t i = cluster.begin; i < cluster.end; i += 3)
+        {
+            const float *p0 = position(indices[i]);
+            const float *p1 = position(indices[i + 1]);
+            const float *p2 = position(indices[i + 2]);
+            double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            double triangleArea = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int j = 0; j < 3; j++)
+            {
+                centroid[j] += (p0[j] + p1[j] + p2[j]) / 3.0 * triangleArea;
+                normal[j] += n[j];
+            }
+            area += triangleArea;
+        }
+        for (int j = 0; j < 3; j++)
+        {
+            meshCentroid[j] += centroid[j];
+            cluster.centroid[j] = static_cast<float>(area > 0.0 ? centroid[j] / area : 0.0);
+            cluster.normal[j] = static_cast<float>(normal[j]);
+        }
+        meshArea += area;
+    }
+    for (int j = 0; j < 3; j++)
+    {
+        meshCentroid[j] = meshArea > 0.0 ? meshCentroid[j] / meshArea : 0.0;
+    }
+
+    // Clusters far out along their normal occlude more than they are occluded
+    for (Cluster &cluster : sorted)
+    {
+        double key = 0.0;
+        for (int j = 0; j < 3; j++)
+        {
+            key += (cluster.centroid[j] - meshCentroid[j]) * cluster.normal[j];
+        }
+        cluster.sortKey = static_cast<float>(key);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster &a, const Cluster &b) { return a.sortKey > b.sortKey; });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+    for (const Cluster &cluster : sorted)
+    {
+        result.insert(result.end(), indices.begin() + cluster.begin, indices.begin() + cluster.end);
+    }
+    indices.swap(result);
+}
+
+uint32_t optimizeFetch(std::vector<uint32_t> &indices, std::vector<uint32_t> &remap, uint32_t vertexCount)
+{
+    remap.assign(vertexCount, UINT32_MAX);
+    uint32_t next = 0;
+    for (uint32_t &index : indices)
+    {
+        if (remap[index] == UINT32_MAX)
+        {
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+    return next;
+}
+} // namespace vertexcache
+} // namespace myvk
@@ -0,0 +1,69 @@
+/*
+* Vertex cache optimization
+*
+* Triangle lists are reordered for the post-transform vertex cache with Tipsify, which runs in linear
+* time and also splits the order into clusters. The clusters can then be sorted so the outside of a
+* mesh tends to be drawn first, which gives early depth tests more to reject. Vertices are finally
+* renumbered in the order the triangles first use them, so vertex fetches walk the buffer forward
+*/
+
+#ifndef VERTEXCACHE_HPP
+#define VERTEXCACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// FIFO entries assumed by the optimizer and the statistics, in the range of current hardware
+#define VERTEX_CACHE_SIZE 16
+
+namespace myvk
+{
+namespace vertexcache
+{
+struct CacheStats
+{
+    // Vertex shader invocations per triangle, 0.5 at best for large regular meshes and 3 at worst
+    float acmr;
+    // Vertex shader invocations per referenced vertex, 1 at best
+    float atvr;
+};
+
+/** @brief Simulate a FIFO post-transform cache of cacheSize entries over a triangle list */
+CacheStats analyze(const std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+/** @brief Reorder the triangles of a triangle list for a cache of cacheSize entries
+ *  @param clusters If set, receives the first index of every cluster in the new order, for optimizeOverdraw */
+void optimizeCache(std::vector<uint32_t> &indices, uint32_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE,
+                   std::vector<uint32_t> *clusters = nullptr);
+
+/** @brief Sort the clusters of optimizeCache so the ones facing away from the mesh center are drawn first
+ *  @param positions float3 positions, positionStride bytes apart */
+void optimizeOverdraw(std::vector<uint32_t> &indices, const std::vector<uint32_t> &clusters, const void *positions, size_t positionStride);
+
+/** @brief Renumber vertices in the order of their first use
+ *  @param remap Receives the new index of every old vertex, UINT32_MAX for vertices no triangle uses
+ *  @return Number of used vertices */
+uint32_t optimizeFetch(std::vector<uint32_t> &indices, std::vector<uint32_t> &remap, uint32_t vertexCount);
+
+/** @brief Move elements of count values each to their place in remap, dropping unused ones */
+template <typename T>
+void remapVertices(std::vector<T> &values, const std::vector<uint32_t> &remap, uint32_t usedCount, size_t count = 1)
+{
+    std::vector<T> remapped(static_cast<size_t>(usedCount) * count);
+    for (size_t i = 0; i < remap.size(); i++)
+    {
+        if (remap[i] != UINT32_MAX)
+        {
+            for (size_t j = 0; j < count; j++)
+            {
+                remapped[remap[i] * count + j] = values[i * count + j];
+            }
+        }
+    }
+    values.swap(remapped);
+}
+} // namespace vertexcache
+} // namespace myvk
+
+#endif
@@ -0,0 +1,202 @@
+/*
+* Packed vertex formats
+*/
+
+#include "vertexformat.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace myvk
+{
+namespace vertexformat
+{
+#if defined(__SSE2__)
+// Lanes x, y, z of an attribute, w is undefined. A full 16 byte load is only safe when another
+// vertex follows, the last one is gathered lane by lane
+static inline __m128 load3(const unsigned char *src, size_t i, size_t count)
+{
+    const float *p = reinterpret_cast<const float *>(src);
+    return i + 1 < count ? _mm_loadu_ps(p) : _mm_setr_ps(p[0], p[1], p[2], 0.0f);
+}
+
+// Lanes x, y of an attribute, z and w are 0
+static inline __m128 load2(const unsigned char *src)
+{
+    return _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double *>(src)));
+}
+#endif
+
+float maxAbsolute3(const void *src, size_t stride, size_t count)
+{
+    const unsigned char *in = static_cast<const unsigned char *>(src);
+#if defined(__SSE2__)
+    const __m128 xyzAbs = _mm_castsi128_ps(_mm_setr_epi32(0x7fffffff, 0x7fffffff, 0x7fffffff, 0));
+    __m128 maximum = _mm_setzero_ps();
+    for (size_t i = 0; i < count; i++, in += stride)
+    {
+        maximum = _mm_max_ps(maximum, _mm_and_ps(load3(in, i, count), xyzAbs));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, maximum);
+    return std::max(std::max(lanes[0], lanes[1]), lanes[2]);
+#else
+    float maximum = 0.0f;
+    for (size_t i = 0; i < count; i++, in += stride)
+    {
+        const float *p = reinterpret_cast<const float *>(in);
+        maximum = std::max(maximum, std::max(std::max(std::fabs(p[0]), std::fabs(p[1])), std::fabs(p[2])));
+    }
+    return maximum;
+#endif
+}
+
+void encodeSnorm16x4(const void *src, size_t srcStride, size_t count, float scale, void *dst, size_t dstStride)
+{
+    const unsigned char *in = static_cast<const unsigned char *>(src);
+    unsigned char *out = static_cast<unsigned char *>(dst);
+    const float factor = 32767.0f / (scale > 0.0f ? scale : 1.0f);
+#if defined(__SSE2__)
+    const __m128 mul = _mm_setr_ps(factor, factor, factor, 0.0f);
+    const __m128 w = _mm_setr_ps(0.0f, 0.0f, 0.0f, 32767.0f);
+    const __m128 lo = _mm_set1_ps(-32767.0f);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    for (size_t i = 0; i < count; i++, in += srcStride, out += dstStride)
+    {
+        // w is multiplied by 0 and then set to 1.0, a NaN in it would survive the multiply so mask it first
+        __m128 v = _mm_and_ps(load3(in, i, count), _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+        v = _mm_add_ps(_mm_mul_ps(v, mul), w);
+        v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+        __m128i q = _mm_cvtps_epi32(v);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out), _mm_packs_epi32(q, q));
+    }
+#else
+    for (size_t i = 0; i < count; i++, in += srcStride, out += dstStride)
+    {
+        const float *p = reinterpret_cast<const float *>(in);
+        int16_t q[4] = {0, 0, 0, 32767};
+        for (int j = 0; j < 3; j++)
+        {
+            q[j] = static_cast<int16_t>(std::nearbyint(std::min(std::max(p[j] * factor, -32767.0f), 32767.0f)));
+        }
+        memcpy(out, q, sizeof(q));
+    }
+#endif
+}
+
+void encodeUnorm8x4(const void *src, size_t srcStride, size_t count, void *dst, size_t dstStride)
+{
+    const unsigned char *in = static_cast<const unsigned char *>(src);
+    unsigned char *out = static_cast<unsigned char *>(dst);
+#if defined(__SSE2__)
+    const __m128 mul = _mm_setr_ps(255.0f, 255.0f, 255.0f, 0.0f);
+    const __m128 alpha = _mm_setr_ps(0.0f, 0.0f, 0.0f, 255.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (size_t i = 0; i < count; i++, in += srcStride, out += dstStride)
+    {
+        __m128 v = _mm_min_ps(_mm_max_ps(load3(in, i, count), _mm_setzero_ps()), one);
+        __m128i q = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(v, mul), alpha));
+        q = _mm_packs_epi32(q, q);
+        int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(q, q));
+        memcpy(out, &packed, sizeof(packed));
+    }
+#else
+    for (size_t i = 0; i < count; i++, in += srcStride, out += dstStride)
+    {
+        const float *p = reinterpret_cast<const float *>(in);
+        for (int j = 0; j < 3; j++)
+        {
+            out[j] = static_cast<uint8_t>(std::nearbyint(std::min(std::max(p[j], 0.0f), 1.0f) * 255.0f));
+        }
+        out[3] = 255;
+    }
+#endif
+}
+
+void encodeUnorm16x2(const void *src, size_t srcStride, size_t count, void *dst, size_t dstStride)
+{
+    const unsigned char *in = static_cast<const unsigned char *>(src);
+    unsigned char *out = static_cast<unsigned char *>(dst);
+#if defined(__SSE2__)
+    const __m128 mul = _mm_set1_ps(65535.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16(static_cast<int16_t>(0x8000));
+    for (size_t i = 0; i < count; i++, in += srcStride, out += dstStride)
+    {
+        __m128 v = _mm_min_ps(_mm_max_ps(load2(in), _mm_setzero_ps()), one);
+        // SSE2 only packs to signed 16 bits, so shift the range down and flip the sign bit back afterwards
+        __m128i q = _mm_sub_epi32(_mm_cvtps_epi32(_mm_mul_ps(v, mul)), bias);
+        q = _mm_xor_si128(_mm_packs_epi32(q, q), flip);
+        int32_t packed = _mm_cvtsi128_si32(q);
+        memcpy(out, &packed, sizeof(packed));
+    }
+#else
+    for (size_t i = 0; i < count; i++, in += srcStride, out += dstStride)
+    {
+        const float *p = reinterpret_cast<const float *>(in);
+        uint16_t q[2];
+        for (int j = 0; j < 2; j++)
+        {
+            q[j] = static_cast<uint16_t>(std::nearbyint(std::min(std::max(p[j], 0.0f), 1.0f) * 65535.0f));
+        }
+        memcpy(out, q, sizeof(q));
+    }
+#endif
+}
+
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    uint32_t magnitude = bits & 0x7fffffff;
+    if (magnitude >= 0x7f800000)
+    {
+        // Infinity stays infinity, NaN stays quiet NaN
+        return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+    }
+    if (magnitude >= 0x477ff000)
+    {
+        // 65520 and above round past the largest half
+        return sign | 0x7c00;
+    }
+    if (magnitude < 0x38800000)
+    {
+        // Below 2^-14 the result is subnormal, counted in steps of 2^-24
+        float absolute;
+        memcpy(&absolute, &magnitude, sizeof(absolute));
+        return sign | static_cast<uint16_t>(std::nearbyint(absolute * 16777216.0f));
+    }
+    // Rebias the exponent from 127 to 15 and round the 13 dropped mantissa bits to nearest even,
+    // a carry out of the mantissa correctly bumps the exponent
+    magnitude += 0xc8000fff + ((magnitude >> 13) & 1);
+    return sign | static_cast<uint16_t>(magnitude >> 13);
+}
+
+void encodeHalf2(const void *src, size_t srcStride, size_t count, void *dst, size_t dstStride)
+{
+    const unsigned char *in = static_cast<const unsigned char *>(src);
+    unsigned char *out = static_cast<unsigned char *>(dst);
+    for (size_t i = 0; i < count; i++, in += srcStride, out += dstStride)
+    {
+#if defined(__F16C__)
+        int32_t packed = _mm_cvtsi128_si32(_mm_cvtps_ph(load2(in), _MM_FROUND_TO_NEAREST_INT));
+        memcpy(out, &packed, sizeof(packed));
+#else
+        const float *p = reinterpret_cast<const float *>(in);
+        uint16_t q[2] = {floatToHalf(p[0]), floatToHalf(p[1])};
+        memcpy(out, q, sizeof(q));
+#endif
+    }
+}
+} // namespace vertexformat
+} // namespace myvk
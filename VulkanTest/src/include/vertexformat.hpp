@@ -0,0 +1,35 @@
+/*
+* Packed vertex formats
+*
+* Encoders from float vertex attributes into the normalized integer and half float formats the
+* vertex input stage expands back to floats, so the shaders read them unchanged
+*/
+
+#ifndef VERTEXFORMAT_HPP
+#define VERTEXFORMAT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace myvk
+{
+namespace vertexformat
+{
+/** @brief Largest absolute x, y or z of count float3 attributes, stride bytes apart
+ *  @note Positions encoded with encodeSnorm16 have to be scaled back by it, e.g. in the model matrix */
+float maxAbsolute3(const void *src, size_t stride, size_t count);
+
+/** @brief Encode float3 attributes as VK_FORMAT_R16G16B16A16_SNORM, divided by scale and with w = 1 */
+void encodeSnorm16x4(const void *src, size_t srcStride, size_t count, float scale, void *dst, size_t dstStride);
+/** @brief Encode float3 attributes in [0, 1] as VK_FORMAT_R8G8B8A8_UNORM with alpha = 1 */
+void encodeUnorm8x4(const void *src, size_t srcStride, size_t count, void *dst, size_t dstStride);
+/** @brief Encode float2 attributes in [0, 1] as VK_FORMAT_R16G16_UNORM */
+void encodeUnorm16x2(const void *src, size_t srcStride, size_t count, void *dst, size_t dstStride);
+/** @brief Encode float2 attributes as VK_FORMAT_R16G16_SFLOAT, rounded to nearest even */
+void encodeHalf2(const void *src, size_t srcStride, size_t count, void *dst, size_t dstStride);
+
+uint16_t floatToHalf(float value);
+} // namespace vertexformat
+} // namespace myvk
+
+#endif
@@ -0,0 +1,135 @@
+/*
+* Vertex layout reflection
+*
+* A vertex struct lists its attributes once, with MYVK_VERTEX_ATTRIBUTE taking offsets and sizes from
+* the struct itself, and the binding and attribute descriptions are generated from that list
+*
+* Every attribute is checked at compile time against the size of its format, and the whole layout
+* against overlapping attributes, duplicate locations and the size of the struct
+*/
+
+#ifndef VERTEXLAYOUT_HPP
+#define VERTEXLAYOUT_HPP
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace myvk
+{
+namespace vertexlayout
+{
+struct Attribute
+{
+    uint32_t location;
+    VkFormat format;
+    uint32_t offset;
+};
+
+/** @brief Bytes of one attribute of format, 0 for formats not used as vertex attributes here */
+constexpr uint32_t formatSize(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R32_SFLOAT:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SNORM:
+    case VK_FORMAT_R8G8B8A8_UINT:
+    case VK_FORMAT_R16G16_UNORM:
+    case VK_FORMAT_R16G16_SNORM:
+    case VK_FORMAT_R16G16_SFLOAT:
+        return 4;
+    case VK_FORMAT_R32G32_SFLOAT:
+    case VK_FORMAT_R16G16B16A16_UNORM:
+    case VK_FORMAT_R16G16B16A16_SNORM:
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+        return 8;
+    case VK_FORMAT_R32G32B32_SFLOAT:
+        return 12;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+/** @brief Specialized for every vertex struct with a static constexpr std::array<Attribute, N> attributes */
+template <typename V>
+struct Layout;
+
+/** @brief Attributes fit in V, don't overlap and use distinct locations */
+template <typename V>
+constexpr bool valid()
+{
+    const auto &attributes = Layout<V>::attributes;
+    for (size_t i = 0; i < attributes.size(); i++)
+    {
+        uint32_t end = attributes[i].offset + formatSize(attributes[i].format);
+        if (formatSize(attributes[i].format) == 0 || end > sizeof(V))
+        {
+            return false;
+        }
+        for (size_t j = 0; j < i; j++)
+        {
+            uint32_t otherEnd = attributes[j].offset + formatSize(attributes[j].format);
+            if (attributes[j].location == attributes[i].location ||
+                (attributes[i].offset < otherEnd && attributes[j].offset < end))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <typename V>
+constexpr VkVertexInputBindingDescription binding(uint32_t binding, VkVertexInputRate inputRate = VK_VERTEX_INPUT_RATE_VERTEX)
+{
+    static_assert(valid<V>(), "invalid vertex layout");
+    return {binding, static_cast<uint32_t>(sizeof(V)), inputRate};
+}
+
+template <typename V>
+constexpr std::array<VkVertexInputAttributeDescription, Layout<V>::attributes.size()> attributes(uint32_t binding)
+{
+    static_assert(valid<V>(), "invalid vertex layout");
+    std::array<VkVertexInputAttributeDescription, Layout<V>::attributes.size()> descriptions{};
+    for (size_t i = 0; i < descriptions.size(); i++)
+    {
+        descriptions[i] = {Layout<V>::attributes[i].location, binding, Layout<V>::attributes[i].format, Layout<V>::attributes[i].offset};
+    }
+    return descriptions;
+}
+
+/** @brief Append V as vertex buffer binding, several structs can be combined as separate streams */
+template <typename V>
+void addStream(std::vector<VkVertexInputBindingDescription> &bindings, std::vector<VkVertexInputAttributeDescription> &attributeDescriptions,
+               uint32_t bindingIndex, VkVertexInputRate inputRate = VK_VERTEX_INPUT_RATE_VERTEX)
+{
+    bindings.push_back(binding<V>(bindingIndex, inputRate));
+    for (const auto &description : attributes<V>(bindingIndex))
+    {
+        for (const auto &existing : attributeDescriptions)
+        {
+            assert(existing.location != description.location && "location used by two streams");
+        }
+        attributeDescriptions.push_back(description);
+    }
+}
+} // namespace vertexlayout
+} // namespace myvk
+
+// One attribute of a vertex struct, fails to compile if the member doesn't have the size of the format
+#define MYVK_VERTEX_ATTRIBUTE(Struct, member, location, format)                                                      \
+    ([]() constexpr {                                                                                                \
+        static_assert(myvk::vertexlayout::formatSize(format) != 0, #format " is not a known vertex format");         \
+        static_assert(myvk::vertexlayout::formatSize(format) == sizeof(Struct::member),                             \
+                      #Struct "::" #member " does not have the size of " #format);                                  \
+        static_assert(offsetof(Struct, member) % 4 == 0, #Struct "::" #member " is not aligned to 4 bytes");       \
+        return myvk::vertexlayout::Attribute{location, format, static_cast<uint32_t>(offsetof(Struct, member))}; \
+    }())
+
+#endif
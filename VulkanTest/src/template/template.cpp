@@ -20,24 +20,6 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugMessageCallback(
     return VK_FALSE;
 }
 
-uint32_t getMemoryTypeIndex(AppData &appData, uint32_t typeBits, VkMemoryPropertyFlags properties)
-{
-    VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
-    vkGetPhysicalDeviceMemoryProperties(appData.physicalDevice, &deviceMemoryProperties);
-    for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; i++)
-    {
-        if ((typeBits & 1) == 1)
-        {
-            if ((deviceMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
-            {
-                return i;
-            }
-        }
-        typeBits >>= 1;
-    }
-    return 0;
-}
-
 VkResult createBuffer(AppData &appData, BufferCreateInfo &bci)
 {
     // Create the buffer handle
@@ -45,39 +27,26 @@ VkResult createBuffer(AppData &appData, BufferCreateInfo &bci)
     bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     VK_CHECK_RESULT(vkCreateBuffer(appData.device, &bufferCreateInfo, nullptr, bci.buffer));
 
-    // Create the memory backing up the buffer handle
+    // Sub-allocate the memory backing up the buffer handle
     VkMemoryRequirements memReqs;
-    VkMemoryAllocateInfo memAlloc = myvk::initializers::memoryAllocateInfo();
     vkGetBufferMemoryRequirements(appData.device, *(bci.buffer), &memReqs);
-    memAlloc.allocationSize = memReqs.size;
-    memAlloc.memoryTypeIndex = getMemoryTypeIndex(appData, memReqs.memoryTypeBits, bci.memoryPropertyFlags);
-    VK_CHECK_RESULT(vkAllocateMemory(appData.device, &memAlloc, nullptr, bci.memory));
+    VK_CHECK_RESULT(appData.allocator.allocate(memReqs, bci.memoryUsage, myvk::ALLOCATION_TILING_LINEAR, *(bci.memory)));
 
+    // Host visible memory is persistently mapped by the allocator
     if (bci.data != nullptr)
     {
-        void *mapped;
-        VK_CHECK_RESULT(vkMapMemory(appData.device, *(bci.memory), 0, bci.size, 0, &mapped));
-        memcpy(mapped, bci.data, bci.size);
-        vkUnmapMemory(appData.device, *(bci.memory));
+        memcpy(bci.memory->mapped, bci.data, bci.size);
     }
 
-    VK_CHECK_RESULT(vkBindBufferMemory(appData.device, *(bci.buffer), *(bci.memory), 0));
+    VK_CHECK_RESULT(vkBindBufferMemory(appData.device, *(bci.buffer), bci.memory->memory, bci.memory->offset));
 
     return VK_SUCCESS;
 }
 
-// Submit command buffer to a queue and wait for fence until queue operations have been finished
-void submitWork(AppData &appData, VkCommandBuffer cmdBuffer, VkQueue queue)
+// Submit a command buffer from the submit context and wait until queue operations have been finished
+void submitWork(AppData &appData, VkCommandBuffer cmdBuffer)
 {
-    VkSubmitInfo submitInfo = myvk::initializers::submitInfo();
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmdBuffer;
-    VkFenceCreateInfo fenceInfo = myvk::initializers::fenceCreateInfo();
-    VkFence fence;
-    VK_CHECK_RESULT(vkCreateFence(appData.device, &fenceInfo, nullptr, &fence));
-    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-    VK_CHECK_RESULT(vkWaitForFences(appData.device, 1, &fence, VK_TRUE, UINT64_MAX));
-    vkDestroyFence(appData.device, fence, nullptr);
+    appData.submitContext.wait(appData.submitContext.submit(cmdBuffer));
 }
 
 void setInstance(AppData &appData)
@@ -86,7 +55,7 @@ void setInstance(AppData &appData)
     appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
     appInfo.pApplicationName = "example";
     appInfo.pEngineName = "did";
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    appInfo.apiVersion = VK_API_VERSION_1_1;
 
     // Vulkan instance creation (without surface extensions)
     VkInstanceCreateInfo instanceCreateInfo = {};
@@ -160,7 +129,7 @@ void setDevice(AppData &appData)
     vkGetPhysicalDeviceProperties(appData.physicalDevice, &deviceProperties);
     printf("GPU: %s\n", deviceProperties.deviceName);
 
-    // Request a single graphics queue
+    // Request a graphics queue and a transfer queue from another family if there is one
     const float defaultQueuePriority(0.0f);
     VkDeviceQueueCreateInfo queueCreateInfo = {};
     uint32_t queueFamilyCount;
@@ -179,102 +148,466 @@ void setDevice(AppData &appData)
             break;
         }
     }
+    std::vector<VkDeviceQueueCreateInfo> queueCreateInfos{queueCreateInfo};
+    appData.transferQueueFamilyIndex = myvk::tools::getTransferQueueFamilyIndex(queueFamilyProperties, appData.queueFamilyIndex);
+    if (appData.transferQueueFamilyIndex != appData.queueFamilyIndex)
+    {
+        queueCreateInfo.queueFamilyIndex = appData.transferQueueFamilyIndex;
+        queueCreateInfos.push_back(queueCreateInfo);
+    }
+    // Heap budgets are queried through vkGetPhysicalDeviceMemoryProperties2, core since 1.1
+    std::vector<const char *> deviceExtensions;
+    bool memoryBudget = deviceProperties.apiVersion >= VK_API_VERSION_1_1 &&
+                        myvk::tools::deviceExtensionSupported(appData.physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memoryBudget)
+    {
+        deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+
+    // Tessellation is optional, without it the template subdivides on the CPU
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(appData.physicalDevice, &supportedFeatures);
+    VkPhysicalDeviceFeatures enabledFeatures{};
+    if (appData.tessellation && !supportedFeatures.tessellationShader)
+    {
+        printf("Tessellation shaders are not supported, subdividing on the CPU\n");
+        appData.tessellation = false;
+    }
+    if (appData.tessellation && (!myvk::ShaderRegistry::isSpirv(ASSET_PATH "shaders/template/tessellation.vert.spv") ||
+                                 !myvk::ShaderRegistry::isSpirv(ASSET_PATH "shaders/template/tessellation.tesc.spv") ||
+                                 !myvk::ShaderRegistry::isSpirv(ASSET_PATH "shaders/template/tessellation.tese.spv") ||
+                                 !myvk::ShaderRegistry::isSpirv(ASSET_PATH "shaders/template/tessellation.frag.spv")))
+    {
+        printf("Tessellation shaders are not built, run make shaders. Subdividing on the CPU\n");
+        appData.tessellation = false;
+    }
+    enabledFeatures.tessellationShader = appData.tessellation ? VK_TRUE : VK_FALSE;
+
     // Create logical device
     VkDeviceCreateInfo deviceCreateInfo = {};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+    deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+    deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
     VK_CHECK_RESULT(vkCreateDevice(appData.physicalDevice, &deviceCreateInfo, nullptr, &(appData.device)));
 
     // Get a graphics queue
     vkGetDeviceQueue(appData.device, appData.queueFamilyIndex, 0, &(appData.queue));
 
-    // Command pool
-    VkCommandPoolCreateInfo cmdPoolInfo = {};
-    cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    cmdPoolInfo.queueFamilyIndex = appData.queueFamilyIndex;
-    cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    VK_CHECK_RESULT(vkCreateCommandPool(appData.device, &cmdPoolInfo, nullptr, &(appData.commandPool)));
+    // Recycled command buffers and fences for the graphics queue
+    appData.submitContext.create(appData.device, appData.queue, appData.queueFamilyIndex);
+    myvk::SubmitContext *uploadContext = &appData.submitContext;
+    if (appData.transferQueueFamilyIndex != appData.queueFamilyIndex)
+    {
+        vkGetDeviceQueue(appData.device, appData.transferQueueFamilyIndex, 0, &(appData.transferQueue));
+        appData.transferContext.create(appData.device, appData.transferQueue, appData.transferQueueFamilyIndex);
+        uploadContext = &appData.transferContext;
+        printf("Uploads on transfer queue family %u\n", appData.transferQueueFamilyIndex);
+    }
+    else
+    {
+        appData.transferQueue = appData.queue;
+    }
+
+    // Device memory allocator, every buffer and image is bound to memory from it
+    appData.allocator.create(appData.instance, appData.physicalDevice, appData.device, memoryBudget);
+
+    // All uploads go through one persistently mapped staging buffer, copied on the transfer queue
+    appData.stagingRing.create(appData.physicalDevice, appData.device, appData.allocator, *uploadContext);
+
+    // Shader modules are shared by every pipeline using the same SPIR-V
+    appData.shaderRegistry.create(appData.device);
+
+    // Reuse the pipelines compiled by earlier runs on this device, opened here since setVertex may build a compute pipeline
+    appData.pipelineCache.create(appData.physicalDevice, appData.device, "./out/template.pipelinecache");
+}
+
+// Seed triangles of the scene, three vertices each
+std::vector<Vertex> getSeedTriangles()
+{
+    return {
+        {{1.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}},
+        {{0.0f, 1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}},
+        {{0.0f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f}},
+
+        {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}},
+        {{0.0f, 1.0f, 0.0f}, {0.0f, 1.0f, 0.0f}},
+        {{-0.5f, 0.0f, -0.5f}, {0.0f, 1.0f, 0.0f}},
+
+        {{-0.5f, 0.0f, -0.5f}, {0.0f, 0.0f, 1.0f}},
+        {{0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+        {{0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 1.0f}},
+
+        {{1.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}},
+        {{-0.5f, 0.0f, -0.5f}, {1.0f, 1.0f, 1.0f}},
+        {{0.0f, 0.0f, 1.0f}, {1.0f, 1.0f, 1.0f}},
+    };
 }
 
 void setVertex(AppData &appData)
 {
+    if (appData.computeSubdivision && setVertexCompute(appData))
+    {
+        return;
+    }
+
     // build vertex position and color
+    std::vector<uint32_t> indices;
     {
-        int target = 4;
-
-        std::vector<Vertex> input1 = {
-            {{1.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}},
-            {{0.0f, 1.0f, 0.0f}, {1.0f, 0.0f, 0.0f}},
-            {{0.0f, 0.0f, 1.0f}, {1.0f, 0.0f, 0.0f}},
-        };
-        buildVertex(appData.vertices, input1, 0, target);
-
-        std::vector<Vertex> input2 = {
-            {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}},
-            {{0.0f, 1.0f, 0.0f}, {0.0f, 1.0f, 0.0f}},
-            {{-0.5f, 0.0f, -0.5f}, {0.0f, 1.0f, 0.0f}},
-        };
-        buildVertex(appData.vertices, input2, 0, target);
-
-        std::vector<Vertex> input3 = {
-            {{-0.5f, 0.0f, -0.5f}, {0.0f, 0.0f, 1.0f}},
-            {{0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
-            {{0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 1.0f}},
-        };
-        buildVertex(appData.vertices, input3, 0, target);
-
-        std::vector<Vertex> input4 = {
-            {{1.0f, 0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}},
-            {{-0.5f, 0.0f, -0.5f}, {1.0f, 1.0f, 1.0f}},
-            {{0.0f, 0.0f, 1.0f}, {1.0f, 1.0f, 1.0f}},
-        };
-        buildVertex(appData.vertices, input4, 0, target);
-    }
-
-    const VkDeviceSize vertexBufferSize = appData.vertices.size() * sizeof(Vertex);
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
-
-    // Command buffer for copy commands (reused)
-    VkCommandBufferAllocateInfo cmdBufAllocateInfo = myvk::initializers::commandBufferAllocateInfo(appData.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-    VkCommandBuffer copyCmd;
-    VK_CHECK_RESULT(vkAllocateCommandBuffers(appData.device, &cmdBufAllocateInfo, &copyCmd));
-    VkCommandBufferBeginInfo cmdBufInfo = myvk::initializers::commandBufferBeginInfo();
-
-    // Copy input data to VRAM using a staging buffer
-    {
-        BufferCreateInfo bcisrc{
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            &stagingBuffer,
-            &stagingMemory,
-            vertexBufferSize,
-            appData.vertices.data()};
-
-        // Vertices
-        createBuffer(appData, bcisrc);
-
-        BufferCreateInfo bcidest{
-            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-            &(appData.vertexBuffer),
-            &(appData.vertexMemory),
+        int target = appData.subdivisionLevel;
+
+        if (appData.tessellation)
+        {
+            // The tessellator does the subdivision, only the 12 seed vertices are uploaded
+            appData.vertices = getSeedTriangles();
+            appData.indexed = false;
+        }
+        else if (appData.lodObjects > 0)
+        {
+            buildLodLevels(appData, indices);
+        }
+        else if (appData.indexed)
+        {
+            buildIndexedVertices(appData.vertices, indices, getSeedTriangles(), target, appData.threadPool);
+            appData.indexCount = static_cast<uint32_t>(indices.size());
+            printf("Indexed mesh: %zu unique vertices for %u indices, the triangle soup takes %u vertices\n",
+                   appData.vertices.size(), appData.indexCount, appData.indexCount);
+            if (appData.optimizeVertexCache)
+            {
+                optimizeIndexedVertices(appData.vertices, indices);
+            }
+        }
+        else
+        {
+            buildVertices(appData.vertices, getSeedTriangles(), target, appData.threadPool);
+        }
+        appData.vertexCount = static_cast<uint32_t>(appData.vertices.size());
+    }
+
+    VkDeviceSize vertexBufferSize = appData.vertices.size() * sizeof(Vertex);
+    const void *vertexData = appData.vertices.data();
+
+    // Quantize into the packed layout, the scale goes back in through the model matrix
+    std::vector<PackedVertex> packedVertices;
+    if (appData.packedVertices)
+    {
+        packedVertices.resize(appData.vertices.size());
+        appData.positionScale = myvk::vertexformat::maxAbsolute3(appData.vertices[0].position, sizeof(Vertex), appData.vertices.size());
+        myvk::vertexformat::encodeSnorm16x4(appData.vertices[0].position, sizeof(Vertex), appData.vertices.size(), appData.positionScale,
+                                            packedVertices[0].position, sizeof(PackedVertex));
+        myvk::vertexformat::encodeUnorm8x4(appData.vertices[0].color, sizeof(Vertex), appData.vertices.size(),
+                                           packedVertices[0].color, sizeof(PackedVertex));
+        vertexBufferSize = packedVertices.size() * sizeof(PackedVertex);
+        vertexData = packedVertices.data();
+        printf("Packed vertices: %zu bytes instead of %zu\n", (size_t)vertexBufferSize, appData.vertices.size() * sizeof(Vertex));
+    }
+
+    BufferCreateInfo bcidest{
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        myvk::MEMORY_USAGE_GPU_ONLY,
+        &(appData.vertexBuffer),
+        &(appData.vertexMemory),
+        vertexBufferSize};
+    createBuffer(appData, bcidest);
+
+    // Copy input data to VRAM through the staging ring, the graphics queue waits for the copies on its own so no need to wait here
+    myvk::UploadBatch uploadBatch(appData.stagingRing, appData.submitContext);
+    uploadBatch.addBuffer(appData.vertexBuffer, 0, vertexData, vertexBufferSize);
+
+    if (appData.indexed)
+    {
+        // Halve the index buffer whenever every index fits in 16 bits
+        std::vector<uint16_t> shortIndices;
+        const void *indexData = indices.data();
+        VkDeviceSize indexBufferSize = indices.size() * sizeof(uint32_t);
+        appData.indexType = VK_INDEX_TYPE_UINT32;
+        // LOD levels are drawn with a vertex offset, so only the largest level has to fit
+        size_t indexRange = appData.lodLevels.empty() ? appData.vertices.size() : 0;
+        for (size_t level = 0; level < appData.lodLevels.size(); level++)
+        {
+            size_t levelEnd = level + 1 < appData.lodLevels.size() ? appData.lodLevels[level + 1].vertexOffset : appData.vertices.size();
+            indexRange = std::max(indexRange, levelEnd - appData.lodLevels[level].vertexOffset);
+        }
+        if (indexRange <= UINT16_MAX)
+        {
+            shortIndices.assign(indices.begin(), indices.end());
+            indexData = shortIndices.data();
+            indexBufferSize = shortIndices.size() * sizeof(uint16_t);
+            appData.indexType = VK_INDEX_TYPE_UINT16;
+        }
+
+        BufferCreateInfo bciindex{
+            VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            myvk::MEMORY_USAGE_GPU_ONLY,
+            &(appData.indexBuffer),
+            &(appData.indexMemory),
+            indexBufferSize};
+        createBuffer(appData, bciindex);
+        uploadBatch.addBuffer(appData.indexBuffer, 0, indexData, indexBufferSize);
+    }
+    uploadBatch.submit();
+}
+
+// Every level from 0 to subdivisionLevel goes into the same buffers, drawLodObjects picks a range per object
+void buildLodLevels(AppData &appData, std::vector<uint32_t> &indices)
+{
+    std::vector<Vertex> seeds = getSeedTriangles();
+    appData.vertices.clear();
+    indices.clear();
+    appData.lodLevels.clear();
+    for (int level = 0; level <= appData.subdivisionLevel; level++)
+    {
+        LodLevel lod;
+        lod.vertexOffset = static_cast<int32_t>(appData.vertices.size());
+        std::vector<Vertex> levelVertices;
+        if (appData.indexed)
+        {
+            std::vector<uint32_t> levelIndices;
+            buildIndexedVertices(levelVertices, levelIndices, seeds, level, appData.threadPool);
+            if (appData.optimizeVertexCache)
+            {
+                optimizeIndexedVertices(levelVertices, levelIndices);
+            }
+            lod.first = static_cast<uint32_t>(indices.size());
+            lod.count = static_cast<uint32_t>(levelIndices.size());
+            indices.insert(indices.end(), levelIndices.begin(), levelIndices.end());
+        }
+        else
+        {
+            buildVertices(levelVertices, seeds, level, appData.threadPool);
+            lod.first = static_cast<uint32_t>(appData.vertices.size());
+            lod.count = static_cast<uint32_t>(levelVertices.size());
+            lod.vertexOffset = 0;
+        }
+        appData.vertices.insert(appData.vertices.end(), levelVertices.begin(), levelVertices.end());
+        appData.lodLevels.push_back(lod);
+        printf("LOD level %d: %u triangles\n", level, lod.count / 3);
+    }
+    appData.indexCount = static_cast<uint32_t>(indices.size());
+
+    // Subdivision stays inside the seeds, so their bounding sphere bounds every level
+    glm::vec3 boundsMin(seeds[0].position[0], seeds[0].position[1], seeds[0].position[2]);
+    glm::vec3 boundsMax = boundsMin;
+    for (const Vertex &seed : seeds)
+    {
+        glm::vec3 p(seed.position[0], seed.position[1], seed.position[2]);
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+    appData.lodCenter = (boundsMin + boundsMax) * 0.5f;
+    appData.lodRadius = glm::length(boundsMax - boundsMin) * 0.5f;
+    appData.lodCurrent.assign(appData.lodObjects, -1);
+    appData.lodLevelDraws.assign(appData.lodLevels.size(), 0);
+}
+
+// Reorder triangles for the vertex cache and overdraw and vertices for fetch locality, same mesh afterwards
+void optimizeIndexedVertices(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+    uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+    myvk::vertexcache::CacheStats before = myvk::vertexcache::analyze(indices, vertexCount);
+    auto tStart = std::chrono::high_resolution_clock::now();
+
+    std::vector<uint32_t> clusters;
+    myvk::vertexcache::optimizeCache(indices, vertexCount, VERTEX_CACHE_SIZE, &clusters);
+    myvk::vertexcache::optimizeOverdraw(indices, clusters, vertices[0].position, sizeof(Vertex));
+    std::vector<uint32_t> remap;
+    uint32_t usedCount = myvk::vertexcache::optimizeFetch(indices, remap, vertexCount);
+    myvk::vertexcache::remapVertices(vertices, remap, usedCount);
+
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    myvk::vertexcache::CacheStats after = myvk::vertexcache::analyze(indices, usedCount);
+    printf("Vertex cache (%u entries): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %zu clusters, %.3f ms\n", VERTEX_CACHE_SIZE,
+           before.acmr, after.acmr, before.atvr, after.atvr, clusters.size(), std::chrono::duration<double, std::milli>(tEnd - tStart).count());
+}
+
+// Subdivide on the GPU straight into the vertex buffer, false if subdivide.comp is not available
+bool setVertexCompute(AppData &appData)
+{
+    VkShaderModule shaderModule = appData.shaderRegistry.acquire(ASSET_PATH "shaders/template/subdivide.comp.spv");
+    if (shaderModule == VK_NULL_HANDLE)
+    {
+        printf("Compute subdivision is not available, subdividing on the CPU\n");
+        appData.verifyFailed = appData.verifyCompute;
+        return false;
+    }
+
+    std::vector<Vertex> seeds = getSeedTriangles();
+    struct
+    {
+        uint32_t leafCount;
+        uint32_t triangleCount;
+    } pushConsts;
+    pushConsts.leafCount = static_cast<uint32_t>(subdividedVertexCount(appData.subdivisionLevel) / 3);
+    pushConsts.triangleCount = static_cast<uint32_t>(seeds.size() / 3) * pushConsts.leafCount;
+    appData.indexed = false;
+    appData.vertexCount = pushConsts.triangleCount * 3;
+    const VkDeviceSize seedBufferSize = seeds.size() * sizeof(Vertex);
+    const VkDeviceSize vertexBufferSize = appData.vertexCount * sizeof(Vertex);
+
+    // The seeds are small enough to be written by the command buffer itself, no staging needed
+    VkBuffer seedBuffer;
+    myvk::Allocation seedMemory;
+    BufferCreateInfo bciseed{
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        myvk::MEMORY_USAGE_GPU_ONLY,
+        &seedBuffer,
+        &seedMemory,
+        seedBufferSize};
+    createBuffer(appData, bciseed);
+
+    BufferCreateInfo bcidest{
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        myvk::MEMORY_USAGE_GPU_ONLY,
+        &(appData.vertexBuffer),
+        &(appData.vertexMemory),
+        vertexBufferSize};
+    createBuffer(appData, bcidest);
+
+    // Host copy of the output, only to check it against the CPU
+    VkBuffer verifyBuffer = VK_NULL_HANDLE;
+    myvk::Allocation verifyMemory;
+    if (appData.verifyCompute)
+    {
+        BufferCreateInfo bciverify{
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            myvk::MEMORY_USAGE_READBACK,
+            &verifyBuffer,
+            &verifyMemory,
             vertexBufferSize};
-        createBuffer(appData, bcidest);
+        createBuffer(appData, bciverify);
+    }
+
+    // Seeds and output as two storage buffers, depth and size as push constants
+    std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+        myvk::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+        myvk::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 1)};
+    VkDescriptorSetLayoutCreateInfo descriptorLayout =
+        myvk::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+    VkDescriptorSetLayout descriptorSetLayout;
+    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(appData.device, &descriptorLayout, nullptr, &descriptorSetLayout));
 
-        VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
-        VkBufferCopy copyRegion = {};
-        copyRegion.size = vertexBufferSize;
-        vkCmdCopyBuffer(copyCmd, stagingBuffer, appData.vertexBuffer, 1, &copyRegion);
-        VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
+        myvk::initializers::pipelineLayoutCreateInfo(&descriptorSetLayout, 1);
+    VkPushConstantRange pushConstantRange = myvk::initializers::pushConstantRange(VK_SHADER_STAGE_COMPUTE_BIT, sizeof(pushConsts), 0);
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+    VkPipelineLayout pipelineLayout;
+    VK_CHECK_RESULT(vkCreatePipelineLayout(appData.device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout));
+
+    std::vector<VkDescriptorPoolSize> poolSizes = {
+        myvk::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2)};
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = myvk::initializers::descriptorPoolCreateInfo(poolSizes, 1);
+    VkDescriptorPool descriptorPool;
+    VK_CHECK_RESULT(vkCreateDescriptorPool(appData.device, &descriptorPoolInfo, nullptr, &descriptorPool));
+
+    VkDescriptorSetAllocateInfo allocInfo = myvk::initializers::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1);
+    VkDescriptorSet descriptorSet;
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(appData.device, &allocInfo, &descriptorSet));
+    VkDescriptorBufferInfo bufferInfos[2] = {
+        {seedBuffer, 0, VK_WHOLE_SIZE},
+        {appData.vertexBuffer, 0, VK_WHOLE_SIZE}};
+    std::vector<VkWriteDescriptorSet> descriptorWrites = {
+        myvk::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, &bufferInfos[0]),
+        myvk::initializers::writeDescriptorSet(descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &bufferInfos[1])};
+    vkUpdateDescriptorSets(appData.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo = myvk::initializers::computePipelineCreateInfo(pipelineLayout);
+    computePipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computePipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computePipelineCreateInfo.stage.module = shaderModule;
+    computePipelineCreateInfo.stage.pName = "main";
+    VkPipeline pipeline;
+    VK_CHECK_RESULT(vkCreateComputePipelines(appData.device, appData.pipelineCache.get(), 1, &computePipelineCreateInfo, nullptr, &pipeline));
+
+    VkCommandBuffer commandBuffer = appData.submitContext.begin();
+    vkCmdUpdateBuffer(commandBuffer, seedBuffer, 0, seedBufferSize, seeds.data());
+
+    VkBufferMemoryBarrier barrier = myvk::initializers::bufferMemoryBarrier();
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.buffer = seedBuffer;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConsts), &pushConsts);
+    // Spread the groups over y, every device supports at least 65535 groups per dimension
+    uint32_t groupCount = (pushConsts.triangleCount + SUBDIVIDE_GROUP_SIZE - 1) / SUBDIVIDE_GROUP_SIZE;
+    uint32_t groupCountX = std::min(groupCount, 65535u);
+    vkCmdDispatch(commandBuffer, groupCountX, (groupCount + groupCountX - 1) / groupCountX, 1);
+
+    // The draws read the vertices as attributes in later submissions on this queue
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.buffer = appData.vertexBuffer;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    if (appData.verifyCompute)
+    {
+        VkBufferCopy copyRegion = {0, 0, vertexBufferSize};
+        vkCmdCopyBuffer(commandBuffer, appData.vertexBuffer, verifyBuffer, 1, &copyRegion);
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        barrier.buffer = verifyBuffer;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    // Wait here so the one-off pipeline and the seeds can go right away
+    auto tStart = std::chrono::high_resolution_clock::now();
+    appData.submitContext.wait(appData.submitContext.submit(commandBuffer));
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    printf("Subdivided %u triangles on the GPU in %.3f ms\n", pushConsts.triangleCount, std::chrono::duration<double, std::milli>(tEnd - tStart).count());
+
+    vkDestroyPipeline(appData.device, pipeline, nullptr);
+    vkDestroyDescriptorPool(appData.device, descriptorPool, nullptr);
+    vkDestroyPipelineLayout(appData.device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(appData.device, descriptorSetLayout, nullptr);
+    appData.shaderRegistry.release(shaderModule);
+    vkDestroyBuffer(appData.device, seedBuffer, nullptr);
+    appData.allocator.free(seedMemory);
+
+    if (appData.verifyCompute)
+    {
+        appData.allocator.invalidate(verifyMemory);
+        appData.verifyFailed = !verifyComputeVertices(appData, static_cast<const Vertex *>(verifyMemory.mapped));
+        vkDestroyBuffer(appData.device, verifyBuffer, nullptr);
+        appData.allocator.free(verifyMemory);
+    }
+    return true;
+}
 
-        submitWork(appData, copyCmd, appData.queue);
+// Compare the output of subdivide.comp with buildVertices, both should produce the same floats
+bool verifyComputeVertices(AppData &appData, const Vertex *gpuVertices)
+{
+    std::vector<Vertex> cpuVertices;
+    buildVertices(cpuVertices, getSeedTriangles(), appData.subdivisionLevel, appData.threadPool);
+    assert(cpuVertices.size() == appData.vertexCount);
 
-        vkDestroyBuffer(appData.device, stagingBuffer, nullptr);
-        vkFreeMemory(appData.device, stagingMemory, nullptr);
+    size_t mismatches = 0;
+    float maxError = 0.0f;
+    for (size_t i = 0; i < cpuVertices.size(); i++)
+    {
+        if (memcmp(&cpuVertices[i], &gpuVertices[i], sizeof(Vertex)) == 0)
+        {
+            continue;
+        }
+        mismatches++;
+        for (int j = 0; j < 3; j++)
+        {
+            maxError = std::max(maxError, std::abs(cpuVertices[i].position[j] - gpuVertices[i].position[j]));
+            maxError = std::max(maxError, std::abs(cpuVertices[i].color[j] - gpuVertices[i].color[j]));
+        }
+    }
+    if (mismatches == 0)
+    {
+        printf("Compute subdivision matches the CPU for all %zu vertices\n", cpuVertices.size());
+        return true;
     }
+    printf("Compute subdivision MISMATCH: %zu of %zu vertices differ, max error %g\n", mismatches, cpuVertices.size(), maxError);
+    return false;
 }
 
 void setFramebufferAtta(AppData &appData)
@@ -298,15 +631,12 @@ void setFramebufferAtta(AppData &appData)
         image.tiling = VK_IMAGE_TILING_OPTIMAL;
         image.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
-        VkMemoryAllocateInfo memAlloc = myvk::initializers::memoryAllocateInfo();
         VkMemoryRequirements memReqs;
 
         VK_CHECK_RESULT(vkCreateImage(appData.device, &image, nullptr, &(appData.colorAttachment.image)));
         vkGetImageMemoryRequirements(appData.device, appData.colorAttachment.image, &memReqs);
-        memAlloc.allocationSize = memReqs.size;
-        memAlloc.memoryTypeIndex = getMemoryTypeIndex(appData, memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(appData.device, &memAlloc, nullptr, &(appData.colorAttachment.memory)));
-        VK_CHECK_RESULT(vkBindImageMemory(appData.device, appData.colorAttachment.image, appData.colorAttachment.memory, 0));
+        VK_CHECK_RESULT(appData.allocator.allocate(memReqs, myvk::MEMORY_USAGE_GPU_ONLY, myvk::ALLOCATION_TILING_OPTIMAL, appData.colorAttachment.memory));
+        VK_CHECK_RESULT(vkBindImageMemory(appData.device, appData.colorAttachment.image, appData.colorAttachment.memory.memory, appData.colorAttachment.memory.offset));
 
         VkImageViewCreateInfo colorImageView = myvk::initializers::imageViewCreateInfo();
         colorImageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
@@ -326,10 +656,8 @@ void setFramebufferAtta(AppData &appData)
 
         VK_CHECK_RESULT(vkCreateImage(appData.device, &image, nullptr, &(appData.depthAttachment.image)));
         vkGetImageMemoryRequirements(appData.device, appData.depthAttachment.image, &memReqs);
-        memAlloc.allocationSize = memReqs.size;
-        memAlloc.memoryTypeIndex = getMemoryTypeIndex(appData, memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(appData.device, &memAlloc, nullptr, &(appData.depthAttachment.memory)));
-        VK_CHECK_RESULT(vkBindImageMemory(appData.device, appData.depthAttachment.image, appData.depthAttachment.memory, 0));
+        VK_CHECK_RESULT(appData.allocator.allocate(memReqs, myvk::MEMORY_USAGE_GPU_ONLY, myvk::ALLOCATION_TILING_OPTIMAL, appData.depthAttachment.memory));
+        VK_CHECK_RESULT(vkBindImageMemory(appData.device, appData.depthAttachment.image, appData.depthAttachment.memory.memory, appData.depthAttachment.memory.offset));
 
         VkImageViewCreateInfo depthStencilView = myvk::initializers::imageViewCreateInfo();
         depthStencilView.viewType = VK_IMAGE_VIEW_TYPE_2D;
@@ -344,6 +672,9 @@ void setFramebufferAtta(AppData &appData)
         depthStencilView.image = appData.depthAttachment.image;
         VK_CHECK_RESULT(vkCreateImageView(appData.device, &depthStencilView, nullptr, &(appData.depthAttachment.view)));
     }
+
+    // Host cached buffers the color attachment is copied into
+    appData.readback.create(appData.device, appData.allocator, appData.submitContext, appData.width, appData.height, 4, appData.framesInFlight);
 }
 
 void setRenderPass(AppData &appData)
@@ -434,20 +765,24 @@ void setPipeline(AppData &appData)
     VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo =
         myvk::initializers::pipelineLayoutCreateInfo(nullptr, 0);
 
-    // MVP via push constant block
-    VkPushConstantRange pushConstantRange = myvk::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4), 0);
+    // MVP via push constant block, every tessellation stage reads the wider TessellationPushConsts
+    const VkShaderStageFlags tessellationStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT |
+                                                  VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    VkPushConstantRange pushConstantRange = appData.tessellation
+                                                ? myvk::initializers::pushConstantRange(tessellationStages, sizeof(TessellationPushConsts), 0)
+                                                : myvk::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, sizeof(glm::mat4), 0);
     pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
     pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
 
     VK_CHECK_RESULT(vkCreatePipelineLayout(appData.device, &pipelineLayoutCreateInfo, nullptr, &(appData.pipelineLayout)));
 
-    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-    VK_CHECK_RESULT(vkCreatePipelineCache(appData.device, &pipelineCacheCreateInfo, nullptr, &(appData.pipelineCache)));
-
     // Create pipeline
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
-        myvk::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+        myvk::initializers::pipelineInputAssemblyStateCreateInfo(appData.tessellation ? VK_PRIMITIVE_TOPOLOGY_PATCH_LIST : VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+
+    // Every seed triangle is one patch
+    VkPipelineTessellationStateCreateInfo tessellationState =
+        myvk::initializers::pipelineTessellationStateCreateInfo(3);
 
     VkPipelineRasterizationStateCreateInfo rasterizationState =
         myvk::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
@@ -476,7 +811,7 @@ void setPipeline(AppData &appData)
     VkGraphicsPipelineCreateInfo pipelineCreateInfo =
         myvk::initializers::pipelineCreateInfo(appData.pipelineLayout, appData.renderPass);
 
-    std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages{};
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages(appData.tessellation ? 4 : 2);
 
     pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
     pipelineCreateInfo.pRasterizationState = &rasterizationState;
@@ -485,20 +820,22 @@ void setPipeline(AppData &appData)
     pipelineCreateInfo.pViewportState = &viewportState;
     pipelineCreateInfo.pDepthStencilState = &depthStencilState;
     pipelineCreateInfo.pDynamicState = &dynamicState;
+    pipelineCreateInfo.pTessellationState = appData.tessellation ? &tessellationState : nullptr;
     pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
     pipelineCreateInfo.pStages = shaderStages.data();
 
-    // Vertex bindings an attributes
-    // Binding description
-    std::vector<VkVertexInputBindingDescription> vertexInputBindings = {
-        myvk::initializers::vertexInputBindingDescription(0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX),
-    };
-
-    // Attribute descriptions
-    std::vector<VkVertexInputAttributeDescription> vertexInputAttributes = {
-        myvk::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0),                 // Position
-        myvk::initializers::vertexInputAttributeDescription(0, 1, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3), // Color
-    };
+    // Vertex bindings an attributes, generated from the layout of the vertex struct
+    // The packed formats are expanded to the same floats the shaders expect
+    std::vector<VkVertexInputBindingDescription> vertexInputBindings;
+    std::vector<VkVertexInputAttributeDescription> vertexInputAttributes;
+    if (appData.packedVertices)
+    {
+        myvk::vertexlayout::addStream<PackedVertex>(vertexInputBindings, vertexInputAttributes, 0);
+    }
+    else
+    {
+        myvk::vertexlayout::addStream<Vertex>(vertexInputBindings, vertexInputAttributes, 0);
+    }
 
     VkPipelineVertexInputStateCreateInfo vertexInputState = myvk::initializers::pipelineVertexInputStateCreateInfo();
     vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexInputBindings.size());
@@ -514,23 +851,118 @@ void setPipeline(AppData &appData)
     shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
     shaderStages[1].pName = "main";
-    shaderStages[0].module = myvk::tools::loadShader(ASSET_PATH "shaders/template/triangle.vert.spv", appData.device);
-    shaderStages[1].module = myvk::tools::loadShader(ASSET_PATH "shaders/template/triangle.frag.spv", appData.device);
-    appData.shaderModules = {shaderStages[0].module, shaderStages[1].module};
-    VK_CHECK_RESULT(vkCreateGraphicsPipelines(appData.device, appData.pipelineCache, 1, &pipelineCreateInfo, nullptr, &(appData.pipeline)));
+    if (appData.tessellation)
+    {
+        shaderStages[0].module = appData.shaderRegistry.acquire(ASSET_PATH "shaders/template/tessellation.vert.spv");
+        shaderStages[1].module = appData.shaderRegistry.acquire(ASSET_PATH "shaders/template/tessellation.frag.spv");
+        shaderStages[2].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[2].stage = VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+        shaderStages[2].pName = "main";
+        shaderStages[2].module = appData.shaderRegistry.acquire(ASSET_PATH "shaders/template/tessellation.tesc.spv");
+        shaderStages[3].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[3].stage = VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+        shaderStages[3].pName = "main";
+        shaderStages[3].module = appData.shaderRegistry.acquire(ASSET_PATH "shaders/template/tessellation.tese.spv");
+    }
+    else
+    {
+        shaderStages[0].module = appData.shaderRegistry.acquire(ASSET_PATH "shaders/template/triangle.vert.spv");
+        shaderStages[1].module = appData.shaderRegistry.acquire(ASSET_PATH "shaders/template/triangle.frag.spv");
+    }
+    appData.shaderModules.clear();
+    for (auto &shaderStage : shaderStages)
+    {
+        appData.shaderModules.push_back(shaderStage.module);
+    }
+    // A missing or broken .spv leaves a null module, which must not reach the driver
+    if (std::find(appData.shaderModules.begin(), appData.shaderModules.end(), VK_NULL_HANDLE) != appData.shaderModules.end())
+    {
+        printf("The shaders of the pipeline could not be loaded, run make shaders\n");
+        exit(1);
+    }
+    auto tStart = std::chrono::high_resolution_clock::now();
+    VK_CHECK_RESULT(vkCreateGraphicsPipelines(appData.device, appData.pipelineCache.get(), 1, &pipelineCreateInfo, nullptr, &(appData.pipeline)));
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    printf("Pipeline created in %.3f ms with a %s cache\n", std::chrono::duration<double, std::milli>(tEnd - tStart).count(), appData.pipelineCache.isWarm() ? "warm" : "cold");
+    appData.pipelineCache.save();
 }
 
-void setCommand(AppData &appData)
+// Turntable around the scene, frame 0 is the original camera
+void getFrameCamera(AppData &appData, uint32_t frame, glm::mat4 &view, glm::mat4 &projection, glm::vec3 &eye)
 {
-    VkCommandBuffer commandBuffer;
-    VkCommandBufferAllocateInfo cmdBufAllocateInfo =
-        myvk::initializers::commandBufferAllocateInfo(appData.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-    VK_CHECK_RESULT(vkAllocateCommandBuffers(appData.device, &cmdBufAllocateInfo, &commandBuffer));
+    eye = glm::vec3(0.5f, 2.0f, 2.0f);
+    glm::vec3 center(0.2f, 0.1f, 0.2f);
+    float angle = glm::two_pi<float>() * frame / appData.frameCount;
+    glm::mat4 turn = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 1.0f, 0.0f));
+    eye = center + glm::vec3(turn * glm::vec4(eye - center, 0.0f));
+
+    view = glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f));
+    projection = glm::perspective(glm::radians(45.0f), (float)appData.width / (float)appData.height, 0.1f, 10.0f);
+    projection[1][1] = -projection[1][1];
+}
+
+glm::mat4 getFrameMVP(AppData &appData, uint32_t frame)
+{
+    glm::mat4 view, projection;
+    glm::vec3 eye;
+    getFrameCamera(appData, frame, view, projection, eye);
+    glm::mat4 model = glm::mat4(1.0f);
+    return projection * view * model;
+}
+
+// Draw the copies on a grid around the origin, each with the level whose triangle edges cover about lodEdgePixels
+void drawLodObjects(AppData &appData, VkCommandBuffer commandBuffer, uint32_t frame)
+{
+    glm::mat4 view, projection;
+    glm::vec3 eye;
+    getFrameCamera(appData, frame, view, projection, eye);
+    if (appData.indexed)
+    {
+        vkCmdBindIndexBuffer(commandBuffer, appData.indexBuffer, 0, appData.indexType);
+    }
+
+    uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(appData.lodObjects))));
+    float gridOffset = (side - 1) * LOD_SPACING * 0.5f;
+    int maxLevel = static_cast<int>(appData.lodLevels.size()) - 1;
+    for (uint32_t object = 0; object < appData.lodObjects; object++)
+    {
+        glm::vec3 offset((object % side) * LOD_SPACING - gridOffset, 0.0f, (object / side) * LOD_SPACING - gridOffset);
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), offset);
+
+        // Level 0 triangles span about the whole object and every level halves their edges
+        float distance = std::max(glm::length(appData.lodCenter + offset - eye), 0.001f);
+        float screenDiameter = appData.lodRadius * std::fabs(projection[1][1]) * appData.height / distance;
+        float ideal = std::min(std::log2(std::max(screenDiameter / appData.lodEdgePixels, 1.0f)), static_cast<float>(maxLevel));
+        int &level = appData.lodCurrent[object];
+        if (level < 0 || ideal > level + 0.5f + LOD_HYSTERESIS || ideal < level - 0.5f - LOD_HYSTERESIS)
+        {
+            level = std::min(static_cast<int>(std::lround(ideal)), maxLevel);
+        }
 
-    VkCommandBufferBeginInfo cmdBufInfo =
-        myvk::initializers::commandBufferBeginInfo();
+        glm::mat4 mvp = projection * view * model;
+        if (appData.packedVertices)
+        {
+            mvp = mvp * glm::scale(glm::mat4(1.0f), glm::vec3(appData.positionScale));
+        }
+        vkCmdPushConstants(commandBuffer, appData.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mvp), &mvp);
+        const LodLevel &lod = appData.lodLevels[level];
+        if (appData.indexed)
+        {
+            vkCmdDrawIndexed(commandBuffer, lod.count, 1, lod.first, lod.vertexOffset, 0);
+        }
+        else
+        {
+            vkCmdDraw(commandBuffer, lod.count, 1, lod.first, 0);
+        }
+        appData.lodTriangles += lod.count / 3;
+        appData.lodLevelDraws[level]++;
+    }
+}
 
-    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+// Record and submit one frame together with the copy of its image, without waiting for it
+void setCommand(AppData &appData, uint32_t frame)
+{
+    VkCommandBuffer commandBuffer = appData.submitContext.begin();
 
     VkClearValue clearValues[2];
     clearValues[0].color = {{0.0f, 0.0f, 0.2f, 1.0f}};
@@ -566,174 +998,279 @@ void setCommand(AppData &appData)
     VkDeviceSize offsets[1] = {0};
     vkCmdBindVertexBuffers(commandBuffer, 0, 1, &appData.vertexBuffer, offsets);
 
-    glm::mat4 model = glm::mat4(1.0f);
-    glm::mat4 view = glm::mat4(1.0f);
-    glm::mat4 projection = glm::mat4(1.0f);
-
-    view = glm::lookAt(
-        glm::vec3(0.5f, 2.0f, 2.0f),
-        glm::vec3(0.2f, 0.1f, 0.2f),
-        glm::vec3(0.0f, 1.0f, 0.0f));
-
-    projection = glm::perspective(glm::radians(45.0f), (float)appData.width / (float)appData.height, 0.1f, 10.0f);
-    projection[1][1] = -projection[1][1];
-
-    glm::mat4 mvp = projection * view * model;
-
-    vkCmdPushConstants(commandBuffer, appData.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mvp), &mvp);
-    vkCmdDraw(commandBuffer, appData.vertices.size(), 1, 0, 0);
+    if (appData.lodObjects > 0)
+    {
+        drawLodObjects(appData, commandBuffer, frame);
+    }
+    else
+    {
+        glm::mat4 mvp = getFrameMVP(appData, frame);
+        if (appData.packedVertices)
+        {
+            mvp = mvp * glm::scale(glm::mat4(1.0f), glm::vec3(appData.positionScale));
+        }
+        if (appData.tessellation)
+        {
+            TessellationPushConsts pushConsts{mvp, glm::vec2(appData.width, appData.height), appData.tessellationEdgePixels, (uint32_t)appData.subdivisionLevel};
+            vkCmdPushConstants(commandBuffer, appData.pipelineLayout,
+                               VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+                               0, sizeof(pushConsts), &pushConsts);
+        }
+        else
+        {
+            vkCmdPushConstants(commandBuffer, appData.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mvp), &mvp);
+        }
+        if (appData.indexed)
+        {
+            vkCmdBindIndexBuffer(commandBuffer, appData.indexBuffer, 0, appData.indexType);
+            vkCmdDrawIndexed(commandBuffer, appData.indexCount, 1, 0, 0, 0);
+        }
+        else
+        {
+            vkCmdDraw(commandBuffer, appData.vertexCount, 1, 0, 0);
+        }
+    }
 
     vkCmdEndRenderPass(commandBuffer);
 
-    VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
-
-    submitWork(appData, commandBuffer, appData.queue);
+    // Copy the color attachment into a host cached readback buffer in the same submission
+    myvk::tools::insertImageMemoryBarrier(
+        commandBuffer,
+        appData.colorAttachment.image,
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_ACCESS_TRANSFER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1});
+    appData.readback.record(commandBuffer, appData.colorAttachment.image);
 
-    vkDeviceWaitIdle(appData.device);
+    // No need to wait, saveImage blocks on the readback
+    appData.readback.submitted(appData.submitContext.submit(commandBuffer));
 }
 
+// Write out the oldest frame in flight
 void saveImage(AppData &appData)
 {
-    const char *imagedata;
-    // Create the linear tiled destination image to copy to and to read the memory from
-    VkImageCreateInfo imgCreateInfo(myvk::initializers::imageCreateInfo());
-    imgCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-    imgCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-    imgCreateInfo.extent.width = appData.width;
-    imgCreateInfo.extent.height = appData.height;
-    imgCreateInfo.extent.depth = 1;
-    imgCreateInfo.arrayLayers = 1;
-    imgCreateInfo.mipLevels = 1;
-    imgCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imgCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    imgCreateInfo.tiling = VK_IMAGE_TILING_LINEAR;
-    imgCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-    // Create the image
-    VkImage dstImage;
-    VK_CHECK_RESULT(vkCreateImage(appData.device, &imgCreateInfo, nullptr, &dstImage));
-    // Create memory to back up the image
-    VkMemoryRequirements memRequirements;
-    VkMemoryAllocateInfo memAllocInfo(myvk::initializers::memoryAllocateInfo());
-    VkDeviceMemory dstImageMemory;
-    vkGetImageMemoryRequirements(appData.device, dstImage, &memRequirements);
-    memAllocInfo.allocationSize = memRequirements.size;
-    // Memory must be host visible to copy from
-    memAllocInfo.memoryTypeIndex = getMemoryTypeIndex(appData, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    VK_CHECK_RESULT(vkAllocateMemory(appData.device, &memAllocInfo, nullptr, &dstImageMemory));
-    VK_CHECK_RESULT(vkBindImageMemory(appData.device, dstImage, dstImageMemory, 0));
-
-    // Do the actual blit from the offscreen image to our host visible destination image
-    VkCommandBufferAllocateInfo cmdBufAllocateInfo = myvk::initializers::commandBufferAllocateInfo(appData.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-    VkCommandBuffer copyCmd;
-    VK_CHECK_RESULT(vkAllocateCommandBuffers(appData.device, &cmdBufAllocateInfo, &copyCmd));
-    VkCommandBufferBeginInfo cmdBufInfo = myvk::initializers::commandBufferBeginInfo();
-    VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
-
-    // Transition destination image to transfer destination layout
-    myvk::tools::insertImageMemoryBarrier(
-        copyCmd,
-        dstImage,
-        0,
-        VK_ACCESS_TRANSFER_WRITE_BIT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1});
-
-    // colorAttachment.image is already in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, and does not need to be transitioned
-
-    VkImageCopy imageCopyRegion{};
-    imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyRegion.srcSubresource.layerCount = 1;
-    imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyRegion.dstSubresource.layerCount = 1;
-    imageCopyRegion.extent.width = appData.width;
-    imageCopyRegion.extent.height = appData.height;
-    imageCopyRegion.extent.depth = 1;
-
-    vkCmdCopyImage(
-        copyCmd,
-        appData.colorAttachment.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1,
-        &imageCopyRegion);
-
-    // Transition destination image to general layout, which is the required layout for mapping the image memory later on
-    myvk::tools::insertImageMemoryBarrier(
-        copyCmd,
-        dstImage,
-        VK_ACCESS_TRANSFER_WRITE_BIT,
-        VK_ACCESS_MEMORY_READ_BIT,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_GENERAL,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1});
+    // Wait for the copy recorded behind the render pass, the memory is already mapped by the allocator
+    myvk::ReadbackFrame frame;
+    if (!appData.readback.map(frame))
+    {
+        printf("Nothing was rendered\n");
+        return;
+    }
 
-    VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
+    /*
+			Save host visible framebuffer image to disk (ppm format)
+		    */
+    char filename[64];
+    if (appData.frameCount == 1)
+    {
+        snprintf(filename, sizeof(filename), "./out/pic/headless.ppm");
+    }
+    else
+    {
+        snprintf(filename, sizeof(filename), "./out/pic/headless_%05llu.ppm", (unsigned long long)frame.index);
+    }
+    // The color attachment is always R8G8B8A8_UNORM, so the texels are in ppm order already
+    myvk::tools::savePPM(filename, frame.data, frame.width, frame.height, frame.rowPitch, false);
+    appData.readback.unmap();
 
-    submitWork(appData, copyCmd, appData.queue);
+    printf("Framebuffer image saved to %s\n", filename);
+}
 
-    // Get layout of the image (including row pitch)
-    VkImageSubresource subResource{};
-    subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    VkSubresourceLayout subResourceLayout;
+size_t subdividedVertexCount(int target)
+{
+    size_t count = 3;
+    for (int i = 0; i < target; i++)
+    {
+        count *= 3;
+    }
+    return count;
+}
 
-    vkGetImageSubresourceLayout(appData.device, dstImage, &subResource, &subResourceLayout);
+// Sub-triangle i keeps corner i and takes the midpoints of the two edges next to it
+static void subdivideTriangle(const Vertex *parent, int i, Vertex *child)
+{
+    for (int j = 0; j < 3; j++)
+    {
+        child[j] = parent[j];
+        if (j != i)
+        {
+            child[j].position[0] = (parent[(j + 1) % 3].position[0] + parent[(j + 2) % 3].position[0]) / 2.0f;
+            child[j].position[1] = (parent[(j + 1) % 3].position[1] + parent[(j + 2) % 3].position[1]) / 2.0f;
+            child[j].position[2] = (parent[(j + 1) % 3].position[2] + parent[(j + 2) % 3].position[2]) / 2.0f;
+        }
+    }
+}
 
-    // Map image memory so we can start copying from it
-    vkMapMemory(appData.device, dstImageMemory, 0, VK_WHOLE_SIZE, 0, (void **)&imagedata);
-    imagedata += subResourceLayout.offset;
+void buildVertex(Vertex *vertices, const Vertex *input, int target)
+{
+    assert(target <= MAX_SUBDIVISION_LEVEL);
+    // Triangle and child index of every level on the path to the current leaf
+    Vertex path[MAX_SUBDIVISION_LEVEL + 1][3];
+    int childIndex[MAX_SUBDIVISION_LEVEL + 1];
+    std::copy(input, input + 3, path[0]);
+    for (int level = 1; level <= target; level++)
+    {
+        childIndex[level] = 0;
+        subdivideTriangle(path[level - 1], 0, path[level]);
+    }
 
-    /*
-			Save host visible framebuffer image to disk (ppm format)
-		    */
-    const char *filename = "./out/pic/headless.ppm";
-    std::ofstream file(filename, std::ios::out | std::ios::binary);
+    for (;;)
+    {
+        std::copy(path[target], path[target] + 3, vertices);
+        vertices += 3;
 
-    // ppm header
-    file << "P6\n"
-         << appData.width << "\n"
-         << appData.height << "\n"
-         << 255 << "\n";
+        // Step to the next leaf like counting in base 3, rebuilding only the levels below the changed digit
+        int level = target;
+        while (level > 0 && childIndex[level] == 2)
+        {
+            level--;
+        }
+        if (level == 0)
+        {
+            break;
+        }
+        childIndex[level]++;
+        subdivideTriangle(path[level - 1], childIndex[level], path[level]);
+        for (level++; level <= target; level++)
+        {
+            childIndex[level] = 0;
+            subdivideTriangle(path[level - 1], 0, path[level]);
+        }
+    }
+}
 
-    // If source is BGR (destination is always RGB) and we can't use blit (which does automatic conversion), we'll have to manually swizzle color components
-    // Check if source is BGR and needs swizzle
-    std::vector<VkFormat> formatsBGR = {VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_B8G8R8A8_SNORM};
-    const bool colorSwizzle = (std::find(formatsBGR.begin(), formatsBGR.end(), VK_FORMAT_R8G8B8A8_UNORM) != formatsBGR.end());
+void buildVertices(std::vector<Vertex> &vertices, const std::vector<Vertex> &seeds, int target, myvk::ThreadPool &threadPool)
+{
+    uint32_t seedCount = static_cast<uint32_t>(seeds.size() / 3);
+    size_t seedVertexCount = subdividedVertexCount(target);
+    vertices.resize(seedCount * seedVertexCount);
+
+    // Split every seed into 3^splitLevel sub-trees until there are a few tasks per thread
+    int splitLevel = 0;
+    uint32_t subtreeCount = 1;
+    while (splitLevel < target && seedCount * subtreeCount < 4 * threadPool.getThreadCount())
+    {
+        splitLevel++;
+        subtreeCount *= 3;
+    }
+    size_t subtreeVertexCount = subdividedVertexCount(target - splitLevel);
+
+    // Sub-trees are written to where the depth first order puts them, so the output doesn't depend on the split
+    threadPool.parallelFor(seedCount * subtreeCount, [&](uint32_t task) {
+        uint32_t seed = task / subtreeCount;
+        uint32_t subtree = task % subtreeCount;
+        Vertex root[3];
+        std::copy(&seeds[seed * 3], &seeds[seed * 3] + 3, root);
+        for (uint32_t digit = subtreeCount / 3; digit > 0; digit /= 3)
+        {
+            Vertex child[3];
+            subdivideTriangle(root, (subtree / digit) % 3, child);
+            std::copy(child, child + 3, root);
+        }
+        buildVertex(&vertices[seed * seedVertexCount + subtree * subtreeVertexCount], root, target - splitLevel);
+    });
+}
 
-    // ppm binary pixel data
-    for (int32_t y = 0; y < appData.height; y++)
+// Same split as subdivideTriangle on vertex indices, an edge midpoint is only created the first time one of its triangles needs it
+static void subdivideIndexedTriangle(std::vector<Vertex> &vertices, std::unordered_map<uint64_t, uint32_t> &midpoints,
+                                     const uint32_t *parent, int i, uint32_t *child)
+{
+    for (int j = 0; j < 3; j++)
     {
-        unsigned int *row = (unsigned int *)imagedata;
-        for (int32_t x = 0; x < appData.width; x++)
+        child[j] = parent[j];
+        if (j == i)
+        {
+            continue;
+        }
+        uint32_t a = parent[(j + 1) % 3];
+        uint32_t b = parent[(j + 2) % 3];
+        uint64_t edge = (uint64_t)std::min(a, b) << 32 | std::max(a, b);
+        auto midpoint = midpoints.emplace(edge, static_cast<uint32_t>(vertices.size()));
+        if (midpoint.second)
+        {
+            // Operands in the same order as subdivideTriangle, so positions match the triangle soup bit for bit
+            Vertex vertex = vertices[parent[j]];
+            vertex.position[0] = (vertices[a].position[0] + vertices[b].position[0]) / 2.0f;
+            vertex.position[1] = (vertices[a].position[1] + vertices[b].position[1]) / 2.0f;
+            vertex.position[2] = (vertices[a].position[2] + vertices[b].position[2]) / 2.0f;
+            vertices.push_back(vertex);
+        }
+        child[j] = midpoint.first->second;
+    }
+}
+
+void buildIndexedVertices(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, const std::vector<Vertex> &seeds, int target, myvk::ThreadPool &threadPool)
+{
+    assert(target <= MAX_SUBDIVISION_LEVEL);
+    uint32_t seedCount = static_cast<uint32_t>(seeds.size() / 3);
+    size_t seedIndexCount = subdividedVertexCount(target);
+    // 3 corners, then every level adds one midpoint per edge of the triangles kept so far
+    size_t seedVertexCount = (seedIndexCount + 3) / 2;
+    std::vector<std::vector<Vertex>> seedVertices(seedCount);
+    indices.resize(seedCount * seedIndexCount);
+
+    // One task per seed, the midpoint cache is not shared so seeds don't merge vertices of different colors
+    threadPool.parallelFor(seedCount, [&](uint32_t seed) {
+        std::vector<Vertex> &local = seedVertices[seed];
+        local.reserve(seedVertexCount);
+        local.assign(&seeds[seed * 3], &seeds[seed * 3] + 3);
+        std::unordered_map<uint64_t, uint32_t> midpoints;
+        midpoints.reserve(seedVertexCount);
+
+        // Walk the leaves in the order buildVertex writes them, so both modes draw the same triangles in the same order
+        uint32_t path[MAX_SUBDIVISION_LEVEL + 1][3] = {{0, 1, 2}};
+        int childIndex[MAX_SUBDIVISION_LEVEL + 1];
+        for (int level = 1; level <= target; level++)
         {
-            if (colorSwizzle)
+            childIndex[level] = 0;
+            subdivideIndexedTriangle(local, midpoints, path[level - 1], 0, path[level]);
+        }
+        uint32_t *out = &indices[seed * seedIndexCount];
+        for (;;)
+        {
+            std::copy(path[target], path[target] + 3, out);
+            out += 3;
+
+            int level = target;
+            while (level > 0 && childIndex[level] == 2)
             {
-                file.write((char *)row + 2, 1);
-                file.write((char *)row + 1, 1);
-                file.write((char *)row, 1);
+                level--;
             }
-            else
+            if (level == 0)
             {
-                file.write((char *)row, 3);
+                break;
+            }
+            childIndex[level]++;
+            subdivideIndexedTriangle(local, midpoints, path[level - 1], childIndex[level], path[level]);
+            for (level++; level <= target; level++)
+            {
+                childIndex[level] = 0;
+                subdivideIndexedTriangle(local, midpoints, path[level - 1], 0, path[level]);
             }
-            row++;
         }
-        imagedata += subResourceLayout.rowPitch;
-    }
-    file.close();
-
-    printf("Framebuffer image saved to %s\n", filename);
+        assert(local.size() == seedVertexCount);
+    });
 
-    // Clean up resources
-    vkUnmapMemory(appData.device, dstImageMemory);
-    vkFreeMemory(appData.device, dstImageMemory, nullptr);
-    vkDestroyImage(appData.device, dstImage, nullptr);
+    // Seeds are appended one after another, rebase their indices onto the shared vertex array
+    vertices.clear();
+    vertices.reserve(seedCount * seedVertexCount);
+    for (uint32_t seed = 0; seed < seedCount; seed++)
+    {
+        uint32_t base = static_cast<uint32_t>(vertices.size());
+        for (size_t i = seed * seedIndexCount; i < (seed + 1) * seedIndexCount; i++)
+        {
+            indices[i] += base;
+        }
+        vertices.insert(vertices.end(), seedVertices[seed].begin(), seedVertices[seed].end());
+    }
 }
 
-void buildVertex(std::vector<Vertex> &vertices, std::vector<Vertex> input, int cur, int target)
+// Original recursive subdivision, kept as the reference for --bench-subdivide
+void buildVertexRecursive(std::vector<Vertex> &vertices, std::vector<Vertex> input, int cur, int target)
 {
     if (cur > target)
         return;
@@ -768,15 +1305,121 @@ void buildVertex(std::vector<Vertex> &vertices, std::vector<Vertex> input, int c
             ninput[(i + 2) % 3].position[0] = nposition[(i + 2) % 3][0];
             ninput[(i + 2) % 3].position[1] = nposition[(i + 2) % 3][1];
             ninput[(i + 2) % 3].position[2] = nposition[(i + 2) % 3][2];
-            buildVertex(vertices, ninput, cur + 1, target);
+            buildVertexRecursive(vertices, ninput, cur + 1, target);
+        }
+    }
+}
+
+// Compare the recursive subdivision with the iterative one on one and on all threads and with the indexed one, outputs must match bit for bit
+void benchmarkSubdivision()
+{
+    myvk::ThreadPool singleThread(1);
+    myvk::ThreadPool allThreads;
+    std::vector<Vertex> seeds = getSeedTriangles();
+    printf("level    vertices   recursive(ms)   iterative(ms)   threaded(ms) x%u   unique   indexed(ms)\n", allThreads.getThreadCount());
+    for (int target = 0; target <= 10; target++)
+    {
+        std::vector<Vertex> reference, single, threaded;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (size_t seed = 0; seed < seeds.size(); seed += 3)
+        {
+            buildVertexRecursive(reference, std::vector<Vertex>(seeds.begin() + seed, seeds.begin() + seed + 3), 0, target);
         }
+        auto t1 = std::chrono::high_resolution_clock::now();
+        buildVertices(single, seeds, target, singleThread);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        buildVertices(threaded, seeds, target, allThreads);
+        auto t3 = std::chrono::high_resolution_clock::now();
+        std::vector<Vertex> unique;
+        std::vector<uint32_t> indices;
+        buildIndexedVertices(unique, indices, seeds, target, allThreads);
+        auto t4 = std::chrono::high_resolution_clock::now();
+
+        bool identical = reference.size() == single.size() && reference.size() == threaded.size() &&
+                         memcmp(reference.data(), single.data(), reference.size() * sizeof(Vertex)) == 0 &&
+                         memcmp(reference.data(), threaded.data(), reference.size() * sizeof(Vertex)) == 0;
+        // Indexed output has to expand back into the same soup
+        identical = identical && indices.size() == reference.size();
+        for (size_t i = 0; identical && i < indices.size(); i++)
+        {
+            identical = memcmp(&unique[indices[i]], &reference[i], sizeof(Vertex)) == 0;
+        }
+        printf("%5d %11zu %15.3f %15.3f %14.3f %11zu %13.3f %s\n", target, reference.size(),
+               std::chrono::duration<double, std::milli>(t1 - t0).count(),
+               std::chrono::duration<double, std::milli>(t2 - t1).count(),
+               std::chrono::duration<double, std::milli>(t3 - t2).count(),
+               unique.size(),
+               std::chrono::duration<double, std::milli>(t4 - t3).count(),
+               identical ? "" : "MISMATCH");
     }
 }
 
-int main()
+// Keep up to framesInFlight frames queued, the CPU writes out frame N while the GPU renders the next ones
+void renderLoop(AppData &appData)
 {
+    auto tStart = std::chrono::high_resolution_clock::now();
+    for (uint32_t frame = 0; frame < appData.frameCount; frame++)
+    {
+        if (appData.readback.full())
+        {
+            saveImage(appData);
+        }
+        setCommand(appData, frame);
+    }
+    while (appData.readback.pending() > 0)
+    {
+        saveImage(appData);
+    }
+    auto tEnd = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(tEnd - tStart).count();
+    printf("Rendered %u frames with %u in flight in %.3f s, %.1f fps\n", appData.frameCount, appData.framesInFlight, seconds, appData.frameCount / seconds);
+
+    if (appData.lodObjects > 0)
+    {
+        double fullDetail = (double)appData.lodObjects * (appData.lodLevels.back().count / 3);
+        double submitted = (double)appData.lodTriangles / appData.frameCount;
+        printf("LOD: %.0f triangles submitted per frame for %u objects, %.1f%% of drawing all at level %zu\n",
+               submitted, appData.lodObjects, 100.0 * submitted / fullDetail, appData.lodLevels.size() - 1);
+        printf("Objects per level and frame:");
+        for (size_t level = 0; level < appData.lodLevelDraws.size(); level++)
+        {
+            printf(" %zu:%.1f", level, (double)appData.lodLevelDraws[level] / appData.frameCount);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (myvk::tools::hasArgument(argc, argv, "--bench-subdivide"))
+    {
+        benchmarkSubdivision();
+        return 0;
+    }
+
     printf("Start\n");
     AppData *appData = new AppData();
+    appData->frameCount = std::max(myvk::tools::getArgument(argc, argv, "--frames", 1), 1u);
+    // The soup stays the default so the saved frames don't change, --indexed opts into the index buffer
+    appData->indexed = myvk::tools::hasArgument(argc, argv, "--indexed");
+    appData->optimizeVertexCache = !myvk::tools::hasArgument(argc, argv, "--no-cache-optimize");
+    appData->lodObjects = myvk::tools::getArgument(argc, argv, "--lod", 0u);
+    appData->lodEdgePixels = (float)std::max(myvk::tools::getArgument(argc, argv, "--lod-edge-pixels", 8u), 1u);
+    appData->subdivisionLevel = std::min(myvk::tools::getArgument(argc, argv, "--level", 4u), (uint32_t)MAX_SUBDIVISION_LEVEL);
+    appData->verifyCompute = myvk::tools::hasArgument(argc, argv, "--verify-compute");
+    appData->tessellationEdgePixels = (float)myvk::tools::getArgument(argc, argv, "--tess-edge-pixels", 0u);
+    appData->tessellation = appData->tessellationEdgePixels > 0.0f || myvk::tools::hasArgument(argc, argv, "--tessellate");
+    appData->computeSubdivision = !appData->tessellation && (appData->verifyCompute || myvk::tools::hasArgument(argc, argv, "--compute-subdivide"));
+    // Compute and tessellation produce a single level
+    if (appData->lodObjects > 0 && (appData->computeSubdivision || appData->tessellation))
+    {
+        printf("--lod needs CPU subdivision, drawing a single object\n");
+        appData->lodObjects = 0;
+    }
+    // The compute shader writes float vertices
+    appData->packedVertices = !appData->computeSubdivision && myvk::tools::hasArgument(argc, argv, "--packed-vertices");
+    appData->framesInFlight = std::min(std::max(myvk::tools::getArgument(argc, argv, "--in-flight", DEFAULT_READBACK_SLOTS), 1u), (uint32_t)MAX_FRAMES_IN_FLIGHT);
 
     setInstance(*appData);
     setDevice(*appData);
@@ -784,12 +1427,18 @@ int main()
     setFramebufferAtta(*appData);
     setRenderPass(*appData);
     setPipeline(*appData);
-    setCommand(*appData);
-    saveImage(*appData);
+    renderLoop(*appData);
+    appData->allocator.dumpStats();
+    appData->shaderRegistry.dumpStats();
 
     vkQueueWaitIdle((*appData).queue);
     printf("End\n");
-    getchar();
+    // Only wait for a key press when run by hand
+    if (argc == 1)
+    {
+        getchar();
+    }
+    bool failed = appData->verifyFailed;
     delete appData;
-    return 0;
+    return failed ? 1 : 0;
 }
\ No newline at end of file
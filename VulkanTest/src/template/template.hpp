@@ -4,14 +4,39 @@
 #include <array>
 #include <assert.h>
 #include <algorithm>
+#include <chrono>
+#include <unordered_map>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
 
 #include <vulkan/vulkan.h>
 #include "tools.hpp"
+#include "allocator.hpp"
+#include "submit.hpp"
+#include "staging.hpp"
+#include "upload.hpp"
+#include "readback.hpp"
+#include "pipelinecache.hpp"
+#include "shader.hpp"
+#include "threadpool.hpp"
+#include "vertexformat.hpp"
+#include "vertexlayout.hpp"
+#include "vertexcache.hpp"
+
+// Upper bound for --in-flight, every frame in flight holds a command buffer, a fence and a readback slot
+#define MAX_FRAMES_IN_FLIGHT 4
+// Deepest subdivision buildVertex supports, 3^16 triangles per seed is far more than a vertex buffer holds
+#define MAX_SUBDIVISION_LEVEL 16
+// local_size_x of subdivide.comp
+#define SUBDIVIDE_GROUP_SIZE 64
+// Levels the ideal LOD has to move past the current one before an object switches, keeps it from flickering
+#define LOD_HYSTERESIS 0.25f
+// Distance between the copies of --lod
+#define LOD_SPACING 1.5f
 
 #define DEBUG (!NDEBUG)
 
@@ -19,7 +44,7 @@
 struct FrameBufferAttachment
 {
     VkImage image;
-    VkDeviceMemory memory;
+    myvk::Allocation memory;
     VkImageView view;
 };
 struct Vertex
@@ -27,16 +52,64 @@ struct Vertex
     float position[3];
     float color[3];
 };
+// Vertex with R16G16B16A16_SNORM position and R8G8B8A8_UNORM color, 12 bytes instead of 24
+struct PackedVertex
+{
+    int16_t position[4];
+    uint8_t color[4];
+};
+// subdivide.comp writes Vertex as six tightly packed floats
+static_assert(sizeof(Vertex) == 6 * sizeof(float), "Vertex does not match the std430 layout of subdivide.comp");
+
+// Vertex input layouts, the locations match the template shaders
+namespace myvk
+{
+namespace vertexlayout
+{
+template <>
+struct Layout<Vertex>
+{
+    static constexpr std::array<Attribute, 2> attributes = {{
+        MYVK_VERTEX_ATTRIBUTE(Vertex, position, 0, VK_FORMAT_R32G32B32_SFLOAT),
+        MYVK_VERTEX_ATTRIBUTE(Vertex, color, 1, VK_FORMAT_R32G32B32_SFLOAT),
+    }};
+};
+template <>
+struct Layout<PackedVertex>
+{
+    static constexpr std::array<Attribute, 2> attributes = {{
+        MYVK_VERTEX_ATTRIBUTE(PackedVertex, position, 0, VK_FORMAT_R16G16B16A16_SNORM),
+        MYVK_VERTEX_ATTRIBUTE(PackedVertex, color, 1, VK_FORMAT_R8G8B8A8_UNORM),
+    }};
+};
+} // namespace vertexlayout
+} // namespace myvk
+// Push constants of the tessellation pipeline, shared by all of its stages
+struct TessellationPushConsts
+{
+    glm::mat4 mvp;
+    glm::vec2 viewport;
+    float edgePixels;
+    uint32_t target;
+};
 struct BufferCreateInfo
 {
     VkBufferUsageFlags usageFlags;
-    VkMemoryPropertyFlags memoryPropertyFlags;
+    myvk::MemoryUsage memoryUsage;
     VkBuffer *buffer;
-    VkDeviceMemory *memory;
+    myvk::Allocation *memory;
     VkDeviceSize size;
     void *data = nullptr;
 };
 
+// Draw range of one subdivision level in the shared LOD buffers, counts are indices or, for the soup, vertices
+struct LodLevel
+{
+    uint32_t first;
+    uint32_t count;
+    int32_t vertexOffset;
+};
+
 // data used in the app
 class AppData
 {
@@ -45,17 +118,58 @@ class AppData
     VkPhysicalDevice physicalDevice;
     VkDevice device;
     uint32_t queueFamilyIndex;
-    VkPipelineCache pipelineCache;
+    myvk::PipelineCache pipelineCache;
     VkQueue queue;
-    VkCommandPool commandPool;
+    myvk::SubmitContext submitContext;
+    // Same as the graphics queue when the device has no separate transfer family
+    uint32_t transferQueueFamilyIndex;
+    VkQueue transferQueue;
+    myvk::SubmitContext transferContext;
+    myvk::Allocator allocator;
+    myvk::StagingRing stagingRing;
+    myvk::ReadbackQueue readback;
+    // Frames rendered by the render loop, and how many of them may be queued before their image is read back
+    uint32_t frameCount = 1;
+    uint32_t framesInFlight = DEFAULT_READBACK_SLOTS;
 
     VkDescriptorSetLayout descriptorSetLayout;
     VkPipelineLayout pipelineLayout;
     VkPipeline pipeline;
+    myvk::ShaderRegistry shaderRegistry;
+    myvk::ThreadPool threadPool;
     std::vector<VkShaderModule> shaderModules;
     VkBuffer vertexBuffer, indexBuffer;
-    VkDeviceMemory vertexMemory, indexMemory;
+    myvk::Allocation vertexMemory, indexMemory;
     std::vector<Vertex> vertices;
+    uint32_t vertexCount = 0;
+    int subdivisionLevel = 4;
+    // Subdivide with subdivide.comp straight into the vertex buffer, vertices stays empty then
+    bool computeSubdivision = false;
+    bool verifyCompute = false;
+    bool verifyFailed = false;
+    // Upload only the seed triangles and subdivide them with tessellation shaders, edgePixels 0 uses subdivisionLevel
+    bool tessellation = false;
+    float tessellationEdgePixels = 0.0f;
+    // Upload PackedVertex instead of Vertex, positions are divided by positionScale to fit SNORM
+    bool packedVertices = false;
+    float positionScale = 1.0f;
+    // Draw unique vertices through the index buffer with --indexed, otherwise the flat triangle list without one
+    bool indexed = false;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+    uint32_t indexCount = 0;
+    // Reorder the indexed mesh for the post-transform cache before upload, --no-cache-optimize keeps generation order
+    bool optimizeVertexCache = true;
+    // --lod N draws N copies on a grid, each at the level whose triangle edges cover about lodEdgePixels on screen
+    uint32_t lodObjects = 0;
+    float lodEdgePixels = 8.0f;
+    std::vector<LodLevel> lodLevels;
+    // Bounding sphere of one copy, and the level every object was drawn with last
+    glm::vec3 lodCenter = glm::vec3(0.0f);
+    float lodRadius = 1.0f;
+    std::vector<int> lodCurrent;
+    // Sums over all frames for the stats readout
+    uint64_t lodTriangles = 0;
+    std::vector<uint64_t> lodLevelDraws;
     int32_t width, height;
     VkFramebuffer framebuffer;
     FrameBufferAttachment colorAttachment, depthAttachment;
@@ -66,26 +180,31 @@ class AppData
     ~AppData()
     {
         vkDestroyBuffer(device, indexBuffer, nullptr);
-        vkFreeMemory(device, indexMemory, nullptr);
+        allocator.free(indexMemory);
         vkDestroyBuffer(device, vertexBuffer, nullptr);
-        vkFreeMemory(device, vertexMemory, nullptr);
+        allocator.free(vertexMemory);
         vkDestroyImageView(device, colorAttachment.view, nullptr);
         vkDestroyImage(device, colorAttachment.image, nullptr);
-        vkFreeMemory(device, colorAttachment.memory, nullptr);
+        allocator.free(colorAttachment.memory);
         vkDestroyImageView(device, depthAttachment.view, nullptr);
         vkDestroyImage(device, depthAttachment.image, nullptr);
-        vkFreeMemory(device, depthAttachment.memory, nullptr);
+        allocator.free(depthAttachment.memory);
         vkDestroyRenderPass(device, renderPass, nullptr);
         vkDestroyFramebuffer(device, framebuffer, nullptr);
         vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
         vkDestroyPipeline(device, pipeline, nullptr);
-        vkDestroyPipelineCache(device, pipelineCache, nullptr);
-        vkDestroyCommandPool(device, commandPool, nullptr);
+        pipelineCache.destroy();
         for (auto shadermodule : shaderModules)
         {
-            vkDestroyShaderModule(device, shadermodule, nullptr);
+            shaderRegistry.release(shadermodule);
         }
+        shaderRegistry.destroy();
+        readback.destroy();
+        stagingRing.destroy();
+        transferContext.destroy();
+        submitContext.destroy();
+        allocator.destroy();
         vkDestroyDevice(device, nullptr);
 #if DEBUG
         if (debugReportCallback)
@@ -99,15 +218,35 @@ class AppData
     }
 };
 
-uint32_t getMemoryTypeIndex(AppData &appData, uint32_t typeBits, VkMemoryPropertyFlags properties);
 VkResult createBuffer(AppData &appData, BufferCreateInfo &bci);
-void submitWork(AppData &appData, VkCommandBuffer cmdBuffer, VkQueue queue);
+void submitWork(AppData &appData, VkCommandBuffer cmdBuffer);
 void setInstance(AppData &appData);
 void setDevice(AppData &appData);
 void setVertex(AppData &appData);
+bool setVertexCompute(AppData &appData);
+bool verifyComputeVertices(AppData &appData, const Vertex *gpuVertices);
 void setFramebufferAtta(AppData &appData);
 void setRenderPass(AppData &appData);
 void setPipeline(AppData &appData);
-void setCommand(AppData &appData);
+glm::mat4 getFrameMVP(AppData &appData, uint32_t frame);
+void setCommand(AppData &appData, uint32_t frame);
 void saveImage(AppData &appData);
-void buildVertex(std::vector<Vertex> &vertices, std::vector<Vertex> input, int cur, int target);
\ No newline at end of file
+void renderLoop(AppData &appData);
+std::vector<Vertex> getSeedTriangles();
+/** @brief Vertices buildVertex writes for one seed triangle, every level keeps 3 of the 4 sub-triangles */
+size_t subdividedVertexCount(int target);
+/** @brief Subdivide one triangle target times into subdividedVertexCount(target) vertices, without recursion */
+void buildVertex(Vertex *vertices, const Vertex *input, int target);
+/** @brief Subdivide every seed triangle on the thread pool, the output matches buildVertexRecursive bit for bit */
+void buildVertices(std::vector<Vertex> &vertices, const std::vector<Vertex> &seeds, int target, myvk::ThreadPool &threadPool);
+/** @brief Subdivide every seed triangle into unique vertices and a triangle list of indices into them
+ *  @note Midpoints are shared within a seed only, so seeds keep their own colors */
+void buildIndexedVertices(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, const std::vector<Vertex> &seeds, int target, myvk::ThreadPool &threadPool);
+/** @brief Reorder an indexed mesh for the vertex cache, overdraw and vertex fetch, unused vertices are dropped */
+void optimizeIndexedVertices(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+/** @brief Build every level up to subdivisionLevel into appData.vertices and indices, one draw range per level */
+void buildLodLevels(AppData &appData, std::vector<uint32_t> &indices);
+void drawLodObjects(AppData &appData, VkCommandBuffer commandBuffer, uint32_t frame);
+void getFrameCamera(AppData &appData, uint32_t frame, glm::mat4 &view, glm::mat4 &projection, glm::vec3 &eye);
+void buildVertexRecursive(std::vector<Vertex> &vertices, std::vector<Vertex> input, int cur, int target);
+void benchmarkSubdivision();
\ No newline at end of file
@@ -0,0 +1,122 @@
+/*
+* Texture converter
+*
+* Turns any image stb_image reads into a .mtex file with its full mip chain, optionally block compressed,
+* which texture --texture loads with no decode step
+*
+* usage: texconv input.jpg output.mtex [--compress bc1|bc3] [--no-mipmaps] [--linear] [--bench N]
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb-master/stb_image.h>
+
+#include "tools.hpp"
+#include "threadpool.hpp"
+#include "mipmap.hpp"
+#include "blockcompress.hpp"
+#include "texturefile.hpp"
+
+// load the source image and the converted file count times each, as a texture load would before its upload
+static void benchmarkLoad(const char *inputFile, const char *outputFile, uint32_t count)
+{
+    size_t decodedBytes = 0;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int width, height, channels;
+        stbi_uc *pixels = stbi_load(inputFile, &width, &height, &channels, STBI_rgb_alpha);
+        decodedBytes += pixels != nullptr ? static_cast<size_t>(width) * height * 4 : 0;
+        stbi_image_free(pixels);
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    // the copy stands in for the one into the staging ring
+    size_t copiedBytes = 0;
+    std::vector<char> staging;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        myvk::TextureFile textureFile;
+        if (textureFile.open(outputFile))
+        {
+            staging.resize(textureFile.getDataSize());
+            memcpy(staging.data(), textureFile.getData(), textureFile.getDataSize());
+            copiedBytes += textureFile.getDataSize();
+        }
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    double decodeMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+    double mapMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+    printf("%u loads, decoding %s: %.3f ms each, %.1f MB/s\n", count, inputFile, decodeMs / count, decodedBytes / (decodeMs * 1000.0));
+    printf("%u loads, mapping %s: %.3f ms each, %.1f MB/s\n", count, outputFile, mapMs / count, copiedBytes / (mapMs * 1000.0));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || argv[1][0] == '-' || argv[2][0] == '-')
+    {
+        printf("usage: texconv input.jpg output.mtex [--compress bc1|bc3] [--no-mipmaps] [--linear] [--bench N]\n");
+        return 1;
+    }
+    const char *inputFile = argv[1];
+    const char *outputFile = argv[2];
+    const char *compress = myvk::tools::getArgument(argc, argv, "--compress", static_cast<const char *>(nullptr));
+    bool mipmaps = !myvk::tools::hasArgument(argc, argv, "--no-mipmaps");
+    bool srgb = !myvk::tools::hasArgument(argc, argv, "--linear");
+    if (compress != nullptr && strcmp(compress, "bc1") != 0 && strcmp(compress, "bc3") != 0)
+    {
+        printf("Unknown --compress %s, use bc1 or bc3\n", compress);
+        return 1;
+    }
+
+    auto tStart = std::chrono::high_resolution_clock::now();
+    int width, height, channels;
+    stbi_uc *pixels = stbi_load(inputFile, &width, &height, &channels, STBI_rgb_alpha);
+    if (pixels == nullptr)
+    {
+        printf("Could not load image %s\n", inputFile);
+        return 1;
+    }
+
+    // the chain is resampled as a repeating texture, like the sampler of texture uses it
+    myvk::ThreadPool threadPool;
+    myvk::mipmap::MipChainLayout layout = myvk::mipmap::layoutChain(static_cast<uint32_t>(width), static_cast<uint32_t>(height), 4, mipmaps ? 0 : 1);
+    std::vector<unsigned char> chain(layout.size);
+    bool converted = myvk::mipmap::buildChain(pixels, layout, chain.data(), threadPool, srgb, true);
+    stbi_image_free(pixels);
+    if (converted && compress == nullptr)
+    {
+        converted = myvk::TextureFile::save(outputFile, VK_FORMAT_R8G8B8A8_UNORM, 4, 1, layout, chain.data());
+    }
+    else if (converted)
+    {
+        myvk::blockcompress::BlockFormat blockFormat = strcmp(compress, "bc3") == 0 ? myvk::blockcompress::BLOCK_FORMAT_BC3 : myvk::blockcompress::BLOCK_FORMAT_BC1;
+        myvk::mipmap::MipChainLayout blockLayout = myvk::blockcompress::layoutChain(layout, blockFormat);
+        std::vector<unsigned char> blocks(blockLayout.size);
+        double psnr = 0.0;
+        myvk::blockcompress::compressChain(chain.data(), layout, blocks.data(), blockLayout, blockFormat, threadPool, true, &psnr);
+        printf("Compressed to %s, PSNR %.2f dB\n", compress, psnr);
+        converted = myvk::TextureFile::save(outputFile, myvk::blockcompress::getVkFormat(blockFormat), myvk::blockcompress::getBlockSize(blockFormat), 4,
+                                            blockLayout, blocks.data());
+    }
+    if (!converted)
+    {
+        printf("Could not convert %s\n", inputFile);
+        return 1;
+    }
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    printf("Wrote %s, %dx%d with %zu levels in %.3f ms\n", outputFile, width, height, layout.levels.size(),
+           std::chrono::duration<double, std::milli>(tEnd - tStart).count());
+
+    if (myvk::tools::hasArgument(argc, argv, "--bench"))
+    {
+        benchmarkLoad(inputFile, outputFile, std::max(myvk::tools::getArgument(argc, argv, "--bench", 1000u), 1u));
+    }
+    return 0;
+}
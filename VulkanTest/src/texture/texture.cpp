@@ -15,24 +15,6 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugMessageCallback(
     return VK_FALSE;
 }
 
-uint32_t Application::getMemoryTypeIndex(uint32_t typeBits, VkMemoryPropertyFlags properties)
-{
-    VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
-    for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; i++)
-    {
-        if ((typeBits & 1) == 1)
-        {
-            if ((deviceMemoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
-            {
-                return i;
-            }
-        }
-        typeBits >>= 1;
-    }
-    return 0;
-}
-
 VkResult Application::createBuffer(BufferCreateInfo &bci)
 {
     // create the buffer handle
@@ -40,23 +22,18 @@ VkResult Application::createBuffer(BufferCreateInfo &bci)
     bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &bci.buffer));
 
-    // create the memory backing up the buffer handle
+    // sub-allocate the memory backing up the buffer handle
     VkMemoryRequirements memReqs;
-    VkMemoryAllocateInfo memAlloc = myvk::initializers::memoryAllocateInfo();
     vkGetBufferMemoryRequirements(device, bci.buffer, &memReqs);
-    memAlloc.allocationSize = memReqs.size;
-    memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, bci.memoryPropertyFlags);
-    VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &bci.memory));
+    VK_CHECK_RESULT(allocator.allocate(memReqs, bci.memoryUsage, myvk::ALLOCATION_TILING_LINEAR, bci.memory));
 
+    // host visible memory is persistently mapped by the allocator
     if (bci.data != nullptr)
     {
-        void *mapped;
-        VK_CHECK_RESULT(vkMapMemory(device, bci.memory, 0, bci.size, 0, &mapped));
-        memcpy(mapped, bci.data, bci.size);
-        vkUnmapMemory(device, bci.memory);
+        memcpy(bci.memory.mapped, bci.data, bci.size);
     }
 
-    VK_CHECK_RESULT(vkBindBufferMemory(device, bci.buffer, bci.memory, 0));
+    VK_CHECK_RESULT(vkBindBufferMemory(device, bci.buffer, bci.memory.memory, bci.memory.offset));
 
     return VK_SUCCESS;
 }
@@ -68,7 +45,7 @@ VkResult Application::createImage(ImageCreateInfo &ici)
     imageInfo.extent.width = ici.width;
     imageInfo.extent.height = ici.height;
     imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
+    imageInfo.mipLevels = ici.mipLevels;
     imageInfo.arrayLayers = 1;
     imageInfo.format = ici.format;
     imageInfo.tiling = ici.tiling;
@@ -79,18 +56,16 @@ VkResult Application::createImage(ImageCreateInfo &ici)
     VK_CHECK_RESULT(vkCreateImage(device, &imageInfo, nullptr, &ici.image));
 
     VkMemoryRequirements memReqs;
-    VkMemoryAllocateInfo memAlloc = myvk::initializers::memoryAllocateInfo();
     vkGetImageMemoryRequirements(device, ici.image, &memReqs);
-    memAlloc.allocationSize = memReqs.size;
-    memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, ici.properties);
-    VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &ici.memory));
+    myvk::AllocationTiling tiling = ici.tiling == VK_IMAGE_TILING_LINEAR ? myvk::ALLOCATION_TILING_LINEAR : myvk::ALLOCATION_TILING_OPTIMAL;
+    VK_CHECK_RESULT(allocator.allocate(memReqs, ici.memoryUsage, tiling, ici.memory));
 
-    VK_CHECK_RESULT(vkBindImageMemory(device, ici.image, ici.memory, 0));
+    VK_CHECK_RESULT(vkBindImageMemory(device, ici.image, ici.memory.memory, ici.memory.offset));
 
     return VK_SUCCESS;
 }
 
-VkResult Application::createImageView(VkImage &image, VkFormat format, VkImageView &imageView)
+VkResult Application::createImageView(VkImage &image, VkFormat format, VkImageView &imageView, uint32_t baseMipLevel, uint32_t levelCount)
 {
     VkImageViewCreateInfo viewInfo = {};
     viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -98,8 +73,8 @@ VkResult Application::createImageView(VkImage &image, VkFormat format, VkImageVi
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
     viewInfo.format = format;
     viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+    viewInfo.subresourceRange.levelCount = levelCount;
     viewInfo.subresourceRange.baseArrayLayer = 0;
     viewInfo.subresourceRange.layerCount = 1;
 
@@ -125,141 +100,19 @@ VkResult Application::createSampler(VkSampler &sampler)
     samplerInfo.compareEnable = VK_FALSE;
     samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    // every level of the view, it decides how many there are
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
 
     VK_CHECK_RESULT(vkCreateSampler(device, &samplerInfo, nullptr, &sampler));
 
     return VK_SUCCESS;
 }
 
-// submit command buffer to a queue and wait until finished
-void Application::submitWork(VkCommandBuffer &cmdBuffer, VkQueue &queue)
-{
-    VkSubmitInfo submitInfo = myvk::initializers::submitInfo();
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmdBuffer;
-    VkFenceCreateInfo fenceInfo = myvk::initializers::fenceCreateInfo();
-    VkFence fence;
-    VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
-    VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, fence));
-    VK_CHECK_RESULT(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
-    vkDestroyFence(device, fence, nullptr);
-}
-
-VkCommandBuffer Application::beginSingleTimeCommands()
-{
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer));
-
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
-
-    return commandBuffer;
-}
-
-void Application::endSingleTimeCommands(VkCommandBuffer &cmdBuffer, VkQueue &q)
-{
-    VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffer));
-
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmdBuffer;
-
-    VK_CHECK_RESULT(vkQueueSubmit(q, 1, &submitInfo, VK_NULL_HANDLE));
-    VK_CHECK_RESULT(vkQueueWaitIdle(q));
-    vkFreeCommandBuffers(device, commandPool, 1, &cmdBuffer);
-}
-
-void Application::copyBuffer(VkBuffer &src, VkBuffer &dst, VkDeviceSize size)
-{
-    VkCommandBuffer cmdBuffer = beginSingleTimeCommands();
-
-    VkBufferCopy copyRegion = {};
-    copyRegion.size = size;
-    vkCmdCopyBuffer(cmdBuffer, src, dst, 1, &copyRegion);
-
-    endSingleTimeCommands(cmdBuffer, queue);
-}
-
-void Application::copyBufferToImage(VkBuffer &src, VkImage &dst, uint32_t width, uint32_t height)
-{
-    VkCommandBuffer cmdBuffer = beginSingleTimeCommands();
-
-    VkBufferImageCopy region = {};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {width, height, 1};
-    vkCmdCopyBufferToImage(cmdBuffer, src, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    endSingleTimeCommands(cmdBuffer, queue);
-}
-
-void Application::transitionImageLayout(VkImage &image, VkImageLayout oldLayout, VkImageLayout newLayout)
+// submit a command buffer from the submit context and wait until finished
+void Application::submitWork(VkCommandBuffer cmdBuffer)
 {
-    VkCommandBuffer cmdBuffer = beginSingleTimeCommands();
-
-    VkImageMemoryBarrier barrier = {};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-
-    VkPipelineStageFlags srcStage;
-    VkPipelineStageFlags dstStage;
-
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-    {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-        srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    }
-    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-    {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    }
-    else
-    {
-        std::cout << "unsupport layout transition" << std::endl;
-        exit(1);
-    }
-
-    vkCmdPipelineBarrier(
-        cmdBuffer,
-        srcStage, dstStage,
-        0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier);
-
-    endSingleTimeCommands(cmdBuffer, queue);
+    submitContext.wait(submitContext.submit(cmdBuffer));
 }
 
 void Application::setInstance()
@@ -345,7 +198,7 @@ void Application::setDevice()
     vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
     printf("GPU: %s\n", deviceProperties.deviceName);
 
-    // request a single graphics queue
+    // request a graphics queue and a transfer queue from another family if there is one
     const float defaultQueuePriority(0.0f);
     VkDeviceQueueCreateInfo queueCreateInfo = {};
     uint32_t queueFamilyCount;
@@ -364,37 +217,86 @@ void Application::setDevice()
             break;
         }
     }
+    std::vector<VkDeviceQueueCreateInfo> queueCreateInfos{queueCreateInfo};
+    transferQueueFamilyIndex = myvk::tools::getTransferQueueFamilyIndex(queueFamilyProperties, queueFamilyIndex);
+    if (transferQueueFamilyIndex != queueFamilyIndex)
+    {
+        queueCreateInfo.queueFamilyIndex = transferQueueFamilyIndex;
+        queueCreateInfos.push_back(queueCreateInfo);
+    }
     // create logical device
     // here needs to use anisotropic filtering
     VkPhysicalDeviceFeatures deviceFeatures = {};
     deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+    // heap budgets are queried through vkGetPhysicalDeviceMemoryProperties2, core since 1.1
+    std::vector<const char *> deviceExtensions;
+    bool memoryBudget = deviceProperties.apiVersion >= VK_API_VERSION_1_1 &&
+                        myvk::tools::deviceExtensionSupported(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    if (memoryBudget)
+    {
+        deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+
     VkDeviceCreateInfo deviceCreateInfo = {};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+    deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+    deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+    deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+    deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
     VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device));
 
     // get a graphics queue
     vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
 
-    // command pool
-    VkCommandPoolCreateInfo cmdPoolInfo = {};
-    cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    cmdPoolInfo.queueFamilyIndex = queueFamilyIndex;
-    cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &commandPool));
+    // recycled command buffers and fences for the graphics queue
+    submitContext.create(device, queue, queueFamilyIndex);
+    myvk::SubmitContext *uploadContext = &submitContext;
+    if (transferQueueFamilyIndex != queueFamilyIndex)
+    {
+        vkGetDeviceQueue(device, transferQueueFamilyIndex, 0, &transferQueue);
+        transferContext.create(device, transferQueue, transferQueueFamilyIndex);
+        uploadContext = &transferContext;
+        printf("Uploads on transfer queue family %u\n", transferQueueFamilyIndex);
+    }
+    else
+    {
+        transferQueue = queue;
+    }
+
+    // device memory allocator, every buffer and image is bound to memory from it
+    allocator.create(instance, physicalDevice, device, memoryBudget);
+
+    // all uploads go through one persistently mapped staging buffer, copied on the transfer queue
+    stagingRing.create(physicalDevice, device, allocator, *uploadContext);
+
+    // shader modules are shared by every pipeline using the same SPIR-V
+    shaderRegistry.create(device);
+
+    // reuse the pipelines compiled by earlier runs on this device, opened here since setTexture may build a compute pipeline
+    pipelineCache.create(physicalDevice, device, "./out/texture.pipelinecache");
 }
 
 void Application::setTexture()
 {
+    // .mtex files are ready for the GPU and skip everything below
+    size_t nameLength = strlen(textureFile);
+    if (nameLength > 5 && strcmp(textureFile + nameLength - 5, ".mtex") == 0)
+    {
+        if (setTextureFile())
+        {
+            return;
+        }
+        printf("Could not use %s, loading %s\n", textureFile, DEFAULT_TEXTURE_FILE);
+        textureFile = DEFAULT_TEXTURE_FILE;
+    }
+
     // load pic from file
     // calculate its size
     int texWidth, texHeight, texChannels;
-    stbi_uc *pixels = stbi_load("./assets/textures/pic1.jpg", &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    stbi_uc *pixels = stbi_load(textureFile, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
 
     if (!pixels)
     {
@@ -402,51 +304,390 @@ void Application::setTexture()
         exit(1);
     }
 
-    // create staging buffer and cp image data
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
-
-    BufferCreateInfo bcisrc{
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingBuffer,
-        stagingMemory,
-        imageSize,
-        pixels};
-
-    createBuffer(bcisrc);
+    // --compress bc1|bc3 stores the texture block compressed if the device can sample the format
+    bool compress = false;
+    myvk::blockcompress::BlockFormat blockFormat = myvk::blockcompress::BLOCK_FORMAT_BC1;
+    if (compressTexture != nullptr && strcmp(compressTexture, "bc1") != 0 && strcmp(compressTexture, "bc3") != 0)
+    {
+        printf("Unknown --compress %s, use bc1 or bc3. Uploading uncompressed\n", compressTexture);
+    }
+    else if (compressTexture != nullptr)
+    {
+        blockFormat = strcmp(compressTexture, "bc3") == 0 ? myvk::blockcompress::BLOCK_FORMAT_BC3 : myvk::blockcompress::BLOCK_FORMAT_BC1;
+        VkFormatProperties blockProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, myvk::blockcompress::getVkFormat(blockFormat), &blockProperties);
+        const VkFormatFeatureFlags sampleFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        compress = (blockProperties.optimalTilingFeatures & sampleFeatures) == sampleFeatures;
+        if (!compress)
+        {
+            printf("The device can't sample %s textures, uploading uncompressed\n", compressTexture);
+        }
+    }
+    textureFormat = compress ? myvk::blockcompress::getVkFormat(blockFormat) : VK_FORMAT_R8G8B8A8_UNORM;
+
+    // a full mip chain. Levels below 0 are blitted on the GPU if the format allows linear filtering, otherwise a
+    // compute shader does the same with storage images. Without the shader, with --cpu-mipmaps or for compressed
+    // textures the CPU builds them
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+    const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    bool blit = !compress && !computeMipmaps && !cpuMipmaps && (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+    VkShaderModule downsampleModule = VK_NULL_HANDLE;
+    if (!compress && !blit && !cpuMipmaps && (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) &&
+        myvk::tools::fileExists(ASSET_PATH "shaders/texture/downsample.comp.spv"))
+    {
+        downsampleModule = shaderRegistry.acquire(ASSET_PATH "shaders/texture/downsample.comp.spv");
+    }
+    bool compute = downsampleModule != VK_NULL_HANDLE;
+    if (!compress && !blit && !compute && !cpuMipmaps)
+    {
+        printf("No linear blits and downsample.comp is not built or can't write the format, run make shaders. Building mipmaps on the CPU\n");
+    }
+    textureMipLevels = myvk::mipmap::getLevelCount(static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
 
-    // create image object
+    // create image object, the GPU paths read level 0 with blits or write the levels as storage images
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if (blit)
+    {
+        usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    if (compute)
+    {
+        usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+    }
     ImageCreateInfo icidst{
         static_cast<uint32_t>(texWidth),
         static_cast<uint32_t>(texHeight),
-        VK_FORMAT_R8G8B8A8_UNORM,
+        textureFormat,
         VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        usage,
+        myvk::MEMORY_USAGE_GPU_ONLY,
         textureImage,
-        textureImageMemory};
+        textureImageMemory,
+        textureMipLevels};
 
     createImage(icidst);
 
-    // transfer the layout of image
-    transitionImageLayout(textureImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-    transitionImageLayout(textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingMemory, nullptr);
+    // copy the pixels and transfer the layout in one submission, the graphics queue waits for it on its own.
+    // The fill callbacks run in submit, so everything they use lives until then
+    myvk::UploadBatch uploadBatch(stagingRing, submitContext);
+    myvk::mipmap::MipChainLayout layout = myvk::mipmap::layoutChain(static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 4);
+    myvk::mipmap::MipChainLayout blockLayout;
+    myvk::mipmap::ChainBuilder chainBuilder(pixels, layout, threadPool, true, true);
+    double buildMs = 0.0;
+    double compressMs = 0.0;
+    double squaredError = 0.0;
+    // levels are resampled as the upload gets to them, only the last two are held in host memory. The sampler repeats
+    auto getLevel = [&](uint32_t level) {
+        auto tStart = std::chrono::high_resolution_clock::now();
+        const unsigned char *texels = chainBuilder.getLevel(level);
+        if (texels == nullptr)
+        {
+            std::cout << "failed to build texture mipmaps!" << std::endl;
+            exit(1);
+        }
+        buildMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+        return texels;
+    };
+    if (blit || compute)
+    {
+        uploadBatch.addImage(textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 4, pixels,
+                             textureMipLevels > 1 ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+    else if (!compress)
+    {
+        // the rows of every level are copied straight into staging memory
+        uploadBatch.addImage(textureImage, textureMipLevels, 4, layout.size, myvk::mipmap::copyRegions(layout),
+                             [&](uint32_t level, uint32_t firstRow, uint32_t rowCount, void *mapped) {
+            size_t rowSize = static_cast<size_t>(layout.levels[level].width) * 4;
+            memcpy(mapped, getLevel(level) + firstRow * rowSize, rowCount * rowSize);
+        }, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+    else
+    {
+        // the blocks of every level are compressed straight into staging memory
+        blockLayout = myvk::blockcompress::layoutChain(layout, blockFormat);
+        uploadBatch.addImage(textureImage, textureMipLevels, myvk::blockcompress::getBlockSize(blockFormat), blockLayout.size,
+                             myvk::mipmap::copyRegions(blockLayout), [&](uint32_t level, uint32_t firstRow, uint32_t rowCount, void *mapped) {
+            const unsigned char *texels = getLevel(level);
+            auto tStart = std::chrono::high_resolution_clock::now();
+            double error = 0.0;
+            myvk::blockcompress::compressRows(texels, layout.levels[level], firstRow, rowCount, mapped, blockFormat, threadPool, false,
+                                              level == 0 ? &error : nullptr);
+            squaredError += error;
+            compressMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+        }, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 4);
+    }
+    uploadBatch.submit();
     stbi_image_free(pixels);
 
-    // create image view
-    createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, textureImageView);
+    if (textureMipLevels > 1 && blit)
+    {
+        blitMipmaps(textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), textureMipLevels);
+    }
+    else if (textureMipLevels > 1 && compute)
+    {
+        downsampleMipmaps(textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), textureMipLevels, downsampleModule);
+    }
+    else if (compute)
+    {
+        shaderRegistry.release(downsampleModule);
+    }
+    if (blit || compute)
+    {
+        printf("Texture %dx%d with %u mip levels, downsampled by %s\n", texWidth, texHeight, textureMipLevels, blit ? "blits" : "compute");
+    }
+    else
+    {
+        printf("Texture %dx%d with %u mip levels, built on %u threads in %.3f ms\n", texWidth, texHeight, textureMipLevels,
+               threadPool.getThreadCount(), buildMs);
+    }
+    if (compress)
+    {
+        // throughput over the texels of all levels, the image memory is compared with the uncompressed chain
+        double texels = 0.0;
+        for (const auto &level : layout.levels)
+        {
+            texels += static_cast<double>(level.width) * level.height;
+        }
+        double megabyte = 1024.0 * 1024.0;
+        double psnr = myvk::blockcompress::getPsnr(squaredError, layout.levels[0].width, layout.levels[0].height, blockFormat);
+        printf("Compressed to %s in %.3f ms, %.1f Mtexels/s, PSNR %.2f dB\n", compressTexture, compressMs, texels / (compressMs * 1000.0), psnr);
+        printf("Texture memory %.2f MB instead of %.2f MB, %.2f MB saved\n", textureImageMemory.size / megabyte, layout.size / megabyte,
+               (static_cast<double>(layout.size) - textureImageMemory.size) / megabyte);
+    }
+
+    // create image view over the whole chain
+    createImageView(textureImage, textureFormat, textureImageView, 0, textureMipLevels);
 
     // create sampler
     createSampler(textureSampler);
 }
 
+// the levels are copied from the mapped file into staging memory and on to the image, with no decode, resampling or compression
+bool Application::setTextureFile()
+{
+    auto tStart = std::chrono::high_resolution_clock::now();
+    myvk::TextureFile file;
+    if (!file.open(textureFile))
+    {
+        return false;
+    }
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, file.getFormat(), &formatProperties);
+    const VkFormatFeatureFlags sampleFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    if ((formatProperties.optimalTilingFeatures & sampleFeatures) != sampleFeatures)
+    {
+        printf("The device can't sample the format of %s\n", textureFile);
+        return false;
+    }
+    textureFormat = file.getFormat();
+    textureMipLevels = file.getLevelCount();
+
+    ImageCreateInfo icidst{
+        file.getWidth(),
+        file.getHeight(),
+        textureFormat,
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        myvk::MEMORY_USAGE_GPU_ONLY,
+        textureImage,
+        textureImageMemory,
+        textureMipLevels};
+
+    createImage(icidst);
+
+    myvk::UploadBatch uploadBatch(stagingRing, submitContext);
+    // the levels go from the mapping into the staging ring one by one
+    uploadBatch.addImage(textureImage, textureMipLevels, file.getTexelSize(), file.getCopyRegions(), file.getData(),
+                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, file.getBlockExtent());
+    uploadBatch.submit();
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+    printf("Texture %ux%u with %u mip levels, %.2f MB loaded from %s in %.3f ms\n", file.getWidth(), file.getHeight(), textureMipLevels,
+           file.getDataSize() / (1024.0 * 1024.0), textureFile, loadMs);
+
+    createImageView(textureImage, textureFormat, textureImageView, 0, textureMipLevels);
+    createSampler(textureSampler);
+    return true;
+}
+
+// every level is blitted from the one above with a linear filter, level 0 is in TRANSFER_SRC_OPTIMAL from the upload
+void Application::blitMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+    VkCommandBuffer commandBuffer = submitContext.begin();
+
+    VkImageMemoryBarrier barrier = myvk::initializers::imageMemoryBarrier();
+    barrier.image = image;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 1, mipLevels - 1, 0, 1};
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    int32_t srcWidth = static_cast<int32_t>(width);
+    int32_t srcHeight = static_cast<int32_t>(height);
+    for (uint32_t level = 1; level < mipLevels; level++)
+    {
+        int32_t dstWidth = std::max(srcWidth / 2, 1);
+        int32_t dstHeight = std::max(srcHeight / 2, 1);
+        VkImageBlit region = {};
+        region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1};
+        region.srcOffsets[1] = {srcWidth, srcHeight, 1};
+        region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+        region.dstOffsets[1] = {dstWidth, dstHeight, 1};
+        vkCmdBlitImage(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+
+        // the level just written is the source of the next blit
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        srcWidth = dstWidth;
+        srcHeight = dstHeight;
+    }
+
+    // all levels are in TRANSFER_SRC_OPTIMAL now
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1};
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // later submissions on the graphics queue are ordered behind the barriers, no need to wait here
+    submitContext.submit(commandBuffer);
+}
+
+// same chain with a 2x2 box filter in downsample.comp, one dispatch per level reading the level above as storage image
+void Application::downsampleMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, VkShaderModule shaderModule)
+{
+    std::vector<VkImageView> levelViews(mipLevels);
+    for (uint32_t level = 0; level < mipLevels; level++)
+    {
+        VK_CHECK_RESULT(createImageView(image, VK_FORMAT_R8G8B8A8_UNORM, levelViews[level], level, 1));
+    }
+
+    std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+        myvk::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+        myvk::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_SHADER_STAGE_COMPUTE_BIT, 1)};
+    VkDescriptorSetLayoutCreateInfo descriptorLayout = myvk::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings);
+    VkDescriptorSetLayout downsampleSetLayout;
+    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &downsampleSetLayout));
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = myvk::initializers::pipelineLayoutCreateInfo(&downsampleSetLayout, 1);
+    VkPipelineLayout downsampleLayout;
+    VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &downsampleLayout));
+
+    // one set per destination level
+    std::vector<VkDescriptorPoolSize> poolSizes = {
+        myvk::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 2 * (mipLevels - 1))};
+    VkDescriptorPoolCreateInfo descriptorPoolInfo = myvk::initializers::descriptorPoolCreateInfo(poolSizes, mipLevels - 1);
+    VkDescriptorPool downsamplePool;
+    VK_CHECK_RESULT(vkCreateDescriptorPool(device, &descriptorPoolInfo, nullptr, &downsamplePool));
+    std::vector<VkDescriptorSetLayout> setLayouts(mipLevels - 1, downsampleSetLayout);
+    std::vector<VkDescriptorSet> descriptorSets(mipLevels - 1);
+    VkDescriptorSetAllocateInfo allocInfo = myvk::initializers::descriptorSetAllocateInfo(downsamplePool, setLayouts.data(), mipLevels - 1);
+    VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()));
+    for (uint32_t level = 1; level < mipLevels; level++)
+    {
+        VkDescriptorImageInfo imageInfos[2] = {
+            myvk::initializers::descriptorImageInfo(VK_NULL_HANDLE, levelViews[level - 1], VK_IMAGE_LAYOUT_GENERAL),
+            myvk::initializers::descriptorImageInfo(VK_NULL_HANDLE, levelViews[level], VK_IMAGE_LAYOUT_GENERAL)};
+        std::vector<VkWriteDescriptorSet> descriptorWrites = {
+            myvk::initializers::writeDescriptorSet(descriptorSets[level - 1], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &imageInfos[0]),
+            myvk::initializers::writeDescriptorSet(descriptorSets[level - 1], VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, &imageInfos[1])};
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    VkComputePipelineCreateInfo computePipelineCreateInfo = myvk::initializers::computePipelineCreateInfo(downsampleLayout);
+    computePipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computePipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computePipelineCreateInfo.stage.module = shaderModule;
+    computePipelineCreateInfo.stage.pName = "main";
+    VkPipeline downsamplePipeline;
+    VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache.get(), 1, &computePipelineCreateInfo, nullptr, &downsamplePipeline));
+
+    VkCommandBuffer commandBuffer = submitContext.begin();
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downsamplePipeline);
+
+    // level 0 comes from the upload in TRANSFER_SRC_OPTIMAL, the others hold nothing yet
+    VkImageMemoryBarrier barriers[2] = {myvk::initializers::imageMemoryBarrier(), myvk::initializers::imageMemoryBarrier()};
+    barriers[0].image = image;
+    barriers[0].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barriers[1].image = image;
+    barriers[1].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 1, mipLevels - 1, 0, 1};
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[1].srcAccessMask = 0;
+    barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 2, barriers);
+
+    VkImageMemoryBarrier barrier = myvk::initializers::imageMemoryBarrier();
+    barrier.image = image;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    for (uint32_t level = 1; level < mipLevels; level++)
+    {
+        uint32_t dstWidth = std::max(width >> level, 1u);
+        uint32_t dstHeight = std::max(height >> level, 1u);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, downsampleLayout, 0, 1, &descriptorSets[level - 1], 0, nullptr);
+        vkCmdDispatch(commandBuffer, (dstWidth + 7) / 8, (dstHeight + 7) / 8, 1);
+
+        // the level just written is read by the next dispatch
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1};
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // the per level views and sets are only needed until the dispatches finished
+    submitWork(commandBuffer);
+
+    vkDestroyPipeline(device, downsamplePipeline, nullptr);
+    shaderRegistry.release(shaderModule);
+    vkDestroyDescriptorPool(device, downsamplePool, nullptr);
+    vkDestroyPipelineLayout(device, downsampleLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, downsampleSetLayout, nullptr);
+    for (VkImageView view : levelViews)
+    {
+        vkDestroyImageView(device, view, nullptr);
+    }
+}
+
+// quantize into the packed layout, the scale goes back in through the model matrix
+static void packVertices(const Vertex *src, size_t count, float positionScale, bool halfTexCoords, PackedVertex *dst)
+{
+    myvk::vertexformat::encodeSnorm16x4(src[0].pos, sizeof(Vertex), count, positionScale, dst[0].pos, sizeof(PackedVertex));
+    myvk::vertexformat::encodeUnorm8x4(src[0].color, sizeof(Vertex), count, dst[0].color, sizeof(PackedVertex));
+    if (halfTexCoords)
+    {
+        myvk::vertexformat::encodeHalf2(src[0].texCoord, sizeof(Vertex), count, dst[0].texCoord, sizeof(PackedVertex));
+    }
+    else
+    {
+        myvk::vertexformat::encodeUnorm16x2(src[0].texCoord, sizeof(Vertex), count, dst[0].texCoord, sizeof(PackedVertex));
+    }
+}
+
 void Application::setVertex()
 {
+    if (meshFile != nullptr && setMesh())
+    {
+        return;
+    }
+
     std::vector<Vertex> vs = {
         {{0.0f, 0.0f, 1.0f}, {0.0f, 0.0f, 0.0f}, {0.0f, 1.0f}},
         {{0.0f, 1.0f, 1.0f}, {0.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
@@ -469,32 +710,235 @@ void Application::setVertex()
     };
 
     vertices = vs;
+    vertexCount = static_cast<uint32_t>(vertices.size());
     VkDeviceSize vertexBufferSize = vertices.size() * sizeof(Vertex);
+    const void *vertexData = vertices.data();
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingMemory;
-
-    BufferCreateInfo bcisrc{
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        stagingBuffer,
-        stagingMemory,
-        vertexBufferSize,
-        vertices.data()};
-    createBuffer(bcisrc);
+    std::vector<PackedVertex> packed;
+    if (packedVertices)
+    {
+        packed.resize(vertices.size());
+        positionScale = myvk::vertexformat::maxAbsolute3(vertices[0].pos, sizeof(Vertex), vertices.size());
+        packVertices(vertices.data(), vertices.size(), positionScale, halfTexCoords, packed.data());
+        vertexBufferSize = packed.size() * sizeof(PackedVertex);
+        vertexData = packed.data();
+    }
 
     BufferCreateInfo bcidst{
         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        myvk::MEMORY_USAGE_GPU_ONLY,
         vertexBuffer,
         vertexMemory,
         vertexBufferSize};
     createBuffer(bcidst);
 
-    copyBuffer(stagingBuffer, vertexBuffer, vertexBufferSize);
+    myvk::UploadBatch uploadBatch(stagingRing, submitContext);
+    uploadBatch.addBuffer(vertexBuffer, 0, vertexData, vertexBufferSize);
+    uploadBatch.submit();
+}
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingMemory, nullptr);
+// load the mesh file and write its vertices straight into staging memory, false falls back to the cube
+bool Application::setMesh()
+{
+    myvk::Mesh mesh;
+    auto tStart = std::chrono::high_resolution_clock::now();
+    if (!mesh.load(meshFile, threadPool))
+    {
+        printf("Drawing the cube instead\n");
+        return false;
+    }
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    printf("Loaded %s: %u vertices, %u triangles in %.3f s on %u threads\n", meshFile, mesh.getVertexCount(), mesh.getIndexCount() / 3,
+           std::chrono::duration<double>(tEnd - tStart).count(), threadPool.getThreadCount());
+    if (optimizeVertexCache)
+    {
+        myvk::vertexcache::CacheStats before = myvk::vertexcache::analyze(mesh.getIndices(), mesh.getVertexCount());
+        tStart = std::chrono::high_resolution_clock::now();
+        mesh.optimize();
+        tEnd = std::chrono::high_resolution_clock::now();
+        myvk::vertexcache::CacheStats after = myvk::vertexcache::analyze(mesh.getIndices(), mesh.getVertexCount());
+        printf("Vertex cache (%u entries): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f in %.3f s\n", VERTEX_CACHE_SIZE,
+               before.acmr, after.acmr, before.atvr, after.atvr, std::chrono::duration<double>(tEnd - tStart).count());
+    }
+    if (saveMeshFile != nullptr && mesh.saveBinary(saveMeshFile))
+    {
+        printf("Mesh saved to %s\n", saveMeshFile);
+    }
+
+    // fit the mesh into the unit cube the camera looks at
+    float boundsMin[3], boundsMax[3];
+    mesh.getBounds(boundsMin, boundsMax);
+    float extent = std::max({boundsMax[0] - boundsMin[0], boundsMax[1] - boundsMin[1], boundsMax[2] - boundsMin[2], 1e-6f});
+    meshModel = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f / extent)) *
+                glm::translate(glm::mat4(1.0f), glm::vec3(-boundsMin[0], -boundsMin[1], -boundsMin[2]));
+    positionScale = 0.0f;
+    for (int i = 0; i < 3; i++)
+    {
+        positionScale = std::max({positionScale, std::fabs(boundsMin[i]), std::fabs(boundsMax[i])});
+    }
+
+    vertexCount = mesh.getVertexCount();
+    indexCount = mesh.getIndexCount();
+    VkDeviceSize vertexStride = packedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
+    BufferCreateInfo vertexInfo{
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        myvk::MEMORY_USAGE_GPU_ONLY,
+        vertexBuffer,
+        vertexMemory,
+        vertexCount * vertexStride};
+    createBuffer(vertexInfo);
+    BufferCreateInfo indexInfo{
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        myvk::MEMORY_USAGE_GPU_ONLY,
+        indexBuffer,
+        indexMemory,
+        indexCount * sizeof(uint32_t)};
+    createBuffer(indexInfo);
+
+    // the color attribute carries the normal, attributes missing from the file are 0
+    myvk::MeshVertexLayout layout;
+    layout.stride = sizeof(Vertex);
+    layout.positionOffset = offsetof(Vertex, pos);
+    layout.normalOffset = offsetof(Vertex, color);
+    layout.texCoordOffset = offsetof(Vertex, texCoord);
+
+    // every chunk of staging memory is filled in place, only packed vertices go through a small float buffer first
+    myvk::UploadBatch uploadBatch(stagingRing, submitContext);
+    uploadBatch.addBuffer(vertexBuffer, 0, vertexCount * vertexStride, vertexStride, [&](void *mapped, VkDeviceSize offset, VkDeviceSize size) {
+        uint32_t first = static_cast<uint32_t>(offset / vertexStride);
+        uint32_t count = static_cast<uint32_t>(size / vertexStride);
+        if (!packedVertices)
+        {
+            mesh.writeVertices(mapped, layout, first, count);
+            return;
+        }
+        std::vector<Vertex> scratch(std::min(count, 4096u));
+        PackedVertex *packed = static_cast<PackedVertex *>(mapped);
+        for (uint32_t i = 0; i < count; i += static_cast<uint32_t>(scratch.size()))
+        {
+            uint32_t blockCount = std::min(count - i, static_cast<uint32_t>(scratch.size()));
+            mesh.writeVertices(scratch.data(), layout, first + i, blockCount);
+            packVertices(scratch.data(), blockCount, positionScale, halfTexCoords, packed + i);
+        }
+    });
+    uploadBatch.addBuffer(indexBuffer, 0, mesh.getIndices().data(), indexCount * sizeof(uint32_t));
+    auto tUpload = std::chrono::high_resolution_clock::now();
+    uploadBatch.submit();
+    printf("Streamed %.1f MB of vertices and indices through staging in %.3f s\n",
+           (vertexCount * vertexStride + indexCount * sizeof(uint32_t)) / (1024.0 * 1024.0),
+           std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tUpload).count());
+    return true;
+}
+
+// lay count cubes out on a cubic grid of the given extent around center, one SSE vector per instance
+static void fillInstanceGrid(InstanceData *instances, uint32_t count, glm::vec3 center, float extent, float instanceScale)
+{
+    uint32_t side = 1;
+    while (side * side * side < count)
+    {
+        side++;
+    }
+    float spacing = extent / side;
+    float cubeSize = spacing * 0.5f;
+    // the cube mesh spans [0, 1], so shift every cube into the middle of its cell
+    glm::vec3 origin = center - glm::vec3(extent * 0.5f) + glm::vec3((spacing - cubeSize) * 0.5f);
+    uint32_t x = 0, y = 0, z = 0;
+#if defined(__SSE2__)
+    const __m128 step = _mm_setr_ps(spacing, spacing, spacing, 0.0f);
+    const __m128 base = _mm_setr_ps(origin.x, origin.y, origin.z, cubeSize * instanceScale);
+#endif
+    for (uint32_t i = 0; i < count; i++)
+    {
+#if defined(__SSE2__)
+        __m128 cell = _mm_cvtepi32_ps(_mm_setr_epi32(x, y, z, 0));
+        _mm_storeu_ps(instances[i].offsetScale, _mm_add_ps(_mm_mul_ps(cell, step), base));
+#else
+        instances[i].offsetScale[0] = origin.x + x * spacing;
+        instances[i].offsetScale[1] = origin.y + y * spacing;
+        instances[i].offsetScale[2] = origin.z + z * spacing;
+        instances[i].offsetScale[3] = cubeSize * instanceScale;
+#endif
+        if (++x == side)
+        {
+            x = 0;
+            if (++y == side)
+            {
+                y = 0;
+                z++;
+            }
+        }
+    }
+}
+
+void Application::setInstances()
+{
+    if (instanceCount == 0)
+    {
+        return;
+    }
+
+    // packed positions are normalized, their scale is folded into every instance
+    instances.resize(instanceCount);
+    auto tStart = std::chrono::high_resolution_clock::now();
+    fillInstanceGrid(instances.data(), instanceCount, glm::vec3(0.2f, 0.2f, 0.0f), 1.6f, packedVertices ? positionScale : 1.0f);
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    printf("Filled %u instance transforms in %.3f ms\n", instanceCount, std::chrono::duration<double, std::milli>(tEnd - tStart).count());
+
+    VkDeviceSize instanceBufferSize = instances.size() * sizeof(InstanceData);
+    BufferCreateInfo bcidst{
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        myvk::MEMORY_USAGE_GPU_ONLY,
+        instanceBuffer,
+        instanceMemory,
+        instanceBufferSize};
+    createBuffer(bcidst);
+
+    myvk::UploadBatch uploadBatch(stagingRing, submitContext);
+    uploadBatch.addBuffer(instanceBuffer, 0, instances.data(), instanceBufferSize);
+    uploadBatch.submit();
+
+    if (!cullInstances)
+    {
+        return;
+    }
+    // bounding spheres of the unit cube mesh after the instance transform, in world space
+    float unscale = packedVertices ? 1.0f / positionScale : 1.0f;
+    instanceBounds.resize(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; i++)
+    {
+        const float *offsetScale = instances[i].offsetScale;
+        float size = offsetScale[3] * unscale;
+        instanceBounds.set(i, offsetScale[0] + size * 0.5f, offsetScale[1] + size * 0.5f, offsetScale[2] + size * 0.5f, size * 0.8660254f);
+    }
+    visibleInstances.resize(instanceCount);
+
+    // written by the CPU every frame, one per frame in flight so a queued frame keeps its list
+    for (uint32_t slot = 0; slot < framesInFlight; slot++)
+    {
+        BufferCreateInfo bcivisible{
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            myvk::MEMORY_USAGE_DYNAMIC,
+            visibleInstanceBuffers[slot],
+            visibleInstanceMemory[slot],
+            instanceBufferSize};
+        createBuffer(bcivisible);
+    }
+}
+
+// cull the instances against the frame's frustum and write the visible ones into the slot's buffer
+uint32_t Application::cullFrame(const glm::mat4 &viewProjection, uint32_t slot)
+{
+    auto tStart = std::chrono::high_resolution_clock::now();
+    myvk::culling::Frustum frustum = myvk::culling::extractFrustum(&viewProjection[0][0]);
+    uint32_t visibleCount = myvk::culling::cullSpheres(frustum, instanceBounds, visibleInstances.data(), threadPool);
+    InstanceData *visible = static_cast<InstanceData *>(visibleInstanceMemory[slot].mapped);
+    for (uint32_t i = 0; i < visibleCount; i++)
+    {
+        visible[i] = instances[visibleInstances[i]];
+    }
+    cullSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+    visibleTotal += visibleCount;
+    return visibleCount;
 }
 
 void Application::setFramebufferAtta()
@@ -518,15 +962,12 @@ void Application::setFramebufferAtta()
         image.tiling = VK_IMAGE_TILING_OPTIMAL;
         image.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
-        VkMemoryAllocateInfo memAlloc = myvk::initializers::memoryAllocateInfo();
         VkMemoryRequirements memReqs;
 
         VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &(colorAttachment.image)));
         vkGetImageMemoryRequirements(device, colorAttachment.image, &memReqs);
-        memAlloc.allocationSize = memReqs.size;
-        memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &(colorAttachment.memory)));
-        VK_CHECK_RESULT(vkBindImageMemory(device, colorAttachment.image, colorAttachment.memory, 0));
+        VK_CHECK_RESULT(allocator.allocate(memReqs, myvk::MEMORY_USAGE_GPU_ONLY, myvk::ALLOCATION_TILING_OPTIMAL, colorAttachment.memory));
+        VK_CHECK_RESULT(vkBindImageMemory(device, colorAttachment.image, colorAttachment.memory.memory, colorAttachment.memory.offset));
 
         VkImageViewCreateInfo colorImageView = myvk::initializers::imageViewCreateInfo();
         colorImageView.viewType = VK_IMAGE_VIEW_TYPE_2D;
@@ -546,10 +987,8 @@ void Application::setFramebufferAtta()
 
         VK_CHECK_RESULT(vkCreateImage(device, &image, nullptr, &(depthAttachment.image)));
         vkGetImageMemoryRequirements(device, depthAttachment.image, &memReqs);
-        memAlloc.allocationSize = memReqs.size;
-        memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &(depthAttachment.memory)));
-        VK_CHECK_RESULT(vkBindImageMemory(device, depthAttachment.image, depthAttachment.memory, 0));
+        VK_CHECK_RESULT(allocator.allocate(memReqs, myvk::MEMORY_USAGE_GPU_ONLY, myvk::ALLOCATION_TILING_OPTIMAL, depthAttachment.memory));
+        VK_CHECK_RESULT(vkBindImageMemory(device, depthAttachment.image, depthAttachment.memory.memory, depthAttachment.memory.offset));
 
         VkImageViewCreateInfo depthStencilView = myvk::initializers::imageViewCreateInfo();
         depthStencilView.viewType = VK_IMAGE_VIEW_TYPE_2D;
@@ -564,6 +1003,9 @@ void Application::setFramebufferAtta()
         depthStencilView.image = depthAttachment.image;
         VK_CHECK_RESULT(vkCreateImageView(device, &depthStencilView, nullptr, &(depthAttachment.view)));
     }
+
+    // host cached buffers the color attachment is copied into
+    readback.create(device, allocator, submitContext, width, height, 4, framesInFlight);
 }
 
 void Application::setRenderPass()
@@ -721,10 +1163,6 @@ void Application::setPipeline()
 
     VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout));
 
-    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-    VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &(pipelineCache)));
-
     // Create pipeline
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
         myvk::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
@@ -768,18 +1206,26 @@ void Application::setPipeline()
     pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
     pipelineCreateInfo.pStages = shaderStages.data();
 
-    // Vertex bindings an attributes
-    // Binding description
-    std::vector<VkVertexInputBindingDescription> vertexInputBindings = {
-        myvk::initializers::vertexInputBindingDescription(0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX),
-    };
-
-    // Attribute descriptions
-    std::vector<VkVertexInputAttributeDescription> vertexInputAttributes = {
-        myvk::initializers::vertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0),                 // Position
-        myvk::initializers::vertexInputAttributeDescription(0, 1, VK_FORMAT_R32G32B32_SFLOAT, sizeof(float) * 3), // Color
-        myvk::initializers::vertexInputAttributeDescription(0, 2, VK_FORMAT_R32G32_SFLOAT, sizeof(float) * 6),    // Texture Coor
-    };
+    // Vertex bindings an attributes, generated from the layout of the vertex struct
+    // packed formats are expanded to the same floats the shaders expect
+    std::vector<VkVertexInputBindingDescription> vertexInputBindings;
+    std::vector<VkVertexInputAttributeDescription> vertexInputAttributes;
+    if (packedVertices && halfTexCoords)
+    {
+        myvk::vertexlayout::addStream<HalfPackedVertex>(vertexInputBindings, vertexInputAttributes, 0);
+    }
+    else if (packedVertices)
+    {
+        myvk::vertexlayout::addStream<PackedVertex>(vertexInputBindings, vertexInputAttributes, 0);
+    }
+    else
+    {
+        myvk::vertexlayout::addStream<Vertex>(vertexInputBindings, vertexInputAttributes, 0);
+    }
+    if (instanceCount > 0)
+    {
+        myvk::vertexlayout::addStream<InstanceData>(vertexInputBindings, vertexInputAttributes, 1, VK_VERTEX_INPUT_RATE_INSTANCE);
+    }
 
     VkPipelineVertexInputStateCreateInfo vertexInputState = myvk::initializers::pipelineVertexInputStateCreateInfo();
     vertexInputState.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexInputBindings.size());
@@ -795,23 +1241,43 @@ void Application::setPipeline()
     shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
     shaderStages[1].pName = "main";
-    shaderStages[0].module = myvk::tools::loadShader(ASSET_PATH "shaders/texture/texture.vert.spv", device);
-    shaderStages[1].module = myvk::tools::loadShader(ASSET_PATH "shaders/texture/texture.frag.spv", device);
+    shaderStages[0].module = shaderRegistry.acquire(instanceCount > 0 ? ASSET_PATH "shaders/texture/texture_instanced.vert.spv" : ASSET_PATH "shaders/texture/texture.vert.spv");
+    shaderStages[1].module = shaderRegistry.acquire(ASSET_PATH "shaders/texture/texture.frag.spv");
     shaderModules = {shaderStages[0].module, shaderStages[1].module};
-    VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &pipeline));
+    // a missing or broken .spv leaves a null module, which must not reach the driver
+    if (shaderStages[0].module == VK_NULL_HANDLE || shaderStages[1].module == VK_NULL_HANDLE)
+    {
+        printf("The shaders of the pipeline could not be loaded, run make shaders\n");
+        exit(1);
+    }
+    auto tStart = std::chrono::high_resolution_clock::now();
+    VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache.get(), 1, &pipelineCreateInfo, nullptr, &pipeline));
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    printf("Pipeline created in %.3f ms with a %s cache\n", std::chrono::duration<double, std::milli>(tEnd - tStart).count(), pipelineCache.isWarm() ? "warm" : "cold");
+    pipelineCache.save();
 }
 
-void Application::setCommand()
+// turntable around the scene, frame 0 is the original camera
+glm::mat4 Application::getFrameMVP(uint32_t frame)
 {
-    VkCommandBuffer commandBuffer;
-    VkCommandBufferAllocateInfo cmdBufAllocateInfo =
-        myvk::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &commandBuffer));
+    glm::vec3 eye(1.5f, 1.5f, 2.5f);
+    glm::vec3 center(0.2f, 0.2f, 0.0f);
+    float angle = glm::two_pi<float>() * frame / frameCount;
+    glm::mat4 turn = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 1.0f, 0.0f));
+    eye = center + glm::vec3(turn * glm::vec4(eye - center, 0.0f));
+
+    glm::mat4 model = meshModel;
+    glm::mat4 view = glm::lookAt(eye, center, glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)width / (float)height, 0.1f, 10.0f);
+    projection[1][1] = -projection[1][1];
 
-    VkCommandBufferBeginInfo cmdBufInfo =
-        myvk::initializers::commandBufferBeginInfo();
+    return projection * view * model;
+}
 
-    VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+// record and submit one frame together with the copy of its image, without waiting for it
+void Application::setCommand(uint32_t frame)
+{
+    VkCommandBuffer commandBuffer = submitContext.begin();
 
     VkClearValue clearValues[2];
     clearValues[0].color = {{0.0f, 0.2f, 0.0f, 1.0f}};
@@ -846,175 +1312,104 @@ void Application::setCommand()
     // Render scene
     VkDeviceSize offsets[1] = {0};
     vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
+    if (indexCount > 0)
+    {
+        vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    }
 
-    glm::mat4 model = glm::mat4(1.0f);
-    glm::mat4 view = glm::mat4(1.0f);
-    glm::mat4 projection = glm::mat4(1.0f);
-
-    view = glm::lookAt(
-        glm::vec3(1.5f, 1.5f, 2.5f),
-        glm::vec3(0.2f, 0.2f, 0.0f),
-        glm::vec3(0.0f, 1.0f, 0.0f));
-
-    projection = glm::perspective(glm::radians(45.0f), (float)width / (float)height, 0.1f, 10.0f);
-    projection[1][1] = -projection[1][1];
-
-    glm::mat4 mvp = projection * view * model;
-
+    glm::mat4 mvp = getFrameMVP(frame);
+    if (packedVertices && instanceCount == 0)
+    {
+        mvp = mvp * glm::scale(glm::mat4(1.0f), glm::vec3(positionScale));
+    }
     vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(mvp), &mvp);
 
     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
 
-    vkCmdDraw(commandBuffer, vertices.size(), 1, 0, 0);
+    auto tRecord = std::chrono::high_resolution_clock::now();
+    if (indexCount > 0)
+    {
+        vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+    }
+    else if (instanceCount == 0)
+    {
+        vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
+    }
+    else
+    {
+        // the slot's previous frame has been read back before this one is recorded, so its buffer is free
+        uint32_t drawCount = instanceCount;
+        VkBuffer drawInstances = instanceBuffer;
+        if (cullInstances)
+        {
+            uint32_t slot = frame % framesInFlight;
+            drawCount = cullFrame(mvp, slot);
+            drawInstances = visibleInstanceBuffers[slot];
+        }
+        VkDeviceSize instanceOffset = 0;
+        vkCmdBindVertexBuffers(commandBuffer, 1, 1, &drawInstances, &instanceOffset);
+        if (drawPerInstance)
+        {
+            // same shader and data, but every cube costs a draw call
+            for (uint32_t i = 0; i < drawCount; i++)
+            {
+                vkCmdDraw(commandBuffer, vertexCount, 1, 0, i);
+            }
+        }
+        else if (drawCount > 0)
+        {
+            vkCmdDraw(commandBuffer, vertexCount, drawCount, 0, 0);
+        }
+    }
+    recordSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tRecord).count();
 
     vkCmdEndRenderPass(commandBuffer);
 
-    VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
-
-    submitWork(commandBuffer, queue);
-
-    vkDeviceWaitIdle(device);
-}
-
-void Application::saveImage()
-{
-    const char *imagedata;
-    // Create the linear tiled destination image to copy to and to read the memory from
-    VkImageCreateInfo imgCreateInfo(myvk::initializers::imageCreateInfo());
-    imgCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-    imgCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-    imgCreateInfo.extent.width = width;
-    imgCreateInfo.extent.height = height;
-    imgCreateInfo.extent.depth = 1;
-    imgCreateInfo.arrayLayers = 1;
-    imgCreateInfo.mipLevels = 1;
-    imgCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imgCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    imgCreateInfo.tiling = VK_IMAGE_TILING_LINEAR;
-    imgCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-    // Create the image
-    VkImage dstImage;
-    VK_CHECK_RESULT(vkCreateImage(device, &imgCreateInfo, nullptr, &dstImage));
-    // Create memory to back up the image
-    VkMemoryRequirements memRequirements;
-    VkMemoryAllocateInfo memAllocInfo(myvk::initializers::memoryAllocateInfo());
-    VkDeviceMemory dstImageMemory;
-    vkGetImageMemoryRequirements(device, dstImage, &memRequirements);
-    memAllocInfo.allocationSize = memRequirements.size;
-    // Memory must be host visible to copy from
-    memAllocInfo.memoryTypeIndex = getMemoryTypeIndex(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    VK_CHECK_RESULT(vkAllocateMemory(device, &memAllocInfo, nullptr, &dstImageMemory));
-    VK_CHECK_RESULT(vkBindImageMemory(device, dstImage, dstImageMemory, 0));
-
-    // Do the actual blit from the offscreen image to our host visible destination image
-    VkCommandBufferAllocateInfo cmdBufAllocateInfo = myvk::initializers::commandBufferAllocateInfo(commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
-    VkCommandBuffer copyCmd;
-    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &copyCmd));
-    VkCommandBufferBeginInfo cmdBufInfo = myvk::initializers::commandBufferBeginInfo();
-    VK_CHECK_RESULT(vkBeginCommandBuffer(copyCmd, &cmdBufInfo));
-
-    // Transition destination image to transfer destination layout
+    // copy the color attachment into a host cached readback buffer in the same submission
     myvk::tools::insertImageMemoryBarrier(
-        copyCmd,
-        dstImage,
-        0,
-        VK_ACCESS_TRANSFER_WRITE_BIT,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        commandBuffer,
+        colorAttachment.image,
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_ACCESS_TRANSFER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
         VK_PIPELINE_STAGE_TRANSFER_BIT,
         VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1});
+    readback.record(commandBuffer, colorAttachment.image);
 
-    // colorAttachment.image is already in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, and does not need to be transitioned
-
-    VkImageCopy imageCopyRegion{};
-    imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyRegion.srcSubresource.layerCount = 1;
-    imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyRegion.dstSubresource.layerCount = 1;
-    imageCopyRegion.extent.width = width;
-    imageCopyRegion.extent.height = height;
-    imageCopyRegion.extent.depth = 1;
-
-    vkCmdCopyImage(
-        copyCmd,
-        colorAttachment.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1,
-        &imageCopyRegion);
-
-    // Transition destination image to general layout, which is the required layout for mapping the image memory later on
-    myvk::tools::insertImageMemoryBarrier(
-        copyCmd,
-        dstImage,
-        VK_ACCESS_TRANSFER_WRITE_BIT,
-        VK_ACCESS_MEMORY_READ_BIT,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_GENERAL,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VK_PIPELINE_STAGE_TRANSFER_BIT,
-        VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1});
-
-    VK_CHECK_RESULT(vkEndCommandBuffer(copyCmd));
-
-    submitWork(copyCmd, queue);
-
-    // Get layout of the image (including row pitch)
-    VkImageSubresource subResource{};
-    subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    VkSubresourceLayout subResourceLayout;
-
-    vkGetImageSubresourceLayout(device, dstImage, &subResource, &subResourceLayout);
+    // no need to wait, saveImage blocks on the readback
+    readback.submitted(submitContext.submit(commandBuffer));
+}
 
-    // Map image memory so we can start copying from it
-    vkMapMemory(device, dstImageMemory, 0, VK_WHOLE_SIZE, 0, (void **)&imagedata);
-    imagedata += subResourceLayout.offset;
+// write out the oldest frame in flight
+void Application::saveImage()
+{
+    // wait for the copy recorded behind the render pass, the memory is already mapped by the allocator
+    myvk::ReadbackFrame frame;
+    if (!readback.map(frame))
+    {
+        printf("Nothing was rendered\n");
+        return;
+    }
 
     /*
 		Save host visible framebuffer image to disk (ppm format)
 	*/
-    const char *filename = "./out/pic/texture.ppm";
-    std::ofstream file(filename, std::ios::out | std::ios::binary);
-
-    // ppm header
-    file << "P6\n"
-         << width << "\n"
-         << height << "\n"
-         << 255 << "\n";
-
-    // If source is BGR (destination is always RGB) and we can't use blit (which does automatic conversion), we'll have to manually swizzle color components
-    // Check if source is BGR and needs swizzle
-    std::vector<VkFormat> formatsBGR = {VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_B8G8R8A8_SNORM};
-    const bool colorSwizzle = (std::find(formatsBGR.begin(), formatsBGR.end(), VK_FORMAT_R8G8B8A8_UNORM) != formatsBGR.end());
-
-    // ppm binary pixel data
-    for (int32_t y = 0; y < height; y++)
+    char filename[64];
+    if (frameCount == 1)
     {
-        unsigned int *row = (unsigned int *)imagedata;
-        for (int32_t x = 0; x < width; x++)
-        {
-            if (colorSwizzle)
-            {
-                file.write((char *)row + 2, 1);
-                file.write((char *)row + 1, 1);
-                file.write((char *)row, 1);
-            }
-            else
-            {
-                file.write((char *)row, 3);
-            }
-            row++;
-        }
-        imagedata += subResourceLayout.rowPitch;
+        snprintf(filename, sizeof(filename), "./out/pic/texture.ppm");
     }
-    file.close();
+    else
+    {
+        snprintf(filename, sizeof(filename), "./out/pic/texture_%05llu.ppm", (unsigned long long)frame.index);
+    }
+    // the color attachment is always R8G8B8A8_UNORM, so the texels are in ppm order already
+    myvk::tools::savePPM(filename, frame.data, frame.width, frame.height, frame.rowPitch, false);
+    readback.unmap();
 
     printf("Framebuffer image saved to %s\n", filename);
-
-    // Clean up resources
-    vkUnmapMemory(device, dstImageMemory);
-    vkFreeMemory(device, dstImageMemory, nullptr);
-    vkDestroyImage(device, dstImage, nullptr);
 }
 
 Application::~Application()
@@ -1022,27 +1417,41 @@ Application::~Application()
     vkDestroySampler(device, textureSampler, nullptr);
     vkDestroyImageView(device, textureImageView, nullptr);
     vkDestroyImage(device, textureImage, nullptr);
-    vkFreeMemory(device, textureImageMemory, nullptr);
+    allocator.free(textureImageMemory);
     vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexMemory, nullptr);
+    allocator.free(vertexMemory);
+    vkDestroyBuffer(device, instanceBuffer, nullptr);
+    allocator.free(instanceMemory);
+    for (uint32_t slot = 0; slot < MAX_FRAMES_IN_FLIGHT; slot++)
+    {
+        vkDestroyBuffer(device, visibleInstanceBuffers[slot], nullptr);
+        allocator.free(visibleInstanceMemory[slot]);
+    }
+    vkDestroyBuffer(device, indexBuffer, nullptr);
+    allocator.free(indexMemory);
     vkDestroyImageView(device, colorAttachment.view, nullptr);
     vkDestroyImage(device, colorAttachment.image, nullptr);
-    vkFreeMemory(device, colorAttachment.memory, nullptr);
+    allocator.free(colorAttachment.memory);
     vkDestroyImageView(device, depthAttachment.view, nullptr);
     vkDestroyImage(device, depthAttachment.image, nullptr);
-    vkFreeMemory(device, depthAttachment.memory, nullptr);
+    allocator.free(depthAttachment.memory);
     vkDestroyRenderPass(device, renderPass, nullptr);
     vkDestroyFramebuffer(device, framebuffer, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
     vkDestroyPipeline(device, pipeline, nullptr);
-    vkDestroyPipelineCache(device, pipelineCache, nullptr);
-    vkDestroyCommandPool(device, commandPool, nullptr);
+    pipelineCache.destroy();
     for (auto shadermodule : shaderModules)
     {
-        vkDestroyShaderModule(device, shadermodule, nullptr);
+        shaderRegistry.release(shadermodule);
     }
+    shaderRegistry.destroy();
+    readback.destroy();
+    stagingRing.destroy();
+    transferContext.destroy();
+    submitContext.destroy();
+    allocator.destroy();
     vkDestroyDevice(device, nullptr);
 #if DEBUG
     if (debugReportCallback)
@@ -1055,25 +1464,172 @@ Application::~Application()
     vkDestroyInstance(instance, nullptr);
 }
 
-void Application::run()
+// keep up to framesInFlight frames queued, the CPU writes out frame N while the GPU renders the next ones
+void Application::renderLoop()
 {
+    auto tStart = std::chrono::high_resolution_clock::now();
+    for (uint32_t frame = 0; frame < frameCount; frame++)
+    {
+        if (readback.full())
+        {
+            saveImage();
+        }
+        setCommand(frame);
+    }
+    while (readback.pending() > 0)
+    {
+        saveImage();
+    }
+    auto tEnd = std::chrono::high_resolution_clock::now();
+
+    double seconds = std::chrono::duration<double>(tEnd - tStart).count();
+    printf("Rendered %u frames with %u in flight in %.3f s, %.1f fps\n", frameCount, framesInFlight, seconds, frameCount / seconds);
+    if (instanceCount > 0)
+    {
+        uint32_t drawnCount = cullInstances ? static_cast<uint32_t>(visibleTotal / frameCount) : instanceCount;
+        printf("%u of %u cubes in %u draw calls per frame, recorded in %.3f ms per frame\n", drawnCount, instanceCount,
+               drawPerInstance ? drawnCount : 1u, recordSeconds * 1000.0 / frameCount);
+        if (cullInstances)
+        {
+            printf("Frustum culling took %.3f ms per frame on %u threads\n", cullSeconds * 1000.0 / frameCount, threadPool.getThreadCount());
+        }
+    }
+}
+
+void Application::run(int argc, char **argv)
+{
+    frameCount = std::max(myvk::tools::getArgument(argc, argv, "--frames", 1), 1u);
+    framesInFlight = std::min(std::max(myvk::tools::getArgument(argc, argv, "--in-flight", DEFAULT_READBACK_SLOTS), 1u), (uint32_t)MAX_FRAMES_IN_FLIGHT);
+    halfTexCoords = myvk::tools::hasArgument(argc, argv, "--half-uv");
+    packedVertices = halfTexCoords || myvk::tools::hasArgument(argc, argv, "--packed-vertices");
+    instanceCount = myvk::tools::getArgument(argc, argv, "--instances", 0u);
+    drawPerInstance = myvk::tools::hasArgument(argc, argv, "--draw-per-instance");
+    cullInstances = !myvk::tools::hasArgument(argc, argv, "--no-cull");
+    meshFile = myvk::tools::getArgument(argc, argv, "--mesh", static_cast<const char *>(nullptr));
+    saveMeshFile = myvk::tools::getArgument(argc, argv, "--save-mesh", static_cast<const char *>(nullptr));
+    optimizeVertexCache = !myvk::tools::hasArgument(argc, argv, "--no-cache-optimize");
+    computeMipmaps = myvk::tools::hasArgument(argc, argv, "--compute-mipmaps");
+    cpuMipmaps = myvk::tools::hasArgument(argc, argv, "--cpu-mipmaps");
+    compressTexture = myvk::tools::getArgument(argc, argv, "--compress", static_cast<const char *>(nullptr));
+    textureFile = myvk::tools::getArgument(argc, argv, "--texture", DEFAULT_TEXTURE_FILE);
+    if (meshFile != nullptr && instanceCount > 0)
+    {
+        // the instance transforms assume the unit cube mesh
+        printf("--instances draws cubes, ignoring it for --mesh\n");
+        instanceCount = 0;
+    }
+    if (instanceCount > 0 && !myvk::ShaderRegistry::isSpirv(ASSET_PATH "shaders/texture/texture_instanced.vert.spv"))
+    {
+        printf("texture_instanced.vert is not built, run make shaders. Drawing a single cube\n");
+        instanceCount = 0;
+    }
+
     setInstance();
     setDevice();
     setTexture();
     setVertex();
+    setInstances();
     setFramebufferAtta();
     setRenderPass();
     setDescriptorSetLayout();
     setDescriptorPool();
     setDescriptorSets();
     setPipeline();
-    setCommand();
-    saveImage();
+    renderLoop();
+    allocator.dumpStats();
+    shaderRegistry.dumpStats();
 }
 
-int main()
+// cull random spheres against a fixed camera with the scalar reference, SIMD and threaded SIMD, the lists must match
+static void benchmarkCulling(uint32_t count)
 {
+    myvk::culling::SphereSet spheres;
+    spheres.resize(count);
+    uint32_t seed = 1;
+    auto random = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) * (1.0f / 16777216.0f);
+    };
+    for (uint32_t i = 0; i < count; i++)
+    {
+        spheres.set(i, random() * 20.0f - 10.0f, random() * 20.0f - 10.0f, random() * 20.0f - 10.0f, random() * 0.2f);
+    }
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 12.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, 20.0f);
+    glm::mat4 viewProjection = projection * view;
+    myvk::culling::Frustum frustum = myvk::culling::extractFrustum(&viewProjection[0][0]);
+
+    myvk::ThreadPool threadPool;
+    std::vector<uint32_t> reference(count), visible(count);
+    const int repeats = 10;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    uint32_t referenceCount = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        referenceCount = myvk::culling::cullSpheresScalar(frustum, spheres, 0, count, reference.data());
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    uint32_t simdCount = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        simdCount = myvk::culling::cullSpheres(frustum, spheres, 0, count, visible.data());
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    bool identical = simdCount == referenceCount && std::equal(visible.begin(), visible.begin() + simdCount, reference.begin());
+    uint32_t threadedCount = 0;
+    for (int r = 0; r < repeats; r++)
+    {
+        threadedCount = myvk::culling::cullSpheres(frustum, spheres, visible.data(), threadPool);
+    }
+    auto t3 = std::chrono::high_resolution_clock::now();
+    identical = identical && threadedCount == referenceCount && std::equal(visible.begin(), visible.begin() + threadedCount, reference.begin());
+
+    auto perMs = [&](std::chrono::high_resolution_clock::time_point a, std::chrono::high_resolution_clock::time_point b) {
+        return count * (double)repeats / std::chrono::duration<double, std::milli>(b - a).count();
+    };
+    printf("%u spheres, %u visible\n", count, referenceCount);
+    printf("scalar %.0f, SIMD %.0f, SIMD on %u threads %.0f spheres per ms %s\n", perMs(t0, t1), perMs(t1, t2),
+           threadPool.getThreadCount(), perMs(t2, t3), identical ? "" : "MISMATCH");
+}
+
+// build the full mip chain of a size x size RGBA gradient on every core
+static void benchmarkMipmaps(uint32_t size)
+{
+    std::vector<unsigned char> pixels(static_cast<size_t>(size) * size * 4);
+    for (uint32_t y = 0; y < size; y++)
+    {
+        for (uint32_t x = 0; x < size; x++)
+        {
+            unsigned char *texel = &pixels[(static_cast<size_t>(y) * size + x) * 4];
+            texel[0] = static_cast<unsigned char>(x * 255 / size);
+            texel[1] = static_cast<unsigned char>(y * 255 / size);
+            texel[2] = static_cast<unsigned char>((x ^ y) & 0xff);
+            texel[3] = 255;
+        }
+    }
+    myvk::ThreadPool threadPool;
+    myvk::mipmap::MipChainLayout layout = myvk::mipmap::layoutChain(size, size, 4);
+    std::vector<unsigned char> chain(layout.size);
+    auto tStart = std::chrono::high_resolution_clock::now();
+    bool built = myvk::mipmap::buildChain(pixels.data(), layout, chain.data(), threadPool);
+    auto tEnd = std::chrono::high_resolution_clock::now();
+    printf("%ux%u, %zu levels, %.1f MB, built on %u threads in %.3f ms %s\n", size, size, layout.levels.size(), layout.size / (1024.0 * 1024.0),
+           threadPool.getThreadCount(), std::chrono::duration<double, std::milli>(tEnd - tStart).count(), built ? "" : "FAILED");
+}
+
+int main(int argc, char **argv)
+{
+    if (myvk::tools::hasArgument(argc, argv, "--bench-cull"))
+    {
+        benchmarkCulling(std::max(myvk::tools::getArgument(argc, argv, "--bench-cull", 1000000u), 1u));
+        return 0;
+    }
+    if (myvk::tools::hasArgument(argc, argv, "--bench-mipmaps"))
+    {
+        benchmarkMipmaps(std::max(myvk::tools::getArgument(argc, argv, "--bench-mipmaps", 4096u), 1u));
+        return 0;
+    }
     Application app;
-    app.run();
+    app.run(argc, argv);
     return 0;
 }
\ No newline at end of file
@@ -4,17 +4,45 @@
 #include <array>
 #include <assert.h>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb-master/stb_image.h>
 
 #include <vulkan/vulkan.h>
 #include "tools.hpp"
+#include "allocator.hpp"
+#include "submit.hpp"
+#include "staging.hpp"
+#include "upload.hpp"
+#include "readback.hpp"
+#include "pipelinecache.hpp"
+#include "shader.hpp"
+#include "vertexformat.hpp"
+#include "vertexlayout.hpp"
+#include "threadpool.hpp"
+#include "mesh.hpp"
+#include "culling.hpp"
+#include "mipmap.hpp"
+#include "blockcompress.hpp"
+#include "texturefile.hpp"
+
+// upper bound for --in-flight, every frame in flight holds a command buffer, a fence and a readback slot
+#define MAX_FRAMES_IN_FLIGHT 4
+
+// texture loaded without --texture
+#define DEFAULT_TEXTURE_FILE ASSET_PATH "textures/pic1.jpg"
 
 #define DEBUG (!NDEBUG)
 
@@ -22,7 +50,7 @@
 struct FrameBufferAttachment
 {
     VkImage image;
-    VkDeviceMemory memory;
+    myvk::Allocation memory;
     VkImageView view;
 };
 struct Vertex
@@ -31,12 +59,71 @@ struct Vertex
     float color[3];
     float texCoord[2];
 };
+// Vertex with R16G16B16A16_SNORM position, R8G8B8A8_UNORM color and R16G16_UNORM or half texcoord, 16 bytes instead of 32
+struct PackedVertex
+{
+    int16_t pos[4];
+    uint8_t color[4];
+    uint16_t texCoord[2];
+};
+// R16G16_SFLOAT is the same size, so --half-uv reuses the layout with the format swapped
+struct HalfPackedVertex : PackedVertex
+{
+};
+
+// per instance transform of the instanced mode, xyz translation and w uniform scale
+struct InstanceData
+{
+    float offsetScale[4];
+};
+
+// vertex input layouts, the locations match texture.vert and texture_instanced.vert
+namespace myvk
+{
+namespace vertexlayout
+{
+template <>
+struct Layout<Vertex>
+{
+    static constexpr std::array<Attribute, 3> attributes = {{
+        MYVK_VERTEX_ATTRIBUTE(Vertex, pos, 0, VK_FORMAT_R32G32B32_SFLOAT),
+        MYVK_VERTEX_ATTRIBUTE(Vertex, color, 1, VK_FORMAT_R32G32B32_SFLOAT),
+        MYVK_VERTEX_ATTRIBUTE(Vertex, texCoord, 2, VK_FORMAT_R32G32_SFLOAT),
+    }};
+};
+template <>
+struct Layout<PackedVertex>
+{
+    static constexpr std::array<Attribute, 3> attributes = {{
+        MYVK_VERTEX_ATTRIBUTE(PackedVertex, pos, 0, VK_FORMAT_R16G16B16A16_SNORM),
+        MYVK_VERTEX_ATTRIBUTE(PackedVertex, color, 1, VK_FORMAT_R8G8B8A8_UNORM),
+        MYVK_VERTEX_ATTRIBUTE(PackedVertex, texCoord, 2, VK_FORMAT_R16G16_UNORM),
+    }};
+};
+template <>
+struct Layout<HalfPackedVertex>
+{
+    static constexpr std::array<Attribute, 3> attributes = {{
+        MYVK_VERTEX_ATTRIBUTE(HalfPackedVertex, pos, 0, VK_FORMAT_R16G16B16A16_SNORM),
+        MYVK_VERTEX_ATTRIBUTE(HalfPackedVertex, color, 1, VK_FORMAT_R8G8B8A8_UNORM),
+        MYVK_VERTEX_ATTRIBUTE(HalfPackedVertex, texCoord, 2, VK_FORMAT_R16G16_SFLOAT),
+    }};
+};
+template <>
+struct Layout<InstanceData>
+{
+    static constexpr std::array<Attribute, 1> attributes = {{
+        MYVK_VERTEX_ATTRIBUTE(InstanceData, offsetScale, 3, VK_FORMAT_R32G32B32A32_SFLOAT),
+    }};
+};
+} // namespace vertexlayout
+} // namespace myvk
 struct BufferCreateInfo
 {
     VkBufferUsageFlags usageFlags;
-    VkMemoryPropertyFlags memoryPropertyFlags;
+    myvk::MemoryUsage memoryUsage;
     VkBuffer &buffer;
-    VkDeviceMemory &memory;
+    myvk::Allocation &memory;
     VkDeviceSize size;
     void *data = nullptr;
 };
@@ -47,9 +134,10 @@ struct ImageCreateInfo
     VkFormat format;
     VkImageTiling tiling;
     VkImageUsageFlags usage;
-    VkMemoryPropertyFlags properties;
+    myvk::MemoryUsage memoryUsage;
     VkImage &image;
-    VkDeviceMemory &memory;
+    myvk::Allocation &memory;
+    uint32_t mipLevels = 1;
 };
 
 class Application
@@ -61,16 +149,68 @@ class Application
     VkDebugReportCallbackEXT debugReportCallback{};
     uint32_t queueFamilyIndex;
     VkQueue queue;
-    VkCommandPool commandPool;
+    myvk::SubmitContext submitContext;
+    // same as the graphics queue when the device has no separate transfer family
+    uint32_t transferQueueFamilyIndex;
+    VkQueue transferQueue;
+    myvk::SubmitContext transferContext;
+    myvk::Allocator allocator;
+    myvk::StagingRing stagingRing;
+    myvk::ReadbackQueue readback;
+    // frames rendered by the render loop, and how many of them may be queued before their image is read back
+    uint32_t frameCount = 1;
+    uint32_t framesInFlight = DEFAULT_READBACK_SLOTS;
 
     VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
+    myvk::Allocation textureImageMemory;
     VkImageView textureImageView;
     VkSampler textureSampler;
+    uint32_t textureMipLevels = 1;
+    // downsample with the compute shader even if the format supports linear blits, or on the CPU
+    bool computeMipmaps = false;
+    bool cpuMipmaps = false;
+    // bc1 or bc3 to block compress the texture and its mip chain on the CPU
+    const char *compressTexture = nullptr;
+    VkFormat textureFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    // any image stb_image reads, or a .mtex file from texconv which is copied to the image as is
+    const char *textureFile = DEFAULT_TEXTURE_FILE;
 
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexMemory;
+    myvk::Allocation vertexMemory;
     std::vector<Vertex> vertices;
+    uint32_t vertexCount = 0;
+    // upload PackedVertex instead of Vertex, positions are divided by positionScale to fit SNORM
+    bool packedVertices = false;
+    bool halfTexCoords = false;
+    float positionScale = 1.0f;
+
+    // instanced mode draws instanceCount cubes from a second, per instance vertex stream
+    uint32_t instanceCount = 0;
+    // one draw call per cube instead of one for all, to compare against
+    bool drawPerInstance = false;
+    VkBuffer instanceBuffer = VK_NULL_HANDLE;
+    myvk::Allocation instanceMemory;
+    // frustum culling of the instances, the visible ones are compacted into the buffer of the frame slot
+    bool cullInstances = true;
+    std::vector<InstanceData> instances;
+    myvk::culling::SphereSet instanceBounds;
+    std::vector<uint32_t> visibleInstances;
+    VkBuffer visibleInstanceBuffers[MAX_FRAMES_IN_FLIGHT] = {};
+    myvk::Allocation visibleInstanceMemory[MAX_FRAMES_IN_FLIGHT];
+    uint64_t visibleTotal = 0;
+    double cullSeconds = 0.0;
+    // CPU time spent recording draws, over all frames
+    double recordSeconds = 0.0;
+
+    // --mesh replaces the cube by an indexed mesh file, scaled into the same unit cube by meshModel
+    const char *meshFile = nullptr;
+    const char *saveMeshFile = nullptr;
+    // reorder the mesh for the post-transform cache before upload and before --save-mesh
+    bool optimizeVertexCache = true;
+    VkBuffer indexBuffer = VK_NULL_HANDLE;
+    myvk::Allocation indexMemory;
+    uint32_t indexCount = 0;
+    glm::mat4 meshModel = glm::mat4(1.0f);
 
     int32_t width;
     int32_t height;
@@ -83,38 +223,43 @@ class Application
     VkDescriptorPool descriptorPool;
     VkDescriptorSet descriptorSet;
 
+    myvk::ShaderRegistry shaderRegistry;
     std::vector<VkShaderModule> shaderModules;
     VkPipelineLayout pipelineLayout;
     VkPipeline pipeline;
-    VkPipelineCache pipelineCache;
+    myvk::PipelineCache pipelineCache;
+    myvk::ThreadPool threadPool;
 
   public:
     ~Application();
-    uint32_t getMemoryTypeIndex(uint32_t, VkMemoryPropertyFlags);
     VkResult createBuffer(BufferCreateInfo &);
     VkResult createImage(ImageCreateInfo &);
-    VkResult createImageView(VkImage &, VkFormat, VkImageView &);
+    VkResult createImageView(VkImage &, VkFormat, VkImageView &, uint32_t baseMipLevel = 0, uint32_t levelCount = 1);
     VkResult createSampler(VkSampler &);
 
-    void submitWork(VkCommandBuffer &, VkQueue &);
-    VkCommandBuffer beginSingleTimeCommands();
-    void endSingleTimeCommands(VkCommandBuffer &, VkQueue &);
-    void copyBuffer(VkBuffer &src, VkBuffer &dst, VkDeviceSize size);
-    void copyBufferToImage(VkBuffer &src, VkImage &dst, uint32_t width, uint32_t height);
-    void transitionImageLayout(VkImage &, VkImageLayout oldLayout, VkImageLayout newLayout);
+    void submitWork(VkCommandBuffer);
 
     void setInstance();
     void setDevice();
     void setTexture();
+    bool setTextureFile();
+    void blitMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels);
+    // takes over the reference to shaderModule, downsample.comp acquired by setTexture
+    void downsampleMipmaps(VkImage image, uint32_t width, uint32_t height, uint32_t mipLevels, VkShaderModule shaderModule);
     void setVertex();
+    bool setMesh();
+    void setInstances();
+    uint32_t cullFrame(const glm::mat4 &viewProjection, uint32_t slot);
     void setFramebufferAtta();
     void setRenderPass();
     void setDescriptorSetLayout();
     void setDescriptorPool();
     void setDescriptorSets();
     void setPipeline();
-    void setCommand();
+    glm::mat4 getFrameMVP(uint32_t frame);
+    void setCommand(uint32_t frame);
     void saveImage();
+    void renderLoop();
 
-    void run();
+    void run(int argc, char **argv);
 };
\ No newline at end of file